@@ -1,15 +1,44 @@
+#include <climits>
+
+#include <QCache>
 #include <QCryptographicHash>
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QFile>
+#include <QFutureInterface>
+#include <QFutureWatcher>
 #include <QNetworkAccessManager>
 #include <QNetworkRequest>
+#include <QPointer>
+#include <QScopedPointer>
+#include <QSet>
+#include <QSharedPointer>
 #include <QStringList>
+#include <QThread>
+#include <QThreadPool>
+#include <QTimer>
 
 #include "qupyun.h"
+#include "qupyunbandwidthlimiter.h"
+#include "qupyunbandwidthlimiter_p.h"
+#include "qupyundiskcache.h"
+#include "qupyunsession.h"
+#include "qupyunsession_p.h"
+#include "qupyuntransport.h"
+#include "qupyuntransport_p.h"
+#ifndef QUPYUN_NO_IMAGE_PROCESSING
+#  include "qupyunimagejob_p.h"
+#endif
 
 static const char SEPARATOR = '/';
 static const QByteArray &MKDIR = QByteArray("folder");
 static const char * const SDK_VERSION = "1.0";
+static const qint64 THROTTLE_CHUNK = 64 * 1024;
+static const int TIMEOUT_TYPES = QUpYun::TOTAL_TIMEOUT + 1;
+static const int TIMEOUT_RESOLUTION = 100;
+static const int DEFAULT_BULK_CONCURRENCY = 8;
+static const int DEFAULT_TOKEN_EXPIRATION = 10 * 60;
+static const int MAX_KNOWN_SIZES = 100000;
 
 QByteArray QUpYun::extraParamHeader(QUpYun::ExtraParam param)
 {
@@ -65,30 +94,288 @@ enum API
     Mkdir,
     Rmdir,
     Ls,
+    LsCompact,
     Upload,
     Read,
+    ReadVersion, // Thumbnail version or with the file secret, only on the CDN.
     RemoveFile,
-    FileProp
+    FileProp,
+    CopyFile,
+    MoveFile,
+    CacheCheck
 }; // end of class API
 
-class QUpYun::Private : public QObject
+static inline bool isMetadataAPI(API api)
+{
+    return api != Upload && api != Read && api != ReadVersion;
+}
+
+/*
+ * Identical requests of these could share one round-trip.
+ */
+static inline bool isIdempotentAPI(API api)
+{
+    return api == BucketUsage || api == Mkdir || api == Ls || api == LsCompact
+            || api == Read || api == ReadVersion || api == FileProp;
+}
+
+static inline bool isMutatingAPI(API api)
+{
+    return api == Mkdir || api == Rmdir || api == Upload || api == RemoveFile
+            || api == CopyFile || api == MoveFile;
+}
+
+static inline QUpYunSession::OperationClass operationClass(API api)
+{
+    if (api == Upload) {
+        return QUpYunSession::Upload;
+    } else if (api == Read || api == ReadVersion) {
+        return QUpYunSession::Download;
+    }
+    return QUpYunSession::Metadata;
+}
+
+/*
+ * How a finished reply tells the session to adapt its limits.
+ */
+static QUpYunSessionClient::Outcome outcomeOf(QNetworkReply *reply)
+{
+    if (reply->error() == QNetworkReply::NoError) {
+        return QUpYunSessionClient::Succeeded;
+    }
+    int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (status == 429 || status == 503 || status == 504
+            || reply->error() == QNetworkReply::TimeoutError) {
+        return QUpYunSessionClient::Overloaded;
+    }
+    return QUpYunSessionClient::Failed;
+}
+
+/*
+ * Key of a request by operation, formatted path and parameters.
+ */
+static QString coalescingKey(API api,
+                             const QString &uri,
+                             bool autoMkdir,
+                             const QUpYun::RequestParams &params)
+{
+    QString key = QString::number(api) + QLatin1Char('\n') + uri;
+    if (autoMkdir) {
+        key += QLatin1String("\nmkdir");
+    }
+    QList<QByteArray> names = params.keys();
+    qSort(names);
+    foreach (const QByteArray &name, names) {
+        key += QLatin1Char('\n') + QString::fromUtf8(name)
+                + QLatin1Char('=') + params.value(name).toString();
+    }
+    return key;
+}
+
+static inline qulonglong parseNumber(const char *begin, const char *end)
+{
+    qulonglong number = 0;
+    for (; begin < end && *begin >= '0' && *begin <= '9'; ++begin) {
+        number = number * 10 + (*begin - '0');
+    }
+    return number;
+}
+
+/*
+ * Parses ls body, one item per line: NAME \t N|F \t SIZE \t DATE.
+ * Malformed lines are skipped.
+ */
+static QList<ItemInfo> parseItems(const QByteArray &data)
+{
+    QList<ItemInfo> infos;
+    infos.reserve(data.count('\n') + 1);
+    const char *begin = data.constData();
+    const char *end = begin + data.size();
+    while (begin < end) {
+        const char *fields[5];
+        int count = 0;
+        fields[count++] = begin;
+        const char *p = begin;
+        for (; p < end && *p != '\n'; ++p) {
+            if (*p == '\t' && count < 5) {
+                fields[count++] = p + 1;
+            }
+        }
+        if (count == 4) {
+            ItemInfo info;
+            info.name = QString::fromUtf8(fields[0], int(fields[1] - fields[0] - 1));
+            info.isFolder = fields[2] - fields[1] == 2 && (*fields[1] == 'F' || *fields[1] == 'f');
+            info.size = parseNumber(fields[2], fields[3] - 1);
+            info.date = QDateTime::fromTime_t(uint(parseNumber(fields[3], p)));
+            infos.append(info);
+        }
+        begin = p + 1;
+    }
+    return infos;
+}
+
+/*
+ * Returns the rest of file, mapped rather than read when possible. Then
+ * mapping is set to the file holding the mapping, which must outlive the
+ * data, or to 0 otherwise.
+ */
+static QByteArray mapFile(QFile *file, QFile **mapping)
+{
+    *mapping = 0;
+    qint64 offset = file->pos();
+    qint64 size = file->size() - offset;
+    if (size > 0 && size <= INT_MAX && !file->fileName().isEmpty()) {
+        QFile *mapped = new QFile(file->fileName());
+        uchar *memory = mapped->open(QFile::ReadOnly) ? mapped->map(offset, size) : 0;
+        if (memory) {
+            file->seek(offset + size);
+            *mapping = mapped;
+            return QByteArray::fromRawData(reinterpret_cast<const char *>(memory), int(size));
+        }
+        delete mapped;
+    }
+    return file->readAll();
+}
+
+typedef QSharedPointer<QFutureInterfaceBase> FuturePointer;
+
+template <typename T>
+static inline FuturePointer newFuture()
+{
+    QFutureInterface<T> *future = new QFutureInterface<T>();
+    future->reportStarted();
+    return FuturePointer(future);
+}
+
+template <typename T>
+static inline QFuture<T> futureOf(const FuturePointer &future)
+{
+    return static_cast<QFutureInterface<T> *>(future.data())->future();
+}
+
+template <typename T>
+static inline void reportResult(const FuturePointer &future, const T &result)
+{
+    QFutureInterface<T> *typed = static_cast<QFutureInterface<T> *>(future.data());
+    typed->reportResult(result);
+    typed->reportFinished();
+}
+
+static inline void reportFailure(const FuturePointer &future)
+{
+    future->reportCanceled();
+    future->reportFinished();
+}
+
+static inline bool isSameFuture(const FuturePointer &future, const QFuture<void> &operation)
+{
+    return QFuture<void>(future.data()) == operation;
+}
+
+/*
+ * Returns true if formatted path is prefix or under it.
+ */
+static inline bool isUnderPath(const QString &path, const QString &prefix)
+{
+    if (path == prefix) {
+        return true;
+    }
+    if (prefix.endsWith(QLatin1Char(SEPARATOR))) {
+        return path.startsWith(prefix);
+    }
+    return path.startsWith(prefix) && path.at(prefix.size()) == QLatin1Char(SEPARATOR);
+}
+
+struct QUpYunRequest
+{
+    API api;
+    QList<FuturePointer> futures; // Callers sharing the result, typed by api.
+    QNetworkAccessManager::Operation method;
+    QString path;         // Formatted path, the URI signed.
+    QByteArray data;      // Request body.
+    bool autoMkdir;
+    QUpYun::RequestParams params;
+    QString cacheKey;     // Set if the result goes to the disk cache waiters.
+    QString coalescingKey; // Set while later callers could join.
+    QPointer<QFile> mappedFile; // Holds the mapping data points to, if any.
+    bool viaDownloadDomain; // Read from the CDN, cleared to fall back to the API host.
+    uint ifModifiedSince; // Last modified time of the cached file revalidated by the CDN, or 0.
+
+    QNetworkReply *reply; // 0 until started.
+    QElapsedTimer clock;  // Since submitted.
+    qint64 startTime;     // Clock time started, -1 until then.
+    qint64 activityTime;  // Clock time of last progress, -1 until any.
+    int timeouts[TIMEOUT_TYPES]; // Milliseconds, 0 for none.
+
+    ~QUpYunRequest()
+    {
+        // once started the reply owns it, as the transport may still read
+        if (mappedFile && !mappedFile->parent()) {
+            delete mappedFile;
+        }
+    }
+};
+
+class QUpYun::Private : public QObject, public QUpYunSessionClient
 {
     Q_OBJECT
 public:
-    Private(QUpYun *upyun) :
+    Private(QUpYun *upyun, QUpYunSession *session) :
         QObject(upyun),
         q(upyun),
-        manager(new QNetworkAccessManager(this)),
-        apiDomain(QUpYun::ED_AUTO)
+        localImageProcessing(false),
+        nextImageJob(0),
+        usageTracking(false),
+        usageBase(0),
+        usageDelta(0),
+        dateSecond(-1),
+        apiDomain(QUpYun::ED_AUTO),
+        bulkConcurrency(DEFAULT_BULK_CONCURRENCY),
+        nextBulkJob(0),
+        thumbnailSeparator(QLatin1String("!")),
+        tokenExpiration(DEFAULT_TOKEN_EXPIRATION)
     {
-        connect(manager, SIGNAL(finished(QNetworkReply*)),
-                this, SLOT(requestFinished(QNetworkReply*)));
+        for (int i = 0; i < TIMEOUT_TYPES; ++i) {
+            timeouts[i] = 0;
+        }
+        sizes.setMaxCost(MAX_KNOWN_SIZES);
+        imagePool.setMaxThreadCount(QThread::idealThreadCount());
+        attach(session ? session : new QUpYunSession(this));
+        timeoutTimer.setInterval(TIMEOUT_RESOLUTION);
+        connect(&timeoutTimer, SIGNAL(timeout()),
+                this, SLOT(checkTimeouts()));
+        throttleTimer.setSingleShot(true);
+        connect(&throttleTimer, SIGNAL(timeout()),
+                this, SLOT(resumeThrottled()));
+        connect(&usageTimer, SIGNAL(timeout()),
+                this, SLOT(reconcileUsage()));
     }
 
     ~Private()
     {
+        // jobs call back into this object
+        imagePool.waitForDone();
+        // replies of a shared session outlive this object
+        foreach (QUpYunRequest *request, requests) {
+            disconnect(request->reply, 0, this, 0);
+            request->reply->abort();
+            request->reply->deleteLater();
+            failRequest(request);
+        }
+        QList<QUpYunRequest *> dropped = detach();
+        foreach (QUpYunRequest *request, dropped) {
+            failRequest(request);
+        }
+        qDeleteAll(requests);
+        qDeleteAll(dropped);
+        foreach (const BulkJob &job, bulkJobs) {
+            reportFailure(job.future);
+        }
     }
 
+    inline void setAccount(const QString &bucket,
+                           const QString &user,
+                           const QString &pass);
     inline QString upyunAPIDomain() const;
 
     QNetworkReply *sendRequest(QNetworkAccessManager::Operation method,
@@ -96,27 +383,177 @@ public:
                                const QByteArray &data = QByteArray(),
                                bool autoMkdir = false,
                                const RequestParams &params = RequestParams());
+    QNetworkReply *sendDownload(const QString &uri, bool version, uint ifModifiedSince);
+    QString signedUrl(const QString &uri, const QByteArray &expiration) const;
+    QUpYunRequest *sendUpload(const QString &path,
+                              const QByteArray &data,
+                              bool autoMkdir,
+                              bool appendFileMD5,
+                              const QString &fileSecret,
+                              const RequestParams &params,
+                              const FuturePointer &future,
+                              QFile *mappedFile = 0);
+    QUpYunRequest *newRequest(API api,
+                              const FuturePointer &future,
+                              QNetworkAccessManager::Operation method,
+                              const QString &uri,
+                              const QByteArray &data = QByteArray(),
+                              bool autoMkdir = false,
+                              const RequestParams &params = RequestParams()) const;
+    QUpYunRequest *submit(API api,
+                          const FuturePointer &future,
+                          QNetworkAccessManager::Operation method,
+                          const QString &uri,
+                          const QByteArray &data = QByteArray(),
+                          bool autoMkdir = false,
+                          const RequestParams &params = RequestParams());
+    template <typename T>
+    inline QFuture<T> submit(API api,
+                             QNetworkAccessManager::Operation method,
+                             const QString &uri,
+                             const QByteArray &data = QByteArray(),
+                             bool autoMkdir = false,
+                             const RequestParams &params = RequestParams())
+    {
+        FuturePointer future = newFuture<T>();
+        submit(api, future, method, uri, data, autoMkdir, params);
+        return futureOf<T>(future);
+    }
+    QFuture<bool> relocate(API api,
+                           const QString &source,
+                           const QString &dest,
+                           bool autoMkdir);
+    QFuture<bool> relocateAll(API api,
+                              const QList<QPair<QString, QString> > &paths,
+                              bool autoMkdir);
+    void fillBulk(int id);
+    void invalidate(const QString &path);
+    inline void enqueue(QUpYunRequest *request);
+    void start(QUpYunRequest *request);
+    void sessionDestroyed();
+    inline void failRequest(QUpYunRequest *request);
+
+    inline bool isLive(QUpYunRequest *request) const;
+    QUpYunRequest *findRequest(const QFuture<void> &operation, FuturePointer *future) const;
+    QUpYunRequest *findFetch(const QString &key) const;
+    inline void cancelFuture(const FuturePointer &future,
+                             QNetworkReply::NetworkError errorCode,
+                             const QString &errorMessage);
+    void abortRequest(QUpYunRequest *request,
+                      QNetworkReply::NetworkError errorCode,
+                      const QString &errorMessage);
+    inline void watchTimeouts(const QUpYunRequest *request);
+    void drainThrottled(QNetworkReply *reply);
+
+    inline void rememberSize(const QString &path, qulonglong size);
+    void accountUsage(qulonglong usage);
+    void accountUpload(const QString &path, qint64 size);
+    void accountRemoval(const QString &path);
+    void accountCopy(const QString &source, const QString &dest, bool move);
+
+    void downloadCached(const QString &key, API api, const FuturePointer &future);
+    void fetchCached(const QString &key, API api, uint ifModifiedSince = 0);
+    void deliverCached(const QString &key, const QByteArray &data);
+    void failCached(const QString &key,
+                    QNetworkReply::NetworkError errorCode,
+                    const QString &errorMessage);
 
     inline QString formatPath(const QString &path) const;
     inline QByteArray md5(const QByteArray &data) const;
     inline QByteArray getGMTDate() const;
     inline QByteArray signature(QNetworkAccessManager::Operation method,
-                                const QString &date,
+                                const QByteArray &date,
                                 const QString &uri,
                                 qlonglong length) const;
 
     QUpYun *q;
-    QNetworkAccessManager *manager;
-    QHash<QNetworkReply *, API> requests;
+    QSet<QUpYunRequest *> queued;                     // Waiting for the session.
+    QHash<QNetworkReply *, QUpYunRequest *> requests; // Started requests.
+    QHash<QString, QUpYunRequest *> inflight;         // Joinable requests by coalescing key.
+
+    QPointer<QUpYunBandwidthLimiter> limiter;  // Shared bandwidth limiter, maybe null.
+    QHash<QNetworkReply *, QByteArray> downloads; // Throttled data read so far.
+    QSet<QNetworkReply *> stalledReplies;         // Waiting for download tokens.
+    QTimer throttleTimer;
+
+    struct PendingImage
+    {
+        QString path;
+        QByteArray original;
+        bool autoMkdir;
+        bool appendFileMD5;
+        QString fileSecret;
+        RequestParams params;
+        FuturePointer future;
+        int timeouts[TIMEOUT_TYPES]; // Per-call timeouts, -1 for default.
+    };
+    bool localImageProcessing;
+    QThreadPool imagePool;
+    QHash<int, PendingImage> pendingImages; // Uploads waiting for local processing.
+    int nextImageJob;
+
+    bool usageTracking;
+    qulonglong usageBase;              // Usage returned by last ?usage request.
+    qint64 usageDelta;                 // Local changes since usageBase.
+    QElapsedTimer usageClock;          // Time since usageBase, invalid if never.
+    QTimer usageTimer;
+
+    int timeouts[TIMEOUT_TYPES]; // Defaults in milliseconds, 0 for none.
+    QTimer timeoutTimer;         // Runs while any request has a timeout.
+    QCache<QString, qulonglong> sizes; // Recently seen sizes of files by formatted path.
+
+    QPointer<QUpYunDiskCache> diskCache;
+    QHash<QString, QList<FuturePointer> > cacheWaiters; // Downloads sharing one fetch.
+    QList<QPair<QString, API> > freshHits;              // Served without validating.
 
     QString bucketName; // Bucket name.
     QString userName;   // User name.
-    QString password;   // User password after MD5.
+    QByteArray password; // User password after MD5.
+
+    QString bucketPrefix;            // "/" + bucket name.
+    QByteArray authorizationPrefix;  // "UpYun " + user name + ":".
+    mutable qint64 dateSecond;       // Second of cached Date header.
+    mutable QByteArray gmtDate;      // Cached Date header.
 
     QUpYun::EndPoint apiDomain; // API end point.
 
-private slots:
+    struct BulkJob
+    {
+        API api;
+        QList<QPair<QString, QString> > paths; // Source and destination.
+        bool autoMkdir;
+        int next;      // Index of the next pair to start.
+        int running;
+        int finished;
+        FuturePointer future; // One result per pair, by index.
+    };
+    struct BulkItem
+    {
+        int job;
+        int index;
+    };
+    int bulkConcurrency;
+    QHash<int, BulkJob> bulkJobs;
+    QHash<QFutureWatcher<bool> *, BulkItem> bulkItems; // Running pairs.
+    int nextBulkJob;
+
+    QString downloadDomain;     // CDN domain of downloads, empty for the API host.
+    QString thumbnailSeparator; // Between a path and its version or secret.
+    QByteArray tokenSecret;     // Anti-leech token secret, empty if none.
+    int tokenExpiration;        // Seconds signed URLs stay valid.
+
     void requestFinished(QNetworkReply *reply);
+
+private slots:
+    void replyFinished();
+    void replyProgress();
+    void checkTimeouts();
+    void readThrottled();
+    void resumeThrottled();
+    void imageProcessed(int id, const QByteArray &data);
+    void reconcileUsage();
+    void serveFreshHits();
+    void bulkItemFinished();
 }; // end of class QUpYun::Private
 
 
@@ -133,11 +570,34 @@ QUpYun::QUpYun(const QString &bucketName,
                const QString &password,
                QObject *parent) :
     QObject(parent),
-    d(new Private(this))
+    d(new Private(this, 0))
+{
+    d->setAccount(bucketName, userName, password);
+}
+
+/*!
+ * \brief Constructs an instance of QUpYun sending requests through \a session.
+ *
+ * The bucket name is \a bucketName, user name is \a userName and
+ * password is \a password. Instances for different buckets and accounts
+ * could share one session, and with it connections and the limit of
+ * requests in flight. QUpYun does not take the ownership of \a session.
+ * If \a session is deleted first, unfinished requests are canceled and
+ * later requests go through a private one.
+ *
+ * \note Password need not compute MD5 value.
+ *
+ * \sa QUpYunSession
+ */
+QUpYun::QUpYun(QUpYunSession *session,
+               const QString &bucketName,
+               const QString &userName,
+               const QString &password,
+               QObject *parent) :
+    QObject(parent),
+    d(new Private(this, session))
 {
-    d->bucketName = bucketName;
-    d->userName = userName;
-    d->password = QString(d->md5(password.toUtf8()));
+    d->setAccount(bucketName, userName, password);
 }
 
 /*!
@@ -173,279 +633,1698 @@ inline QUpYun::EndPoint QUpYun::apiDomain() const
 }
 
 /*!
- * \brief Gets the usage of this bucket.
+ * \brief Returns the session requests are sent through.
  *
- * \sa QUpYun::requestBucketUsageFinished(qulonglong)
+ * It is a private one if no session was given to the constructor.
  */
-void QUpYun::bucketUsage()
+QUpYunSession *QUpYun::session() const
 {
-    QNetworkReply *reply = d->sendRequest(QNetworkAccessManager::GetOperation,
-                                          QString("%1?usage").arg(d->formatPath("/")));
-    d->requests.insert(reply, BucketUsage);
+    return d->session();
 }
 
 /*!
- * \brief Makes a directory at \a path.
+ * \brief Sets bandwidth \a limiter for transfers of this instance.
  *
- * Sets \a autoMkdir to true if auto mkdir needed.
+ * The same limiter could be shared by several instances. Sets \a limiter to
+ * 0 to remove the limits. QUpYun does not take the ownership of \a limiter.
  *
- * \sa QUpYun::requestMkdirFinished(bool)
+ * \sa QUpYunBandwidthLimiter
  */
-void QUpYun::mkdir(const QString &path, bool autoMkdir)
+void QUpYun::setBandwidthLimiter(QUpYunBandwidthLimiter *limiter)
 {
-    RequestParams params;
-    params.insert(MKDIR, QLatin1String("true"));
-    QNetworkReply *reply = d->sendRequest(QNetworkAccessManager::PutOperation,
-                                          d->formatPath(path),
-                                          QByteArray(),
-                                          autoMkdir,
-                                          params);
-    d->requests.insert(reply, Mkdir);
+    if (d->limiter) {
+        disconnect(d->limiter, 0, d, 0);
+    }
+    d->limiter = limiter;
+    if (limiter) {
+        connect(limiter, SIGNAL(rateChanged(QUpYunBandwidthLimiter::Direction)),
+                d, SLOT(resumeThrottled()));
+    }
 }
 
 /*!
- * \brief Removes directory at \a path.
+ * \brief Returns current bandwidth limiter, 0 if there is none.
+ */
+QUpYunBandwidthLimiter *QUpYun::bandwidthLimiter() const
+{
+    return d->limiter;
+}
+
+/*!
+ * \brief Sets whether pictures are processed locally before upload to \a enabled.
  *
- * \sa QUpYun::requestRmdirFinished(bool)
+ * If enabled, the thumbnail (\c X_GMKERL_TYPE with \c X_GMKERL_VALUE),
+ * \c X_GMKERL_CROP, \c X_GMKERL_ROTATE and \c X_GMKERL_QUALITY parameters
+ * given to uploadFile() are applied by a thread pool sized to the CPU cores
+ * and only the processed picture is uploaded. EXIF is stripped from the
+ * processed picture, so pictures uploaded with \c X_GMKERL_EXIF_SWITCH set to
+ * \c true are left to UpYun. Pictures which could not be decoded are
+ * uploaded as is with the original parameters.
+ *
+ * Local processing needs Qt 5.5 or later and a build with
+ * \c {CONFIG += qupyun_image}; it is disabled by default.
+ *
+ * \sa QUpYun::uploadFile(const QString &, QFile *, bool, bool, const QString &, const RequestParams &)
  */
-void QUpYun::rmdir(const QString &path)
+void QUpYun::setLocalImageProcessing(bool enabled)
 {
-    QNetworkReply *reply = d->sendRequest(QNetworkAccessManager::DeleteOperation,
-                                          d->formatPath(path));
-    d->requests.insert(reply, Rmdir);
+    d->localImageProcessing = enabled;
 }
 
 /*!
- * \brief Lists directory at \a path.
+ * \brief Returns true if pictures are processed locally before upload.
  */
-void QUpYun::ls(const QString &path)
+bool QUpYun::localImageProcessing() const
 {
-    QNetworkReply *reply = d->sendRequest(QNetworkAccessManager::GetOperation,
-                                          path.endsWith(SEPARATOR)
-                                            ? d->formatPath(path)
-                                            : d->formatPath(path) + SEPARATOR);
-    d->requests.insert(reply, Ls);
+    return d->localImageProcessing;
 }
 
 /*!
- * \brief Uploads a file at \a localPath to \a path.
- *
- * \a Path should start with '/', append by bucket name and file path.
- * eg: /demobucket/upload.png. If the path is a directory, it MUST end with '/'.
+ * \brief Sets whether the bucket usage is tracked locally to \a enabled.
  *
- * Sets \a autoMkdir to true if auto mkdir needed (10 at most).
+ * If enabled, QUpYun keeps an estimate of the bucket usage from its own
+ * successful uploads and removals, using sizes of files it has seen from
+ * uploadFile(), fileInfo() and ls() to account overwrites and removals. Only
+ * the 100000 most recently seen sizes are kept; changes of other files are
+ * corrected by the next reconciliation. The estimate is reconciled with the
+ * server by every bucketUsage() request, including those made by
+ * setUsageReconcileInterval().
  *
- * Sets \a appendFileMD5 to true if append file MD5 value needed. If this value
- * is different from the server computed, 406 Not Accepted will be recieved.
+ * Disabled by default.
  *
- * Sets \a fileSecret as file secret key. ONLY picture spaces support secret.
- * If this is set, the file could not access directly by URL,
- * use THUMB_SEPERATOR + SECRET instead. eg, if THUMB_SEPERATOR is "!",
- * secret is "bac" and file upload path is "/folder/test.jpg", the image accessed
- * URL will be http://BUCKET/folder/test.jpg!bac.
+ * \sa QUpYun::usageEstimate()
+ */
+void QUpYun::setUsageTracking(bool enabled)
+{
+    d->usageTracking = enabled;
+    if (!enabled) {
+        d->sizes.clear();
+        d->usageTimer.stop();
+    } else if (d->usageTimer.interval() > 0) {
+        d->usageTimer.start();
+    }
+}
+
+/*!
+ * \brief Returns true if the bucket usage is tracked locally.
+ */
+bool QUpYun::usageTracking() const
+{
+    return d->usageTracking;
+}
+
+/*!
+ * \brief Sets the bucket usage to be reconciled with the server every \a msecs.
  *
- * Extra parameters should be stored in \a params.
+ * Sets \a msecs to 0 to reconcile only by explicit bucketUsage() calls,
+ * which is the default. Only used when usage tracking is enabled.
+ */
+void QUpYun::setUsageReconcileInterval(int msecs)
+{
+    d->usageTimer.setInterval(qMax(0, msecs));
+    if (msecs > 0 && d->usageTracking) {
+        d->usageTimer.start();
+    } else {
+        d->usageTimer.stop();
+    }
+}
+
+/*!
+ * \brief Returns the interval in milliseconds the usage is reconciled.
+ */
+int QUpYun::usageReconcileInterval() const
+{
+    return d->usageTimer.interval();
+}
+
+/*!
+ * \brief Returns the estimated bucket usage in bytes without any request.
  *
- * \sa QUpYun::uploadFile(const QString &, QFile *, bool, bool, const QString &, const RequestParams &)
- * \sa QUpYun::requestUploadFinished(bool, const PicInfo &)
+ * \sa QUpYun::usageStaleness()
  */
-void QUpYun::uploadFile(const QString &path,
-                        const QString &localPath,
-                        bool autoMkdir,
-                        bool appendFileMD5,
-                        const QString &fileSecret,
-                        const RequestParams &params)
+qulonglong QUpYun::usageEstimate() const
 {
-    QFile file(localPath);
-    uploadFile(path, &file, autoMkdir, appendFileMD5, fileSecret, params);
+    qint64 estimate = qint64(d->usageBase) + d->usageDelta;
+    return estimate > 0 ? qulonglong(estimate) : 0;
 }
 
 /*!
- * \brief Uploads a \a file to \a path.
+ * \brief Returns milliseconds since the estimate was last reconciled.
  *
- * \a Path should start with '/', append by bucket name and file path.
- * eg: /demobucket/upload.png. If the path is a directory, it MUST end with '/'.
+ * Returns -1 if the usage has never been got from the server, in which case
+ * usageEstimate() only holds the changes made by this instance.
+ */
+qint64 QUpYun::usageStaleness() const
+{
+    return d->usageClock.isValid() ? d->usageClock.elapsed() : -1;
+}
+
+/*!
+ * \brief Sets disk \a cache for downloadFile().
  *
- * Sets \a autoMkdir to true if auto mkdir needed (10 at most).
+ * Cached files are validated against the size and date returned by a HEAD
+ * request before being served, unless they have been validated within
+ * QUpYunDiskCache::validationInterval(). Simultaneous downloads of the same
+ * path share one request. Sets \a cache to 0 to disable caching. QUpYun does
+ * not take the ownership of \a cache.
  *
- * Sets \a appendFileMD5 to true if append file MD5 value needed. If this value
- * is different from the server computed, 406 Not Accepted will be recieved.
+ * \sa QUpYunDiskCache
+ */
+void QUpYun::setDiskCache(QUpYunDiskCache *cache)
+{
+    d->diskCache = cache;
+}
+
+/*!
+ * \brief Returns current disk cache, 0 if there is none.
+ */
+QUpYunDiskCache *QUpYun::diskCache() const
+{
+    return d->diskCache;
+}
+
+/*!
+ * \brief Downloads files from the CDN \a domain of the bucket.
  *
- * Sets \a fileSecret as file secret key. ONLY picture spaces support secret.
- * If this is set, the file could not access directly by URL,
- * use THUMB_SEPERATOR + SECRET instead. eg, if THUMB_SEPERATOR is "!",
- * secret is "bac" and file upload path is "/folder/test.jpg", the image accessed
- * URL will be http://BUCKET/folder/test.jpg!bac.
+ * \a domain is the default domain of the bucket, e.g.
+ * "bucket.b0.upaiyun.com", or a custom one bound to it. The CDN is built
+ * for reads, so it is faster and less rate limited than the API host.
+ * Downloads are sent to it without credentials, signed by an anti-leech
+ * token if a token secret is set. A download the CDN fails with an error
+ * other than 404 is retried once by the API host, unless it is of a version
+ * only the CDN serves. Sets \a domain to an empty string to
+ * download by the API host only, which is the default.
  *
- * Extra parameters should be stored in \a params.
+ * Requests to the CDN are limited by the session apart from those to the
+ * API host, see QUpYunSession::setAdaptiveConcurrency(bool).
  *
- * \sa QUpYun::uploadFile(const QString &, const QString &, bool, bool, const QString &, const RequestParams &)
- * \sa QUpYun::requestUploadFinished(bool, const PicInfo &)
+ * \sa QUpYun::setTokenSecret(const QString &), QUpYun::downloadUrl(const QString &, const QString &) const
  */
-void QUpYun::uploadFile(const QString &path,
-                        QFile *file,
-                        bool autoMkdir,
-                        bool appendFileMD5,
-                        const QString &fileSecret,
-                        const RequestParams &params)
+void QUpYun::setDownloadDomain(const QString &domain)
 {
-    if (!file->isOpen()) {
-        file->open(QFile::ReadOnly);
-    }
-    RequestParams newParams(params);
-    QByteArray data = file->readAll();
-    if (appendFileMD5) {
-        static QByteArray CONTENT_MD5("Content-MD5");
-        newParams.insert(CONTENT_MD5, d->md5(data));
-    }
-    if (!fileSecret.isEmpty()) {
-        static QByteArray CONTENT_SECRET("Content-Secret");
-        newParams.insert(CONTENT_SECRET, fileSecret.toUtf8());
-    }
-    QNetworkReply *reply = d->sendRequest(QNetworkAccessManager::PutOperation,
-                                          d->formatPath(path),
-                                          data,
-                                          autoMkdir,
-                                          newParams);
-    d->requests.insert(reply, Upload);
+    d->downloadDomain = domain.trimmed();
 }
 
 /*!
- * \brief Downloads file from \a path.
- *
- * \sa QUpYun::requestDownloadFinished(const QByteArray &)
+ * \brief Returns the CDN domain of downloads, empty if there is none.
  */
-void QUpYun::downloadFile(const QString &path)
+QString QUpYun::downloadDomain() const
 {
-    QNetworkReply *reply = d->sendRequest(QNetworkAccessManager::GetOperation,
-                                          d->formatPath(path));
-    d->requests.insert(reply, Read);
+    return d->downloadDomain;
 }
 
 /*!
- * \brief Removes file at \a filePath.
+ * \brief Sets the \a separator between a path and its thumbnail version or
+ * file secret.
  *
- * \sa QUpYun::requestRemoveFileFinished(bool)
+ * It must match the separator set for the bucket. It is "!" by default.
  */
-void QUpYun::removeFile(const QString &filePath)
+void QUpYun::setThumbnailSeparator(const QString &separator)
 {
-    QNetworkReply *reply = d->sendRequest(QNetworkAccessManager::DeleteOperation,
-                                          d->formatPath(filePath));
-    d->requests.insert(reply, RemoveFile);
+    d->thumbnailSeparator = separator;
 }
 
 /*!
- * \brief Gets information of the file at \a filePath.
+ * \brief Returns the separator between a path and its thumbnail version or file secret.
+ */
+QString QUpYun::thumbnailSeparator() const
+{
+    return d->thumbnailSeparator;
+}
+
+/*!
+ * \brief Sets the token \a secret of the anti-leech protection of the bucket.
  *
- * \sa QUpYun::requestFileInfoFinished(const FileInfo &)
+ * When it is set, URLs of the download domain carry the \c _upt token,
+ * made of the 8 characters of MD5(secret&etime&URI) from the 12th and the
+ * expiration time etime. Tokens are made locally, without any request.
+ * Sets \a secret to an empty string for unsigned URLs.
+ *
+ * \sa QUpYun::setTokenExpiration(int)
  */
-void QUpYun::fileInfo(const QString &filePath)
+void QUpYun::setTokenSecret(const QString &secret)
 {
-    QNetworkReply *reply = d->sendRequest(QNetworkAccessManager::HeadOperation,
-                                          d->formatPath(filePath));
-    d->requests.insert(reply, FileProp);
+    d->tokenSecret = secret.toUtf8();
 }
 
-#include "qupyun.moc"
+/*!
+ * \brief Sets the seconds signed URLs stay valid to \a secs.
+ *
+ * It is 600 by default.
+ */
+void QUpYun::setTokenExpiration(int secs)
+{
+    d->tokenExpiration = qMax(1, secs);
+}
 
-QString QUpYun::Private::upyunAPIDomain() const
+/*!
+ * \brief Returns the seconds signed URLs stay valid.
+ */
+int QUpYun::tokenExpiration() const
 {
-    switch (apiDomain) {
-    case QUpYun::ED_AUTO:
-        return QLatin1String("v0.api.upyun.com");
-    case QUpYun::ED_TELECOM:
-        return QLatin1String("v1.api.upyun.com");
-    case QUpYun::ED_CNC:
-        return QLatin1String("v2.api.upyun.com");
-    case QUpYun::ED_CTT:
-        return QLatin1String("v3.api.upyun.com");
-    default:
-        return QLatin1String("");
-    }
+    return d->tokenExpiration;
 }
 
-QNetworkReply * QUpYun::Private::sendRequest(QNetworkAccessManager::Operation method,
-                                            const QString &uri,
-                                            const QByteArray &data,
-                                            bool autoMkdir,
-                                            const RequestParams &params)
+/*!
+ * \brief Returns the URL of the file at \a path on the download domain.
+ *
+ * A non-empty \a suffix, a thumbnail version or the file secret, is
+ * appended after thumbnailSeparator(). The URL is signed if a token secret
+ * is set, so it could be handed to a browser or a player.
+ *
+ * Returns an empty string if no download domain is set.
+ *
+ * \sa QUpYun::downloadUrls(const QStringList &, const QString &) const
+ */
+QString QUpYun::downloadUrl(const QString &path, const QString &suffix) const
 {
-    Q_ASSERT(method == QNetworkAccessManager::GetOperation
-             || method == QNetworkAccessManager::PutOperation
-             || method == QNetworkAccessManager::HeadOperation
-             || method == QNetworkAccessManager::DeleteOperation);
+    return downloadUrls(QStringList(path), suffix).value(0);
+}
 
-    static QByteArray DATE("Date");
-    static QByteArray AUTHORIZATION("Authorization");
-    static QByteArray MKDIR("mkdir");
+/*!
+ * \brief Returns the URLs of the files at \a paths on the download domain.
+ *
+ * Same as downloadUrl(), for many files at once: they share the same
+ * expiration time, so signing costs one MD5 per URL.
+ */
+QStringList QUpYun::downloadUrls(const QStringList &paths, const QString &suffix) const
+{
+    QStringList urls;
+    if (d->downloadDomain.isEmpty()) {
+        return urls;
+    }
+    QByteArray expiration;
+    if (!d->tokenSecret.isEmpty()) {
+        uint now = QDateTime::currentDateTime().toTime_t();
+        expiration = QByteArray::number(now + uint(d->tokenExpiration));
+    }
+    urls.reserve(paths.size());
+    foreach (const QString &path, paths) {
+        QString uri = d->formatPath(path);
+        if (!suffix.isEmpty()) {
+            uri += d->thumbnailSeparator + suffix;
+        }
+        urls.append(d->signedUrl(uri, expiration));
+    }
+    return urls;
+}
+
+/*!
+ * \brief Sets the default timeout of \a type to \a msecs for later operations.
+ *
+ * \c CONNECT_TIMEOUT bounds the time from a request being sent until it
+ * makes any progress, \c IDLE_TIMEOUT the time a started transfer makes no
+ * progress, and \c TOTAL_TIMEOUT the whole operation including the time it
+ * waits for a free connection. An operation exceeding any of them is
+ * aborted and fails with \c QNetworkReply::TimeoutError. Sets \a msecs to 0
+ * for no timeout, which is the default of all types.
+ *
+ * \note Time spent processing pictures locally is not counted.
+ *
+ * \sa QUpYun::setTimeout(const QFuture<void> &, Timeout, int)
+ */
+void QUpYun::setTimeout(Timeout type, int msecs)
+{
+    d->timeouts[type] = qMax(0, msecs);
+}
+
+/*!
+ * \brief Returns the default timeout of \a type in milliseconds, 0 if none.
+ */
+int QUpYun::timeout(Timeout type) const
+{
+    return d->timeouts[type];
+}
+
+/*!
+ * \brief Sets the timeout of \a type to \a msecs for the unfinished \a operation.
+ *
+ * \a operation is a future returned by QUpYun. Operations sharing one
+ * request get the same timeout. The total timeout still counts from the
+ * call which returned \a operation.
+ *
+ * Returns false if \a operation has finished or does not belong to this
+ * instance.
+ *
+ * \sa QUpYun::setTimeout(Timeout, int)
+ */
+bool QUpYun::setTimeout(const QFuture<void> &operation, Timeout type, int msecs)
+{
+    msecs = qMax(0, msecs);
+    QHash<int, Private::PendingImage>::iterator i = d->pendingImages.begin();
+    for (; i != d->pendingImages.end(); ++i) {
+        if (isSameFuture(i.value().future, operation)) {
+            i.value().timeouts[type] = msecs;
+            return true;
+        }
+    }
+    QHash<QString, QList<FuturePointer> >::const_iterator c = d->cacheWaiters.constBegin();
+    for (; c != d->cacheWaiters.constEnd(); ++c) {
+        foreach (const FuturePointer &future, c.value()) {
+            if (isSameFuture(future, operation)) {
+                QUpYunRequest *fetch = d->findFetch(c.key());
+                if (!fetch) {
+                    // served from the cache right away
+                    return false;
+                }
+                fetch->timeouts[type] = msecs;
+                d->watchTimeouts(fetch);
+                return true;
+            }
+        }
+    }
+    FuturePointer future;
+    QUpYunRequest *request = d->findRequest(operation, &future);
+    if (!request) {
+        return false;
+    }
+    request->timeouts[type] = msecs;
+    d->watchTimeouts(request);
+    return true;
+}
+
+/*!
+ * \brief Cancels the unfinished \a operation.
+ *
+ * \a operation is a future returned by QUpYun. The request is removed from
+ * the session queue, or aborted if it has been sent, and its buffers are
+ * freed, unless other identical operations still share it. \a operation is
+ * canceled and QUpYun::requestError(QNetworkReply::NetworkError, const QString &)
+ * is emitted with \c QNetworkReply::OperationCanceledError.
+ *
+ * Returns false if \a operation has finished or does not belong to this
+ * instance.
+ *
+ * \sa QUpYun::cancelAll(const QString &)
+ */
+bool QUpYun::cancel(const QFuture<void> &operation)
+{
+    QString message = tr("Operation canceled");
+    QMutableHashIterator<int, Private::PendingImage> i(d->pendingImages);
+    while (i.hasNext()) {
+        i.next();
+        if (isSameFuture(i.value().future, operation)) {
+            // the job result is ignored
+            FuturePointer future = i.value().future;
+            i.remove();
+            d->cancelFuture(future, QNetworkReply::OperationCanceledError, message);
+            return true;
+        }
+    }
+    QMutableHashIterator<QString, QList<FuturePointer> > c(d->cacheWaiters);
+    while (c.hasNext()) {
+        c.next();
+        QList<FuturePointer> &waiters = c.value();
+        for (int j = 0; j < waiters.size(); ++j) {
+            if (!isSameFuture(waiters.at(j), operation)) {
+                continue;
+            }
+            FuturePointer future = waiters.takeAt(j);
+            if (waiters.isEmpty()) {
+                QString key = c.key();
+                c.remove();
+                QUpYunRequest *fetch = d->findFetch(key);
+                if (fetch) {
+                    d->abortRequest(fetch, QNetworkReply::OperationCanceledError, message);
+                }
+            }
+            d->cancelFuture(future, QNetworkReply::OperationCanceledError, message);
+            return true;
+        }
+    }
+    QHash<int, Private::BulkJob>::iterator b = d->bulkJobs.begin();
+    for (; b != d->bulkJobs.end(); ++b) {
+        if (!isSameFuture(b.value().future, operation)) {
+            continue;
+        }
+        // the job finishes once its running pairs have
+        int id = b.key();
+        b.value().future->reportCanceled();
+        QList<QFutureWatcher<bool> *> watchers = d->bulkItems.keys();
+        foreach (QFutureWatcher<bool> *watcher, watchers) {
+            if (d->bulkItems.value(watcher).job == id) {
+                cancel(QFuture<void>(watcher->future()));
+            }
+        }
+        d->fillBulk(id);
+        return true;
+    }
+    FuturePointer future;
+    QUpYunRequest *request = d->findRequest(operation, &future);
+    if (!request) {
+        return false;
+    }
+    request->futures.removeOne(future);
+    if (request->futures.isEmpty()) {
+        d->abortRequest(request, QNetworkReply::OperationCanceledError, message);
+    }
+    d->cancelFuture(future, QNetworkReply::OperationCanceledError, message);
+    return true;
+}
+
+/*!
+ * \brief Cancels all unfinished operations on \a path or under it.
+ *
+ * Cancels every operation of this instance if \a path is empty. Works as
+ * cancel() on each of them. Returns the number of operations canceled.
+ *
+ * \sa QUpYun::cancel(const QFuture<void> &)
+ */
+int QUpYun::cancelAll(const QString &path)
+{
+    QString prefix = d->formatPath(path);
+    QString message = tr("Operation canceled");
+    QList<FuturePointer> canceled;
+
+    QMutableHashIterator<int, Private::PendingImage> i(d->pendingImages);
+    while (i.hasNext()) {
+        i.next();
+        if (isUnderPath(d->formatPath(i.value().path), prefix)) {
+            canceled.append(i.value().future);
+            i.remove();
+        }
+    }
+
+    QStringList keys = d->cacheWaiters.keys();
+    foreach (const QString &key, keys) {
+        if (!isUnderPath(key, prefix)) {
+            continue;
+        }
+        canceled += d->cacheWaiters.take(key);
+        QUpYunRequest *fetch = d->findFetch(key);
+        if (fetch) {
+            d->abortRequest(fetch, QNetworkReply::OperationCanceledError, message);
+        }
+    }
+
+    QList<QUpYunRequest *> live = d->queued.toList() + d->requests.values();
+    foreach (QUpYunRequest *request, live) {
+        if (request->cacheKey.isEmpty() && isUnderPath(request->path, prefix)) {
+            // signals are emitted once all are aborted
+            canceled += request->futures;
+            request->futures.clear();
+            d->abortRequest(request, QNetworkReply::OperationCanceledError, message);
+        }
+    }
+
+    foreach (const FuturePointer &future, canceled) {
+        d->cancelFuture(future, QNetworkReply::OperationCanceledError, message);
+    }
+    return canceled.size();
+}
+
+/*!
+ * \brief Gets the usage of this bucket.
+ *
+ * Returns a future holding the usage in bytes. As all the futures returned
+ * by QUpYun, it is canceled if the request fails; the error is reported by
+ * QUpYun::requestError(QNetworkReply::NetworkError, const QString &).
+ *
+ * \sa QUpYun::requestBucketUsageFinished(qulonglong)
+ */
+QFuture<qulonglong> QUpYun::bucketUsage()
+{
+    return d->submit<qulonglong>(BucketUsage,
+                                 QNetworkAccessManager::GetOperation,
+                                 QString("%1?usage").arg(d->formatPath("/")));
+}
+
+/*!
+ * \brief Makes a directory at \a path.
+ *
+ * Sets \a autoMkdir to true if auto mkdir needed.
+ *
+ * Returns a future holding whether the directory is made.
+ *
+ * \sa QUpYun::requestMkdirFinished(bool)
+ */
+QFuture<bool> QUpYun::mkdir(const QString &path, bool autoMkdir)
+{
+    RequestParams params;
+    params.insert(MKDIR, QLatin1String("true"));
+    return d->submit<bool>(Mkdir,
+                           QNetworkAccessManager::PutOperation,
+                           d->formatPath(path),
+                           QByteArray(),
+                           autoMkdir,
+                           params);
+}
+
+/*!
+ * \brief Removes directory at \a path.
+ *
+ * Returns a future holding whether the directory is removed.
+ *
+ * \sa QUpYun::requestRmdirFinished(bool)
+ */
+QFuture<bool> QUpYun::rmdir(const QString &path)
+{
+    return d->submit<bool>(Rmdir,
+                           QNetworkAccessManager::DeleteOperation,
+                           d->formatPath(path));
+}
+
+/*!
+ * \brief Lists directory at \a path.
+ *
+ * Returns a future holding the items in the directory.
+ *
+ * \sa QUpYun::requestLsFinished(const QList<ItemInfo> &)
+ */
+QFuture<QList<ItemInfo> > QUpYun::ls(const QString &path)
+{
+    return d->submit<QList<ItemInfo> >(Ls,
+                                       QNetworkAccessManager::GetOperation,
+                                       path.endsWith(SEPARATOR)
+                                         ? d->formatPath(path)
+                                         : d->formatPath(path) + SEPARATOR);
+}
+
+/*!
+ * \brief Lists directory at \a path into a compact list.
+ *
+ * Same as ls(), but the items are kept in a QUpYunItemList, which takes a
+ * fraction of the memory of a QList<ItemInfo> for large directories. The
+ * directory of the items is \a path in the bucket, such as "/folder/".
+ *
+ * Returns a future holding the items in the directory.
+ *
+ * \sa QUpYun::requestLsCompactFinished(const QUpYunItemList &)
+ */
+QFuture<QUpYunItemList> QUpYun::lsCompact(const QString &path)
+{
+    return d->submit<QUpYunItemList>(LsCompact,
+                                     QNetworkAccessManager::GetOperation,
+                                     path.endsWith(SEPARATOR)
+                                       ? d->formatPath(path)
+                                       : d->formatPath(path) + SEPARATOR);
+}
+
+/*!
+ * \brief Uploads a file at \a localPath to \a path.
+ *
+ * \a Path should start with '/', append by bucket name and file path.
+ * eg: /demobucket/upload.png. If the path is a directory, it MUST end with '/'.
+ *
+ * Sets \a autoMkdir to true if auto mkdir needed (10 at most).
+ *
+ * Sets \a appendFileMD5 to true if append file MD5 value needed. If this value
+ * is different from the server computed, 406 Not Accepted will be recieved.
+ *
+ * Sets \a fileSecret as file secret key. ONLY picture spaces support secret.
+ * If this is set, the file could not access directly by URL,
+ * use THUMB_SEPERATOR + SECRET instead. eg, if THUMB_SEPERATOR is "!",
+ * secret is "bac" and file upload path is "/folder/test.jpg", the image accessed
+ * URL will be http://BUCKET/folder/test.jpg!bac.
+ *
+ * Extra parameters should be stored in \a params.
+ *
+ * Returns a future holding the picture information.
+ *
+ * \sa QUpYun::uploadFile(const QString &, QFile *, bool, bool, const QString &, const RequestParams &)
+ * \sa QUpYun::requestUploadFinished(bool, const PicInfo &)
+ */
+QFuture<PicInfo> QUpYun::uploadFile(const QString &path,
+                                    const QString &localPath,
+                                    bool autoMkdir,
+                                    bool appendFileMD5,
+                                    const QString &fileSecret,
+                                    const RequestParams &params)
+{
+    QFile file(localPath);
+    return uploadFile(path, &file, autoMkdir, appendFileMD5, fileSecret, params);
+}
+
+/*!
+ * \brief Uploads a \a file to \a path.
+ *
+ * \a Path should start with '/', append by bucket name and file path.
+ * eg: /demobucket/upload.png. If the path is a directory, it MUST end with '/'.
+ *
+ * Sets \a autoMkdir to true if auto mkdir needed (10 at most).
+ *
+ * Sets \a appendFileMD5 to true if append file MD5 value needed. If this value
+ * is different from the server computed, 406 Not Accepted will be recieved.
+ *
+ * Sets \a fileSecret as file secret key. ONLY picture spaces support secret.
+ * If this is set, the file could not access directly by URL,
+ * use THUMB_SEPERATOR + SECRET instead. eg, if THUMB_SEPERATOR is "!",
+ * secret is "bac" and file upload path is "/folder/test.jpg", the image accessed
+ * URL will be http://BUCKET/folder/test.jpg!bac.
+ *
+ * Extra parameters should be stored in \a params.
+ *
+ * The rest of \a file from its position is mapped rather than read when
+ * possible, so the file must not change until the upload has finished.
+ *
+ * Returns a future holding the picture information.
+ *
+ * \sa QUpYun::uploadFile(const QString &, const QString &, bool, bool, const QString &, const RequestParams &)
+ * \sa QUpYun::requestUploadFinished(bool, const PicInfo &)
+ */
+QFuture<PicInfo> QUpYun::uploadFile(const QString &path,
+                                    QFile *file,
+                                    bool autoMkdir,
+                                    bool appendFileMD5,
+                                    const QString &fileSecret,
+                                    const RequestParams &params)
+{
+    FuturePointer future = newFuture<PicInfo>();
+    if (!file->isOpen()) {
+        file->open(QFile::ReadOnly);
+    }
+#ifndef QUPYUN_NO_IMAGE_PROCESSING
+    if (d->localImageProcessing && QUpYunImageJob::accepts(params)) {
+        QByteArray data = file->readAll();
+        int id = d->nextImageJob++;
+        Private::PendingImage &pending = d->pendingImages[id];
+        pending.path = path;
+        pending.original = data;
+        pending.autoMkdir = autoMkdir;
+        pending.appendFileMD5 = appendFileMD5;
+        pending.fileSecret = fileSecret;
+        pending.params = params;
+        pending.future = future;
+        for (int i = 0; i < TIMEOUT_TYPES; ++i) {
+            pending.timeouts[i] = -1;
+        }
+        d->imagePool.start(new QUpYunImageJob(d, id, data, params));
+        return futureOf<PicInfo>(future);
+    }
+#endif
+    QFile *mappedFile = 0;
+    QByteArray data = mapFile(file, &mappedFile);
+    d->sendUpload(path, data, autoMkdir, appendFileMD5, fileSecret, params, future, mappedFile);
+    return futureOf<PicInfo>(future);
+}
+
+/*!
+ * \brief Downloads file from \a path.
+ *
+ * Returns a future holding the file content.
+ *
+ * \sa QUpYun::requestDownloadFinished(const QByteArray &)
+ */
+QFuture<QByteArray> QUpYun::downloadFile(const QString &path)
+{
+    return downloadFile(path, QString());
+}
+
+/*!
+ * \brief Downloads the version of file at \a path named by \a suffix.
+ *
+ * \a suffix is a thumbnail version or the file secret, appended to \a path
+ * after thumbnailSeparator(), as in "/folder/test.jpg!small". Such files
+ * are only served by the CDN, so a download domain must be set; without it
+ * the future fails at once with
+ * \c QNetworkReply::ContentOperationNotPermittedError and nothing is sent.
+ * An empty \a suffix downloads the file itself.
+ *
+ * Returns a future holding the file content.
+ *
+ * \sa QUpYun::setDownloadDomain(const QString &)
+ */
+QFuture<QByteArray> QUpYun::downloadFile(const QString &path, const QString &suffix)
+{
+    QString uri = d->formatPath(path);
+    API api = Read;
+    if (!suffix.isEmpty()) {
+        if (d->downloadDomain.isEmpty()) {
+            // the API host has no versions
+            FuturePointer future = newFuture<QByteArray>();
+            d->cancelFuture(future,
+                            QNetworkReply::ContentOperationNotPermittedError,
+                            tr("Versions are only served by the download domain"));
+            return futureOf<QByteArray>(future);
+        }
+        uri += d->thumbnailSeparator + suffix;
+        api = ReadVersion;
+    }
+    if (d->diskCache) {
+        FuturePointer future = newFuture<QByteArray>();
+        d->downloadCached(uri, api, future);
+        return futureOf<QByteArray>(future);
+    }
+    return d->submit<QByteArray>(api,
+                                 QNetworkAccessManager::GetOperation,
+                                 uri);
+}
+
+/*!
+ * \brief Removes file at \a filePath.
+ *
+ * Returns a future holding whether the file is removed.
+ *
+ * \sa QUpYun::requestRemoveFileFinished(bool)
+ */
+QFuture<bool> QUpYun::removeFile(const QString &filePath)
+{
+    return d->submit<bool>(RemoveFile,
+                           QNetworkAccessManager::DeleteOperation,
+                           d->formatPath(filePath));
+}
+
+/*!
+ * \brief Gets information of the file at \a filePath.
+ *
+ * Returns a future holding the file information.
+ *
+ * \sa QUpYun::requestFileInfoFinished(const FileInfo &)
+ */
+QFuture<FileInfo> QUpYun::fileInfo(const QString &filePath)
+{
+    return d->submit<FileInfo>(FileProp,
+                               QNetworkAccessManager::HeadOperation,
+                               d->formatPath(filePath));
+}
+
+/*!
+ * \brief Copies the file at \a sourcePath to \a destPath on the server.
+ *
+ * The file is copied by UpYun, so its content is neither downloaded nor
+ * uploaded again: the request has no body. Both paths are in this bucket.
+ * Sets \a autoMkdir to true if the missing folders of \a destPath should be
+ * made.
+ *
+ * Returns a future holding whether the file is copied.
+ *
+ * \sa QUpYun::copyFiles(const QList<QPair<QString, QString> > &, bool)
+ * \sa QUpYun::requestCopyFileFinished(bool)
+ */
+QFuture<bool> QUpYun::copyFile(const QString &sourcePath,
+                               const QString &destPath,
+                               bool autoMkdir)
+{
+    return d->relocate(CopyFile, sourcePath, destPath, autoMkdir);
+}
+
+/*!
+ * \brief Moves the file at \a sourcePath to \a destPath on the server.
+ *
+ * Same as copyFile(), but the file at \a sourcePath is removed, which
+ * makes it a rename when both paths are in the same folder.
+ *
+ * Returns a future holding whether the file is moved.
+ *
+ * \sa QUpYun::moveFiles(const QList<QPair<QString, QString> > &, bool)
+ * \sa QUpYun::requestMoveFileFinished(bool)
+ */
+QFuture<bool> QUpYun::moveFile(const QString &sourcePath,
+                               const QString &destPath,
+                               bool autoMkdir)
+{
+    return d->relocate(MoveFile, sourcePath, destPath, autoMkdir);
+}
+
+/*!
+ * \brief Copies each file of \a paths, a list of source and destination
+ * paths, on the server.
+ *
+ * At most bulkConcurrency() copies are submitted at a time; the next one
+ * is submitted when one finishes, so a list of any length takes little
+ * memory and leaves room in the session queue for other requests.
+ *
+ * Returns a future holding one result per pair, at the index of the pair,
+ * whether that file is copied. Its progress is the number of pairs
+ * finished. A failed copy does not stop the others. Canceling the future
+ * by QUpYun::cancel(const QFuture<void> &) cancels the running copies and
+ * starts no more.
+ *
+ * \sa QUpYun::copyFile(const QString &, const QString &, bool)
+ */
+QFuture<bool> QUpYun::copyFiles(const QList<QPair<QString, QString> > &paths,
+                                bool autoMkdir)
+{
+    return d->relocateAll(CopyFile, paths, autoMkdir);
+}
+
+/*!
+ * \brief Moves each file of \a paths, a list of source and destination
+ * paths, on the server.
+ *
+ * Same as copyFiles(), but moves the files.
+ *
+ * \sa QUpYun::moveFile(const QString &, const QString &, bool)
+ */
+QFuture<bool> QUpYun::moveFiles(const QList<QPair<QString, QString> > &paths,
+                                bool autoMkdir)
+{
+    return d->relocateAll(MoveFile, paths, autoMkdir);
+}
+
+/*!
+ * \brief Sets the number of requests copyFiles() and moveFiles() submit at
+ * a time to \a max.
+ *
+ * It is 8 by default. The session still limits the requests in flight, see
+ * QUpYunSession::setMaxConnections(int). Jobs already running follow the
+ * new limit as their requests finish.
+ */
+void QUpYun::setBulkConcurrency(int max)
+{
+    d->bulkConcurrency = qMax(1, max);
+    foreach (int id, d->bulkJobs.keys()) {
+        d->fillBulk(id);
+    }
+}
+
+/*!
+ * \brief Returns the number of requests copyFiles() and moveFiles() submit
+ * at a time.
+ */
+int QUpYun::bulkConcurrency() const
+{
+    return d->bulkConcurrency;
+}
+
+#include "qupyun.moc"
+
+inline void QUpYun::Private::setAccount(const QString &bucket,
+                                       const QString &user,
+                                       const QString &pass)
+{
+    bucketName = bucket;
+    userName = user;
+    password = md5(pass.toUtf8());
+    bucketPrefix = SEPARATOR + bucket;
+    authorizationPrefix = "UpYun " + user.toUtf8() + ':';
+}
+
+QString QUpYun::Private::upyunAPIDomain() const
+{
+    switch (apiDomain) {
+    case QUpYun::ED_AUTO:
+        return QLatin1String("v0.api.upyun.com");
+    case QUpYun::ED_TELECOM:
+        return QLatin1String("v1.api.upyun.com");
+    case QUpYun::ED_CNC:
+        return QLatin1String("v2.api.upyun.com");
+    case QUpYun::ED_CTT:
+        return QLatin1String("v3.api.upyun.com");
+    default:
+        return QLatin1String("");
+    }
+}
+
+QNetworkReply * QUpYun::Private::sendRequest(QNetworkAccessManager::Operation method,
+                                            const QString &uri,
+                                            const QByteArray &data,
+                                            bool autoMkdir,
+                                            const RequestParams &params)
+{
+    Q_ASSERT(method == QNetworkAccessManager::GetOperation
+             || method == QNetworkAccessManager::PutOperation
+             || method == QNetworkAccessManager::HeadOperation
+             || method == QNetworkAccessManager::DeleteOperation);
+
+    static QByteArray DATE("Date");
+    static QByteArray AUTHORIZATION("Authorization");
+    static QByteArray MKDIR("mkdir");
+
+    QByteArray date = getGMTDate();
+
+    QNetworkRequest request;
+    request.setUrl(QUrl(QString("http://%1%2").arg(upyunAPIDomain(), uri)));
+    request.setRawHeader(DATE, date);
+
+    // mkdir
+    if (autoMkdir) {
+        request.setRawHeader(MKDIR, QByteArray("true"));
+    }
+
+    qlonglong contentLength = data.length();
+    // set content length
+    request.setHeader(QNetworkRequest::ContentLengthHeader, contentLength);
+    // set signature
+    request.setRawHeader(AUTHORIZATION, signature(method, date, uri, contentLength));
+    // set extra params
+    bool isFolder = false;
+    if (!params.isEmpty()) {
+        isFolder = params.value(MKDIR).toBool();
+        QHash<QByteArray, QVariant>::const_iterator i = params.constBegin();
+        while (i != params.constEnd()) {
+            request.setRawHeader(i.key(), i.value().toByteArray());
+            ++i;
+        }
+    }
+
+#ifdef QT_DEBUG
+    qDebug() << request.url().toString();
+    QList<QByteArray> rawHeaders = request.rawHeaderList();
+    foreach (QByteArray header, rawHeaders) {
+        qDebug() << header << ": " << request.rawHeader(header);
+    }
+    qDebug() << "---------- Request Data Finished ----------";
+#endif
+
+    QUpYunTransport *sender = transport();
+    QNetworkReply *reply = 0;
+    if (method == QNetworkAccessManager::PutOperation && limiter && !data.isEmpty()) {
+        QUpYunThrottledDevice *device = new QUpYunThrottledDevice(data, limiter);
+        request.setAttribute(QNetworkRequest::DoNotBufferUploadDataAttribute, true);
+        reply = sender->send(method, request, device);
+        device->setParent(reply);
+    } else {
+        reply = sender->send(method, request, data);
+    }
+    return reply;
+}
+
+/*
+ * Sends a download of uri, a formatted path, to the download domain. The
+ * CDN gets no credentials, only the token of the URL. A non-zero
+ * ifModifiedSince makes it a conditional download.
+ */
+QNetworkReply *QUpYun::Private::sendDownload(const QString &uri, bool version, uint ifModifiedSince)
+{
+    static QByteArray IF_MODIFIED_SINCE("If-Modified-Since");
+
+    QByteArray expiration;
+    if (!tokenSecret.isEmpty()) {
+        uint now = QDateTime::currentDateTime().toTime_t();
+        expiration = QByteArray::number(now + uint(tokenExpiration));
+    }
+    QNetworkRequest request(QUrl::fromEncoded(signedUrl(uri, expiration).toLatin1()));
+    request.setHeader(QNetworkRequest::ContentLengthHeader, 0);
+    if (ifModifiedSince != 0) {
+        QDateTime time = QDateTime::fromTime_t(ifModifiedSince).toUTC();
+        QByteArray date = QLocale::c().toString(time, "ddd, dd MMM yyyy hh:mm:ss").toLatin1();
+        request.setRawHeader(IF_MODIFIED_SINCE, date + " GMT");
+    }
+    if (version) {
+        // the suffix follows the last separator
+        int file = qMax(bucketPrefix.size(), uri.lastIndexOf(thumbnailSeparator));
+        request.setAttribute(DOWNLOAD_PATH_ATTRIBUTE,
+                             uri.mid(bucketPrefix.size(), file - bucketPrefix.size()));
+    }
+    return transport()->send(QNetworkAccessManager::GetOperation, request, QByteArray());
+}
+
+/*
+ * URL of uri, a formatted path, on the download domain, with the token
+ * expiring at expiration if it is not empty.
+ */
+QString QUpYun::Private::signedUrl(const QString &uri, const QByteArray &expiration) const
+{
+    static QByteArray PATH_SAFE("/!~");
+
+    QByteArray path = uri.mid(bucketPrefix.size()).toUtf8();
+    if (path.isEmpty()) {
+        path = QByteArray(1, SEPARATOR);
+    }
+    QByteArray host = QUrl::toAce(downloadDomain);
+    QByteArray url = "http://";
+    // toAce() rejects a port
+    url += host.isEmpty() ? downloadDomain.toUtf8() : host;
+    url += path.toPercentEncoding(PATH_SAFE);
+    if (!expiration.isEmpty()) {
+        QByteArray sign = tokenSecret;
+        sign += '&';
+        sign += expiration;
+        sign += '&';
+        sign += path;
+        url += "?_upt=";
+        url += md5(sign).mid(12, 8);
+        url += expiration;
+    }
+    return QString::fromLatin1(url);
+}
+
+QUpYunRequest *QUpYun::Private::sendUpload(const QString &path,
+                                           const QByteArray &data,
+                                           bool autoMkdir,
+                                           bool appendFileMD5,
+                                           const QString &fileSecret,
+                                           const RequestParams &params,
+                                           const FuturePointer &future,
+                                           QFile *mappedFile)
+{
+    RequestParams newParams(params);
+    if (appendFileMD5) {
+        static QByteArray CONTENT_MD5("Content-MD5");
+        newParams.insert(CONTENT_MD5, md5(data));
+    }
+    if (!fileSecret.isEmpty()) {
+        static QByteArray CONTENT_SECRET("Content-Secret");
+        newParams.insert(CONTENT_SECRET, fileSecret.toUtf8());
+    }
+    QUpYunRequest *request = submit(Upload,
+                                    future,
+                                    QNetworkAccessManager::PutOperation,
+                                    formatPath(path),
+                                    data,
+                                    autoMkdir,
+                                    newParams);
+    if (mappedFile) {
+        // the request may have been started already
+        request->mappedFile = mappedFile;
+        mappedFile->setParent(request->reply);
+    }
+    return request;
+}
 
-    QByteArray date = getGMTDate();
+void QUpYun::Private::imageProcessed(int id, const QByteArray &data)
+{
+    if (!pendingImages.contains(id)) {
+        return;
+    }
+    PendingImage pending = pendingImages.take(id);
+    QUpYunRequest *request = 0;
+#ifndef QUPYUN_NO_IMAGE_PROCESSING
+    if (!data.isEmpty()) {
+        request = sendUpload(pending.path,
+                             data,
+                             pending.autoMkdir,
+                             pending.appendFileMD5,
+                             pending.fileSecret,
+                             QUpYunImageJob::remainingParams(pending.params),
+                             pending.future);
+    }
+#else
+    Q_UNUSED(data);
+#endif
+    if (!request) {
+        // could not process it, let UpYun do
+        request = sendUpload(pending.path,
+                             pending.original,
+                             pending.autoMkdir,
+                             pending.appendFileMD5,
+                             pending.fileSecret,
+                             pending.params,
+                             pending.future);
+    }
+    for (int i = 0; i < TIMEOUT_TYPES; ++i) {
+        if (pending.timeouts[i] >= 0) {
+            request->timeouts[i] = pending.timeouts[i];
+        }
+    }
+    watchTimeouts(request);
+}
 
-    QNetworkRequest request;
-    request.setUrl(QUrl(QString("http://%1%2").arg(upyunAPIDomain(), uri)));
-    request.setRawHeader(DATE, date);
+QUpYunRequest *QUpYun::Private::newRequest(API api,
+                                           const FuturePointer &future,
+                                           QNetworkAccessManager::Operation method,
+                                           const QString &uri,
+                                           const QByteArray &data,
+                                           bool autoMkdir,
+                                           const RequestParams &params) const
+{
+    QUpYunRequest *request = new QUpYunRequest;
+    request->api = api;
+    if (future) {
+        request->futures.append(future);
+    }
+    request->method = method;
+    request->path = uri;
+    request->data = data;
+    request->autoMkdir = autoMkdir;
+    request->params = params;
+    request->viaDownloadDomain = (api == Read || api == ReadVersion) && !downloadDomain.isEmpty();
+    request->ifModifiedSince = 0;
+    request->reply = 0;
+    request->clock.start();
+    request->startTime = -1;
+    request->activityTime = -1;
+    for (int i = 0; i < TIMEOUT_TYPES; ++i) {
+        request->timeouts[i] = timeouts[i];
+    }
+    return request;
+}
 
-    // mkdir
-    if (autoMkdir) {
-        request.setRawHeader(MKDIR, QByteArray("true"));
+/*
+ * Sends a request, or lets future share an identical one in flight.
+ */
+QUpYunRequest *QUpYun::Private::submit(API api,
+                                       const FuturePointer &future,
+                                       QNetworkAccessManager::Operation method,
+                                       const QString &uri,
+                                       const QByteArray &data,
+                                       bool autoMkdir,
+                                       const RequestParams &params)
+{
+    QString key;
+    if (isIdempotentAPI(api)) {
+        key = coalescingKey(api, uri, autoMkdir, params);
+        QUpYunRequest *running = inflight.value(key);
+        if (running) {
+            running->futures.append(future);
+            return running;
+        }
+    }
+    if (isMutatingAPI(api)) {
+        invalidate(uri);
     }
+    QUpYunRequest *request = newRequest(api, future, method, uri, data, autoMkdir, params);
+    if (!key.isEmpty()) {
+        request->coalescingKey = key;
+        inflight.insert(key, request);
+    }
+    enqueue(request);
+    return request;
+}
 
-    qlonglong contentLength = data.length();
-    // set content length
-    request.setHeader(QNetworkRequest::ContentLengthHeader, contentLength);
-    // set signature
-    request.setRawHeader(AUTHORIZATION, signature(method, QString(date), uri, contentLength));
-    // set extra params
-    bool isFolder = false;
-    if (!params.isEmpty()) {
-        isFolder = params.value(MKDIR).toBool();
-        QHash<QByteArray, QVariant>::const_iterator i = params.constBegin();
-        while (i != params.constEnd()) {
-            request.setRawHeader(i.key(), i.value().toByteArray());
-            ++i;
+/*
+ * Copies or moves source to dest by a PUT with no body, which names the
+ * source in a header.
+ */
+QFuture<bool> QUpYun::Private::relocate(API api,
+                                        const QString &source,
+                                        const QString &dest,
+                                        bool autoMkdir)
+{
+    static QByteArray COPY_SOURCE("X-Upyun-Copy-Source");
+    static QByteArray MOVE_SOURCE("X-Upyun-Move-Source");
+
+    QString from = formatPath(source);
+    RequestParams params;
+    params.insert(api == MoveFile ? MOVE_SOURCE : COPY_SOURCE,
+                  QUrl::toPercentEncoding(from, QByteArray(1, SEPARATOR)));
+    if (api == MoveFile) {
+        invalidate(from);
+    }
+    return submit<bool>(api,
+                        QNetworkAccessManager::PutOperation,
+                        formatPath(dest),
+                        QByteArray(),
+                        autoMkdir,
+                        params);
+}
+
+QFuture<bool> QUpYun::Private::relocateAll(API api,
+                                           const QList<QPair<QString, QString> > &paths,
+                                           bool autoMkdir)
+{
+    FuturePointer future = newFuture<bool>();
+    future->setProgressRange(0, paths.size());
+    int id = nextBulkJob++;
+    BulkJob &job = bulkJobs[id];
+    job.api = api;
+    job.paths = paths;
+    job.autoMkdir = autoMkdir;
+    job.next = 0;
+    job.running = 0;
+    job.finished = 0;
+    job.future = future;
+    fillBulk(id);
+    return futureOf<bool>(future);
+}
+
+/*
+ * Submits pairs of a bulk job while fewer than bulkConcurrency run, and
+ * finishes the job once all have, or once it is canceled and the running
+ * ones have.
+ */
+void QUpYun::Private::fillBulk(int id)
+{
+    QHash<int, BulkJob>::iterator job = bulkJobs.find(id);
+    if (job == bulkJobs.end()) {
+        return;
+    }
+    bool canceled = job.value().future->isCanceled();
+    while (!canceled
+           && job.value().running < bulkConcurrency
+           && job.value().next < job.value().paths.size()) {
+        BulkItem item;
+        item.job = id;
+        item.index = job.value().next++;
+        ++job.value().running;
+        const QPair<QString, QString> &pair = job.value().paths.at(item.index);
+        QFutureWatcher<bool> *watcher = new QFutureWatcher<bool>(this);
+        connect(watcher, SIGNAL(finished()), this, SLOT(bulkItemFinished()));
+        bulkItems.insert(watcher, item);
+        watcher->setFuture(relocate(job.value().api, pair.first, pair.second, job.value().autoMkdir));
+    }
+    if (job.value().running == 0
+            && (canceled || job.value().next >= job.value().paths.size())) {
+        FuturePointer future = job.value().future;
+        bulkJobs.erase(job);
+        future->reportFinished();
+    }
+}
+
+void QUpYun::Private::bulkItemFinished()
+{
+    QFutureWatcher<bool> *watcher = static_cast<QFutureWatcher<bool> *>(sender());
+    watcher->deleteLater();
+    BulkItem item = bulkItems.take(watcher);
+    QHash<int, BulkJob>::iterator job = bulkJobs.find(item.job);
+    if (job == bulkJobs.end()) {
+        return;
+    }
+    QFuture<bool> result = watcher->future();
+    bool succeeded = !result.isCanceled() && result.resultCount() > 0 && result.result();
+    QFutureInterface<bool> *future = static_cast<QFutureInterface<bool> *>(job.value().future.data());
+    future->reportResult(succeeded, item.index);
+    future->setProgressValue(++job.value().finished);
+    --job.value().running;
+    fillBulk(item.job);
+}
+
+/*
+ * Stops later callers from joining requests whose result may miss a change
+ * of path: reads of path itself, listings of it and of its parent, and
+ * usage. Callers already joined still share the result.
+ */
+void QUpYun::Private::invalidate(const QString &path)
+{
+    if (inflight.isEmpty()) {
+        return;
+    }
+    bool isFolder = path.endsWith(QLatin1Char(SEPARATOR));
+    QString folder = isFolder ? path : path + SEPARATOR;
+    QString parent = path.left(path.lastIndexOf(QLatin1Char(SEPARATOR), isFolder ? -2 : -1) + 1);
+    QMutableHashIterator<QString, QUpYunRequest *> i(inflight);
+    while (i.hasNext()) {
+        i.next();
+        QUpYunRequest *request = i.value();
+        if (request->api == BucketUsage
+                || request->path == path
+                || request->path == folder
+                || request->path == parent) {
+            request->coalescingKey.clear();
+            i.remove();
         }
     }
+}
 
-#ifdef QT_DEBUG
-    qDebug() << request.url().toString();
-    QList<QByteArray> rawHeaders = request.rawHeaderList();
-    foreach (QByteArray header, rawHeaders) {
-        qDebug() << header << ": " << request.rawHeader(header);
+inline void QUpYun::Private::enqueue(QUpYunRequest *request)
+{
+    if (!session()) {
+        // the shared session has been deleted, go on with a private one
+        attach(new QUpYunSession(this));
     }
-    qDebug() << "---------- Request Data Finished ----------";
-#endif
+    queued.insert(request);
+    watchTimeouts(request);
+    schedule(request,
+             request->viaDownloadDomain ? downloadDomain : upyunAPIDomain(),
+             operationClass(request->api));
+}
 
-    QNetworkReply *reply = 0;
-    switch (method) {
-    case QNetworkAccessManager::GetOperation:
-        reply = manager->get(request);
-        break;
-    case QNetworkAccessManager::PutOperation:
-        reply = manager->put(request, data);
-        break;
-    case QNetworkAccessManager::HeadOperation:
-        reply = manager->head(request);
-        break;
-    case QNetworkAccessManager::DeleteOperation:
-        reply = manager->deleteResource(request);
-        break;
-    default:
-        // do nothing
-        break;
+/*
+ * Called by the session once there is a free connection. The request is
+ * signed now, so waiting in the queue does not age its Date header.
+ */
+void QUpYun::Private::start(QUpYunRequest *request)
+{
+    queued.remove(request);
+    QNetworkReply *reply = request->viaDownloadDomain
+            ? sendDownload(request->path, request->api == ReadVersion, request->ifModifiedSince)
+            : sendRequest(request->method,
+                          request->path,
+                          request->data,
+                          request->autoMkdir,
+                          request->params);
+    request->reply = reply;
+    request->startTime = request->clock.elapsed();
+    if (request->mappedFile) {
+        request->mappedFile->setParent(reply);
+    }
+    requests.insert(reply, request);
+    connect(reply, SIGNAL(finished()), this, SLOT(replyFinished()));
+    connect(reply, SIGNAL(metaDataChanged()), this, SLOT(replyProgress()));
+    connect(reply, SIGNAL(uploadProgress(qint64,qint64)), this, SLOT(replyProgress()));
+    connect(reply, SIGNAL(downloadProgress(qint64,qint64)), this, SLOT(replyProgress()));
+    if (limiter && !(isMetadataAPI(request->api) && limiter->metadataBypass())) {
+        // keep replies from buffering more than one chunk ahead of the tokens
+        reply->setReadBufferSize(THROTTLE_CHUNK);
+        connect(reply, SIGNAL(readyRead()), this, SLOT(readThrottled()));
     }
-    return reply;
 }
 
-inline QString QUpYun::Private::formatPath(const QString &path) const
+/*
+ * Called by a shared session being deleted. Its transport takes the replies
+ * with it, so every request is aborted now; signals are emitted once all
+ * are aborted.
+ */
+void QUpYun::Private::sessionDestroyed()
+{
+    QList<QUpYunRequest *> live = detach() + requests.values();
+    QString message = tr("Session destroyed");
+    QList<FuturePointer> canceled;
+    QStringList keys;
+    foreach (QUpYunRequest *request, live) {
+        canceled += request->futures;
+        request->futures.clear();
+        if (!request->cacheKey.isEmpty()) {
+            keys.append(request->cacheKey);
+            request->cacheKey.clear();
+        }
+        abortRequest(request, QNetworkReply::OperationCanceledError, message);
+    }
+    foreach (const QString &key, keys) {
+        failCached(key, QNetworkReply::OperationCanceledError, message);
+    }
+    foreach (const FuturePointer &future, canceled) {
+        cancelFuture(future, QNetworkReply::OperationCanceledError, message);
+    }
+}
+
+inline void QUpYun::Private::failRequest(QUpYunRequest *request)
+{
+    foreach (const FuturePointer &future, request->futures) {
+        reportFailure(future);
+    }
+}
+
+inline bool QUpYun::Private::isLive(QUpYunRequest *request) const
+{
+    return queued.contains(request)
+            || (request->reply && requests.value(request->reply) == request);
+}
+
+/*
+ * Returns the queued or started request operation belongs to and sets
+ * future to the caller's interface, or returns 0.
+ */
+QUpYunRequest *QUpYun::Private::findRequest(const QFuture<void> &operation,
+                                            FuturePointer *future) const
+{
+    QList<QUpYunRequest *> live = queued.toList() + requests.values();
+    foreach (QUpYunRequest *request, live) {
+        foreach (const FuturePointer &candidate, request->futures) {
+            if (isSameFuture(candidate, operation)) {
+                *future = candidate;
+                return request;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Returns the disk cache fetch of key, or 0.
+ */
+QUpYunRequest *QUpYun::Private::findFetch(const QString &key) const
+{
+    QList<QUpYunRequest *> live = queued.toList() + requests.values();
+    foreach (QUpYunRequest *request, live) {
+        if (request->cacheKey == key) {
+            return request;
+        }
+    }
+    return 0;
+}
+
+inline void QUpYun::Private::cancelFuture(const FuturePointer &future,
+                                          QNetworkReply::NetworkError errorCode,
+                                          const QString &errorMessage)
+{
+    emit q->requestError(errorCode, errorMessage);
+    reportFailure(future);
+}
+
+/*
+ * Removes request from the session, aborts its reply and fails everyone
+ * waiting for it. Buffers held by the request are freed before returning.
+ */
+void QUpYun::Private::abortRequest(QUpYunRequest *request,
+                                   QNetworkReply::NetworkError errorCode,
+                                   const QString &errorMessage)
+{
+    QScopedPointer<QUpYunRequest> guard(request);
+    if (!request->coalescingKey.isEmpty()) {
+        inflight.remove(request->coalescingKey);
+    }
+    QNetworkReply *reply = request->reply;
+    if (reply) {
+        requests.remove(reply);
+        stalledReplies.remove(reply);
+        downloads.remove(reply);
+        disconnect(reply, 0, this, 0);
+        reply->abort();
+        reply->deleteLater();
+    } else {
+        queued.remove(request);
+        unschedule(request);
+    }
+    if (!request->cacheKey.isEmpty()) {
+        failCached(request->cacheKey, errorCode, errorMessage);
+    }
+    foreach (const FuturePointer &future, request->futures) {
+        cancelFuture(future, errorCode, errorMessage);
+    }
+    if (reply) {
+        // may start another request
+        release(request, errorCode == QNetworkReply::TimeoutError
+                ? QUpYunSessionClient::Overloaded : QUpYunSessionClient::Canceled);
+    }
+}
+
+inline void QUpYun::Private::watchTimeouts(const QUpYunRequest *request)
+{
+    if (timeoutTimer.isActive()) {
+        return;
+    }
+    for (int i = 0; i < TIMEOUT_TYPES; ++i) {
+        if (request->timeouts[i] > 0) {
+            timeoutTimer.start();
+            return;
+        }
+    }
+}
+
+void QUpYun::Private::replyProgress()
+{
+    QUpYunRequest *request = requests.value(qobject_cast<QNetworkReply *>(sender()));
+    if (request) {
+        request->activityTime = request->clock.elapsed();
+    }
+}
+
+/*
+ * Aborts requests past the total timeout, started requests which have not
+ * made progress within the connect timeout, and those which have stopped
+ * making progress for the idle timeout. Downloads held back by the
+ * bandwidth limiter are not idle.
+ */
+void QUpYun::Private::checkTimeouts()
+{
+    QList<QUpYunRequest *> expired;
+    bool watching = false;
+    QList<QUpYunRequest *> live = queued.toList() + requests.values();
+    foreach (QUpYunRequest *request, live) {
+        const int *limits = request->timeouts;
+        if (limits[QUpYun::CONNECT_TIMEOUT] <= 0
+                && limits[QUpYun::IDLE_TIMEOUT] <= 0
+                && limits[QUpYun::TOTAL_TIMEOUT] <= 0) {
+            continue;
+        }
+        watching = true;
+        qint64 now = request->clock.elapsed();
+        if (limits[QUpYun::TOTAL_TIMEOUT] > 0 && now >= limits[QUpYun::TOTAL_TIMEOUT]) {
+            expired.append(request);
+        } else if (request->startTime < 0) {
+            continue;
+        } else if (request->activityTime < 0) {
+            if (limits[QUpYun::CONNECT_TIMEOUT] > 0
+                    && now - request->startTime >= limits[QUpYun::CONNECT_TIMEOUT]) {
+                expired.append(request);
+            }
+        } else if (limits[QUpYun::IDLE_TIMEOUT] > 0
+                   && now - request->activityTime >= limits[QUpYun::IDLE_TIMEOUT]
+                   && !stalledReplies.contains(request->reply)) {
+            expired.append(request);
+        }
+    }
+    if (!watching) {
+        timeoutTimer.stop();
+    }
+    foreach (QUpYunRequest *request, expired) {
+        // slots of an earlier abort may have canceled it
+        if (isLive(request)) {
+            abortRequest(request, QNetworkReply::TimeoutError, tr("Operation timed out"));
+        }
+    }
+}
+
+void QUpYun::Private::drainThrottled(QNetworkReply *reply)
+{
+    qint64 available = reply->bytesAvailable();
+    while (available > 0) {
+        qint64 granted = limiter
+                ? limiter->acquire(QUpYunBandwidthLimiter::Download, available)
+                : available;
+        if (granted <= 0) {
+            stalledReplies.insert(reply);
+            if (!throttleTimer.isActive()) {
+                throttleTimer.start(limiter->msecsUntilAvailable(QUpYunBandwidthLimiter::Download));
+            }
+            return;
+        }
+        downloads[reply].append(reply->read(granted));
+        available = reply->bytesAvailable();
+        QUpYunRequest *request = requests.value(reply);
+        if (request) {
+            request->activityTime = request->clock.elapsed();
+        }
+    }
+}
+
+void QUpYun::Private::readThrottled()
+{
+    QNetworkReply *reply = qobject_cast<QNetworkReply *>(sender());
+    if (reply && !stalledReplies.contains(reply)) {
+        drainThrottled(reply);
+    }
+}
+
+void QUpYun::Private::resumeThrottled()
+{
+    QSet<QNetworkReply *> stalled = stalledReplies;
+    stalledReplies.clear();
+    foreach (QNetworkReply *reply, stalled) {
+        drainThrottled(reply);
+    }
+}
+
+inline void QUpYun::Private::rememberSize(const QString &path, qulonglong size)
+{
+    sizes.insert(path, new qulonglong(size));
+}
+
+void QUpYun::Private::accountUsage(qulonglong usage)
+{
+    usageBase = usage;
+    usageDelta = 0;
+    usageClock.start();
+}
+
+void QUpYun::Private::accountUpload(const QString &path, qint64 size)
+{
+    if (!usageTracking) {
+        return;
+    }
+    // an overwritten file does not count twice
+    qulonglong *known = sizes.object(path);
+    if (known) {
+        usageDelta -= qint64(*known);
+        *known = size;
+    } else {
+        sizes.insert(path, new qulonglong(size));
+    }
+    usageDelta += size;
+}
+
+void QUpYun::Private::accountRemoval(const QString &path)
+{
+    if (!usageTracking) {
+        return;
+    }
+    // unknown sizes are corrected by next reconciliation
+    qulonglong *known = sizes.take(path);
+    if (known) {
+        usageDelta -= qint64(*known);
+        delete known;
+    }
+}
+
+void QUpYun::Private::accountCopy(const QString &source, const QString &dest, bool move)
+{
+    qulonglong *known = usageTracking ? sizes.object(source) : 0;
+    if (!known) {
+        // unknown sizes are corrected by next reconciliation
+        return;
+    }
+    qulonglong size = *known;
+    if (move) {
+        sizes.remove(source);
+        usageDelta -= qint64(size);
+    }
+    accountUpload(dest, size);
+}
+
+void QUpYun::Private::reconcileUsage()
+{
+    q->bucketUsage();
+}
+
+void QUpYun::Private::downloadCached(const QString &key, API api, const FuturePointer &future)
 {
-    QString formatted;
-    if (!path.isEmpty()) {
-        formatted = path.trimmed();
-        if (!formatted.startsWith(SEPARATOR)) {
-            return SEPARATOR + bucketName + SEPARATOR + formatted;
+    QList<FuturePointer> &waiters = cacheWaiters[key];
+    waiters.append(future);
+    if (waiters.size() > 1) {
+        // a fetch of the same file is in flight
+        return;
+    }
+    if (diskCache->isFresh(key)) {
+        freshHits.append(qMakePair(key, api));
+        QTimer::singleShot(0, this, SLOT(serveFreshHits()));
+    } else if (!diskCache->contains(key)) {
+        fetchCached(key, api);
+    } else if (downloadDomain.isEmpty() || (api == Read && diskCache->lastModified(key) == 0)) {
+        // the API compares the size and the last modified time
+        fetchCached(key, CacheCheck);
+    } else {
+        // the CDN answers 304 Not Modified if the cached file is still valid
+        fetchCached(key, api, diskCache->lastModified(key));
+    }
+}
+
+void QUpYun::Private::fetchCached(const QString &key, API api, uint ifModifiedSince)
+{
+    QUpYunRequest *request = newRequest(api,
+                                        FuturePointer(),
+                                        api == CacheCheck
+                                          ? QNetworkAccessManager::HeadOperation
+                                          : QNetworkAccessManager::GetOperation,
+                                        key);
+    request->cacheKey = key;
+    request->ifModifiedSince = ifModifiedSince;
+    enqueue(request);
+}
+
+void QUpYun::Private::deliverCached(const QString &key, const QByteArray &data)
+{
+    QList<FuturePointer> waiters = cacheWaiters.take(key);
+    foreach (const FuturePointer &future, waiters) {
+        emit q->requestDownloadFinished(data);
+        reportResult<QByteArray>(future, data);
+    }
+}
+
+void QUpYun::Private::failCached(const QString &key,
+                                 QNetworkReply::NetworkError errorCode,
+                                 const QString &errorMessage)
+{
+    QList<FuturePointer> waiters = cacheWaiters.take(key);
+    foreach (const FuturePointer &future, waiters) {
+        emit q->requestError(errorCode, errorMessage);
+        reportFailure(future);
+    }
+}
+
+void QUpYun::Private::serveFreshHits()
+{
+    QList<QPair<QString, API> > hits = freshHits;
+    freshHits.clear();
+    for (int i = 0; i < hits.size(); ++i) {
+        const QString &key = hits.at(i).first;
+        if (!cacheWaiters.contains(key)) {
+            // canceled
+            continue;
+        }
+        if (diskCache && diskCache->contains(key)) {
+            deliverCached(key, diskCache->data(key));
+        } else {
+            fetchCached(key, hits.at(i).second);
         }
     }
-    return SEPARATOR + bucketName + formatted;
+}
+
+inline QString QUpYun::Private::formatPath(const QString &path) const
+{
+    QString formatted = path.trimmed();
+    if (formatted.isEmpty()) {
+        return bucketPrefix;
+    }
+    QString result;
+    result.reserve(bucketPrefix.size() + formatted.size() + 1);
+    result += bucketPrefix;
+    if (!formatted.startsWith(QLatin1Char(SEPARATOR))) {
+        result += QLatin1Char(SEPARATOR);
+    }
+    result += formatted;
+    return result;
 }
 
 inline QByteArray QUpYun::Private::md5(const QByteArray &data) const
@@ -456,13 +2335,18 @@ inline QByteArray QUpYun::Private::md5(const QByteArray &data) const
 
 inline QByteArray QUpYun::Private::getGMTDate() const
 {
-    QString dateTimeString = QLocale::c().toString(QDateTime::currentDateTimeUtc(),
-                                                   "ddd, dd MMM yyyy hh:mm:ss");
-    return QString("%1 GMT").arg(dateTimeString).toUtf8();
+    // the header has a precision of one second, format it once per second
+    qint64 second = QDateTime::currentMSecsSinceEpoch() / 1000;
+    if (second != dateSecond) {
+        QDateTime now = QDateTime::fromMSecsSinceEpoch(second * 1000).toUTC();
+        gmtDate = QLocale::c().toString(now, "ddd, dd MMM yyyy hh:mm:ss").toLatin1() + " GMT";
+        dateSecond = second;
+    }
+    return gmtDate;
 }
 
 inline QByteArray QUpYun::Private::signature(QNetworkAccessManager::Operation method,
-                                            const QString &date,
+                                            const QByteArray &date,
                                             const QString &uri,
                                             qlonglong length) const
 {
@@ -470,72 +2354,143 @@ inline QByteArray QUpYun::Private::signature(QNetworkAccessManager::Operation me
              || method == QNetworkAccessManager::PutOperation
              || method == QNetworkAccessManager::HeadOperation
              || method == QNetworkAccessManager::DeleteOperation);
-    QString methodName;
+    const char *methodName = "";
     switch (method) {
     case QNetworkAccessManager::GetOperation:
-        methodName = QString("GET");
+        methodName = "GET";
         break;
     case QNetworkAccessManager::PutOperation:
-        methodName = QString("PUT");
+        methodName = "PUT";
         break;
     case QNetworkAccessManager::HeadOperation:
-        methodName = QString("HEAD");
+        methodName = "HEAD";
         break;
     case QNetworkAccessManager::DeleteOperation:
-        methodName = QString("DELETE");
+        methodName = "DELETE";
         break;
     default:
         // do nothing
         break;
     }
-    QString sign = QString("%1&%2&%3&%4&%5").arg(methodName,
-                                                 uri,
-                                                 date,
-                                                 QString::number(length),
-                                                 password);
-    return QString("UpYun %1:%2").arg(userName, QString(md5(sign.toUtf8()))).toUtf8();
+    // METHOD&URI&DATE&LENGTH&PASSWORD
+    QByteArray uriBytes = uri.toUtf8();
+    QByteArray lengthBytes = QByteArray::number(length);
+    QByteArray sign;
+    sign.reserve(8 + uriBytes.size() + date.size() + lengthBytes.size() + password.size());
+    sign += methodName;
+    sign += '&';
+    sign += uriBytes;
+    sign += '&';
+    sign += date;
+    sign += '&';
+    sign += lengthBytes;
+    sign += '&';
+    sign += password;
+    return authorizationPrefix + md5(sign);
+}
+
+void QUpYun::Private::replyFinished()
+{
+    QNetworkReply *reply = qobject_cast<QNetworkReply *>(sender());
+    if (reply) {
+        requestFinished(reply);
+    }
 }
 
 void QUpYun::Private::requestFinished(QNetworkReply *reply)
 {
-    QByteArray data = reply->readAll();
+    stalledReplies.remove(reply);
+    QByteArray data = downloads.take(reply);
+    data.append(reply->readAll());
 #ifdef QT_DEBUG
     qDebug() << "Reply: " << data << endl
              << "Raw headers: " << endl << reply->rawHeaderPairs();
 #endif
+    QScopedPointer<QUpYunRequest> request(requests.take(reply));
+    if (!request) {
+        reply->deleteLater();
+        return;
+    }
+    if (request->viaDownloadDomain
+            && request->api != ReadVersion
+            && reply->error() != QNetworkReply::NoError
+            && reply->error() != QNetworkReply::ContentNotFoundError) {
+        // an error of the CDN is retried once by the API host, which has no
+        // versions and reports a missing file the same
+        request->viaDownloadDomain = false;
+        request->reply = 0;
+        request->startTime = -1;
+        request->activityTime = -1;
+        reply->deleteLater();
+        release(request.data(), outcomeOf(reply));
+        enqueue(request.take());
+        return;
+    }
+    if (!request->coalescingKey.isEmpty()) {
+        // later callers make a new request
+        inflight.remove(request->coalescingKey);
+    }
+    // every caller sharing the request gets its own signal
+    const QList<FuturePointer> &futures = request->futures;
     if (reply->error() == QNetworkReply::NoError) {
-        API currentAPI = requests.value(reply);
-        switch (currentAPI) {
+        switch (request->api) {
         case BucketUsage:
             {
-            emit q->requestBucketUsageFinished(data.toULongLong());
+            accountUsage(data.toULongLong());
+            foreach (const FuturePointer &future, futures) {
+                emit q->requestBucketUsageFinished(data.toULongLong());
+                reportResult<qulonglong>(future, data.toULongLong());
+            }
             break;
             }
         case Mkdir:
             {
-            emit q->requestMkdirFinished(data.isEmpty());
+            foreach (const FuturePointer &future, futures) {
+                emit q->requestMkdirFinished(data.isEmpty());
+                reportResult<bool>(future, data.isEmpty());
+            }
             break;
             }
         case Rmdir:
             {
-            emit q->requestRmdirFinished(data.isEmpty());
+            foreach (const FuturePointer &future, futures) {
+                emit q->requestRmdirFinished(data.isEmpty());
+                reportResult<bool>(future, data.isEmpty());
+            }
             break;
             }
         case Ls:
         {
-            QList<ItemInfo> infos;
-            QString result(data);
-            QStringList entries = result.split('\n');
-            foreach (QString entry, entries) {
-                QStringList items = entry.split('\t');
-                ItemInfo info;
-                info.name = items.at(0);
-                info.isFolder = items.at(1).compare(QLatin1String("F"), Qt::CaseInsensitive) == 0;
-                info.size = items.at(2).toULongLong();
-                info.date = QDateTime::fromTime_t(items.at(3).toUInt());
-                infos << info;
-            }
-            emit q->requestLsFinished(infos);
+            QList<ItemInfo> infos = parseItems(data);
+            if (usageTracking) {
+                foreach (const ItemInfo &info, infos) {
+                    if (!info.isFolder) {
+                        rememberSize(request->path + info.name, info.size);
+                    }
+                }
+            }
+            foreach (const FuturePointer &future, futures) {
+                emit q->requestLsFinished(infos);
+                reportResult<QList<ItemInfo> >(future, infos);
+            }
+            break;
+        }
+        case LsCompact:
+        {
+            QUpYunItemList items;
+            // directories as the caller knows them, without the bucket
+            items.appendListing(request->path.mid(bucketPrefix.size()), data);
+            if (usageTracking) {
+                for (int i = 0; i < items.size(); ++i) {
+                    if (!items.isFolder(i)) {
+                        rememberSize(bucketPrefix + items.path(i), items.fileSize(i));
+                    }
+                }
+            }
+            foreach (const FuturePointer &future, futures) {
+                emit q->requestLsCompactFinished(items);
+                reportResult<QUpYunItemList>(future, items);
+            }
             break;
         }
         case Upload:
@@ -551,17 +2506,79 @@ void QUpYun::Private::requestFinished(QNetworkReply *reply)
             info.height = reply->rawHeader(PIC_HEIGHT).toULongLong();
             info.frames = reply->rawHeader(PIC_FRAMES).toULongLong();
 
-            emit q->requestUploadFinished(data.isEmpty(), info);
+            accountUpload(request->path, request->data.size());
+            if (diskCache) {
+                diskCache->remove(request->path);
+            }
+            foreach (const FuturePointer &future, futures) {
+                emit q->requestUploadFinished(data.isEmpty(), info);
+                reportResult<PicInfo>(future, info);
+            }
             break;
             }
         case Read:
+        case ReadVersion:
             {
-            emit q->requestDownloadFinished(data);
+            if (!request->cacheKey.isEmpty()) {
+                if (reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 304) {
+                    if (diskCache && diskCache->validate(request->cacheKey)) {
+                        deliverCached(request->cacheKey, diskCache->data(request->cacheKey));
+                    } else {
+                        // evicted meanwhile
+                        fetchCached(request->cacheKey, request->api);
+                    }
+                    break;
+                }
+                if (diskCache) {
+                    QDateTime lastModified = reply->header(QNetworkRequest::LastModifiedHeader).toDateTime();
+                    diskCache->insert(request->cacheKey,
+                                      data,
+                                      lastModified.isValid() ? lastModified.toTime_t() : 0);
+                }
+                deliverCached(request->cacheKey, data);
+                break;
+            }
+            foreach (const FuturePointer &future, futures) {
+                emit q->requestDownloadFinished(data);
+                reportResult<QByteArray>(future, data);
+            }
             break;
             }
         case RemoveFile:
             {
-            emit q->requestRemoveFileFinished(data.isEmpty());
+            accountRemoval(request->path);
+            if (diskCache) {
+                diskCache->remove(request->path);
+            }
+            foreach (const FuturePointer &future, futures) {
+                emit q->requestRemoveFileFinished(data.isEmpty());
+                reportResult<bool>(future, data.isEmpty());
+            }
+            break;
+            }
+        case CopyFile:
+        case MoveFile:
+            {
+            static QByteArray COPY_SOURCE("X-Upyun-Copy-Source");
+            static QByteArray MOVE_SOURCE("X-Upyun-Move-Source");
+
+            bool move = request->api == MoveFile;
+            QString source = QUrl::fromPercentEncoding(request->params.value(move ? MOVE_SOURCE : COPY_SOURCE).toByteArray());
+            accountCopy(source, request->path, move);
+            if (diskCache) {
+                diskCache->remove(request->path);
+                if (move) {
+                    diskCache->remove(source);
+                }
+            }
+            foreach (const FuturePointer &future, futures) {
+                if (move) {
+                    emit q->requestMoveFileFinished(data.isEmpty());
+                } else {
+                    emit q->requestCopyFileFinished(data.isEmpty());
+                }
+                reportResult<bool>(future, data.isEmpty());
+            }
             break;
             }
         case FileProp:
@@ -574,18 +2591,47 @@ void QUpYun::Private::requestFinished(QNetworkReply *reply)
             info.type = QString(reply->rawHeader(FILE_TYPE));
             info.size = reply->rawHeader(FILE_SIZE).toULongLong();
             info.createDate = QDateTime::fromTime_t(reply->rawHeader(FILE_DATE).toUInt());
-            emit q->requestFileInfoFinished(info);
+            if (usageTracking && info.type != QLatin1String("folder")) {
+                rememberSize(request->path, info.size);
+            }
+            foreach (const FuturePointer &future, futures) {
+                emit q->requestFileInfoFinished(info);
+                reportResult<FileInfo>(future, info);
+            }
+            break;
+            }
+        case CacheCheck:
+            {
+            static QByteArray FILE_SIZE("x-upyun-file-size");
+            static QByteArray FILE_DATE("x-upyun-file-date");
+
+            if (diskCache && diskCache->validate(request->cacheKey,
+                                                 reply->rawHeader(FILE_SIZE).toULongLong(),
+                                                 reply->rawHeader(FILE_DATE).toUInt())) {
+                deliverCached(request->cacheKey, diskCache->data(request->cacheKey));
+            } else {
+                fetchCached(request->cacheKey, Read);
+            }
             break;
             }
         default:
             // do nothing
             break;
         }
+    } else if (!request->cacheKey.isEmpty()) {
+        if (diskCache && reply->error() == QNetworkReply::ContentNotFoundError) {
+            diskCache->remove(request->cacheKey);
+        }
+        failCached(request->cacheKey, reply->error(), reply->errorString());
     } else {
         // something wrong
-        emit q->requestError(reply->error(), reply->errorString());
+        foreach (const FuturePointer &future, futures) {
+            emit q->requestError(reply->error(), reply->errorString());
+            reportFailure(future);
+        }
     }
-   reply->deleteLater();
+    reply->deleteLater();
+    release(request.data(), outcomeOf(reply));
 }
 
 QDebug operator<<(QDebug dbg, const FileInfo &fileInfo)
@@ -2,15 +2,23 @@
 #define QUPYUN_H
 
 #include <QDateTime>
+#include <QFuture>
 #include <QNetworkReply>
 #include <QObject>
+#include <QPair>
+#include <QStringList>
 
 #include "qupyun_global.h"
+#include "qupyunitemlist.h"
 
 QT_BEGIN_NAMESPACE
 class QFile;
 QT_END_NAMESPACE
 
+class QUpYunBandwidthLimiter;
+class QUpYunDiskCache;
+class QUpYunSession;
+
 struct FileInfo
 {
     QString    type;
@@ -80,12 +88,24 @@ public:
         ROTATE_270
     };
 
+    enum Timeout
+    {
+        CONNECT_TIMEOUT,
+        IDLE_TIMEOUT,
+        TOTAL_TIMEOUT
+    };
+
     static QByteArray extraParamHeader(QUpYun::ExtraParam param);
 
     QUpYun(const QString &bucketName,
            const QString &userName,
            const QString &password,
            QObject *parent = 0);
+    QUpYun(QUpYunSession *session,
+           const QString &bucketName,
+           const QString &userName,
+           const QString &password,
+           QObject *parent = 0);
     ~QUpYun();
 
     inline QString version() const;
@@ -93,28 +113,78 @@ public:
     inline void setAPIDomain(EndPoint ed);
     inline EndPoint apiDomain() const;
 
-    void bucketUsage();
-
-    void mkdir(const QString &path, bool autoMkdir = false);
-    void rmdir(const QString &path);
-    void ls(const QString &path);
-
-    void uploadFile(const QString &path,
-                    const QString &localPath,
-                    bool autoMkdir = false,
-                    bool appendFileMD5 = false,
-                    const QString &fileSecret = QString(),
-                    const RequestParams &params = RequestParams());
-    void uploadFile(const QString &path,
-                    QFile *file,
-                    bool autoMkdir = false,
-                    bool appendFileMD5 = false,
-                    const QString &fileSecret = QString(),
-                    const RequestParams &params = RequestParams());
-    void downloadFile(const QString &path);
-    void removeFile(const QString &filePath);
-
-    void fileInfo(const QString &filePath);
+    QUpYunSession *session() const;
+
+    void setBandwidthLimiter(QUpYunBandwidthLimiter *limiter);
+    QUpYunBandwidthLimiter *bandwidthLimiter() const;
+
+    void setLocalImageProcessing(bool enabled);
+    bool localImageProcessing() const;
+
+    void setUsageTracking(bool enabled);
+    bool usageTracking() const;
+    void setUsageReconcileInterval(int msecs);
+    int usageReconcileInterval() const;
+    qulonglong usageEstimate() const;
+    qint64 usageStaleness() const;
+
+    void setDiskCache(QUpYunDiskCache *cache);
+    QUpYunDiskCache *diskCache() const;
+
+    void setDownloadDomain(const QString &domain);
+    QString downloadDomain() const;
+    void setThumbnailSeparator(const QString &separator);
+    QString thumbnailSeparator() const;
+    void setTokenSecret(const QString &secret);
+    void setTokenExpiration(int secs);
+    int tokenExpiration() const;
+    QString downloadUrl(const QString &path, const QString &suffix = QString()) const;
+    QStringList downloadUrls(const QStringList &paths, const QString &suffix = QString()) const;
+
+    void setTimeout(Timeout type, int msecs);
+    int timeout(Timeout type) const;
+    bool setTimeout(const QFuture<void> &operation, Timeout type, int msecs);
+
+    bool cancel(const QFuture<void> &operation);
+    int cancelAll(const QString &path = QString());
+
+    QFuture<qulonglong> bucketUsage();
+
+    QFuture<bool> mkdir(const QString &path, bool autoMkdir = false);
+    QFuture<bool> rmdir(const QString &path);
+    QFuture<QList<ItemInfo> > ls(const QString &path);
+    QFuture<QUpYunItemList> lsCompact(const QString &path);
+
+    QFuture<PicInfo> uploadFile(const QString &path,
+                                const QString &localPath,
+                                bool autoMkdir = false,
+                                bool appendFileMD5 = false,
+                                const QString &fileSecret = QString(),
+                                const RequestParams &params = RequestParams());
+    QFuture<PicInfo> uploadFile(const QString &path,
+                                QFile *file,
+                                bool autoMkdir = false,
+                                bool appendFileMD5 = false,
+                                const QString &fileSecret = QString(),
+                                const RequestParams &params = RequestParams());
+    QFuture<QByteArray> downloadFile(const QString &path);
+    QFuture<QByteArray> downloadFile(const QString &path, const QString &suffix);
+    QFuture<bool> removeFile(const QString &filePath);
+
+    QFuture<bool> copyFile(const QString &sourcePath,
+                           const QString &destPath,
+                           bool autoMkdir = false);
+    QFuture<bool> moveFile(const QString &sourcePath,
+                           const QString &destPath,
+                           bool autoMkdir = false);
+    QFuture<bool> copyFiles(const QList<QPair<QString, QString> > &paths,
+                            bool autoMkdir = false);
+    QFuture<bool> moveFiles(const QList<QPair<QString, QString> > &paths,
+                            bool autoMkdir = false);
+    void setBulkConcurrency(int max);
+    int bulkConcurrency() const;
+
+    QFuture<FileInfo> fileInfo(const QString &filePath);
 
 signals:
     void requestError(QNetworkReply::NetworkError errorCode,
@@ -124,9 +194,12 @@ signals:
     void requestMkdirFinished(bool success);
     void requestRmdirFinished(bool success);
     void requestLsFinished(const QList<ItemInfo> &itemInfos);
+    void requestLsCompactFinished(const QUpYunItemList &items);
     void requestUploadFinished(bool success, const PicInfo &picInfo);
     void requestDownloadFinished(const QByteArray &data);
     void requestRemoveFileFinished(bool success);
+    void requestCopyFileFinished(bool success);
+    void requestMoveFileFinished(bool success);
     void requestFileInfoFinished(const FileInfo &fileInfo);
 
 private:
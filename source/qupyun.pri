@@ -7,7 +7,46 @@ DEFINES += QUPYUN_LIBRARY
 
 HEADERS += \
     $$PWD/qupyun.h \
-    $$PWD/qupyun_global.h
+    $$PWD/qupyun_global.h \
+    $$PWD/qupyunbandwidthlimiter.h \
+    $$PWD/qupyunbandwidthlimiter_p.h \
+    $$PWD/qupyundiskcache.h \
+    $$PWD/qupyunformsigner.h \
+    $$PWD/qupyunitemlist.h \
+    $$PWD/qupyunloopbacktransport.h \
+    $$PWD/qupyunloopbacktransport_p.h \
+    $$PWD/qupyunnetworktransport.h \
+    $$PWD/qupyunsession.h \
+    $$PWD/qupyunsession_p.h \
+    $$PWD/qupyunsockettransport.h \
+    $$PWD/qupyunsockettransport_p.h \
+    $$PWD/qupyuntrafficrecorder.h \
+    $$PWD/qupyuntransferqueue.h \
+    $$PWD/qupyuntransport.h \
+    $$PWD/qupyuntransport_p.h
 
 SOURCES += \
-    $$PWD/qupyun.cpp
+    $$PWD/qupyun.cpp \
+    $$PWD/qupyunbandwidthlimiter.cpp \
+    $$PWD/qupyundiskcache.cpp \
+    $$PWD/qupyunformsigner.cpp \
+    $$PWD/qupyunitemlist.cpp \
+    $$PWD/qupyunloopbacktransport.cpp \
+    $$PWD/qupyunnetworktransport.cpp \
+    $$PWD/qupyunsession.cpp \
+    $$PWD/qupyunsockettransport.cpp \
+    $$PWD/qupyuntrafficrecorder.cpp \
+    $$PWD/qupyuntransferqueue.cpp \
+    $$PWD/qupyuntransport.cpp
+
+qupyun_image {
+    QT *= gui
+
+    HEADERS += \
+        $$PWD/qupyunimagejob_p.h
+
+    SOURCES += \
+        $$PWD/qupyunimagejob.cpp
+} else {
+    DEFINES += QUPYUN_NO_IMAGE_PROCESSING
+}
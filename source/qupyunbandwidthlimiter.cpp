@@ -0,0 +1,266 @@
+#include <QElapsedTimer>
+
+#include "qupyunbandwidthlimiter.h"
+#include "qupyunbandwidthlimiter_p.h"
+
+static const qint64 USEFUL_CHUNK = 64 * 1024;
+
+struct TokenBucket
+{
+    TokenBucket() :
+        rate(0),
+        burst(0),
+        tokens(0),
+        refillTime(0)
+    {
+        clock.start();
+    }
+
+    inline void refill();
+
+    qint64 rate;       // Bytes per second, 0 means unlimited.
+    qint64 burst;      // Bucket capacity in bytes.
+    qint64 tokens;     // Bytes which could be sent right now.
+    qint64 refillTime; // Clock time in nanoseconds the tokens are counted to.
+    QElapsedTimer clock;
+};
+
+/*
+ * Adds the tokens earned since refillTime. Only the time whole tokens took
+ * is consumed, so frequent calls keep the fraction instead of losing it.
+ */
+inline void TokenBucket::refill()
+{
+    qint64 now = clock.nsecsElapsed();
+    if (rate <= 0) {
+        refillTime = now;
+        return;
+    }
+    double earned = double(rate) * double(now - refillTime) / 1e9;
+    if (tokens + earned >= burst) {
+        // idle time past a full bucket earns nothing
+        tokens = burst;
+        refillTime = now;
+        return;
+    }
+    qint64 whole = qint64(earned);
+    if (whole <= 0) {
+        return;
+    }
+    tokens += whole;
+    refillTime += qint64(double(whole) * 1e9 / double(rate));
+}
+
+class QUpYunBandwidthLimiter::Private
+{
+public:
+    Private() :
+        metadataBypass(true)
+    {
+    }
+
+    TokenBucket buckets[2];
+    bool metadataBypass;
+};
+
+/*!
+ * \class QUpYunBandwidthLimiter
+ * \brief Token bucket bandwidth shaper for QUpYun transfers.
+ *
+ * Upload and download directions have their own bucket. The same limiter
+ * could be set on several QUpYun instances so that they share one budget.
+ *
+ * \note The limiter is not thread-safe. Instances sharing it must live in
+ * the thread of the limiter.
+ *
+ * \sa QUpYun::setBandwidthLimiter(QUpYunBandwidthLimiter *)
+ */
+
+/*!
+ * \brief Constructs an unlimited bandwidth limiter with given \a parent.
+ */
+QUpYunBandwidthLimiter::QUpYunBandwidthLimiter(QObject *parent) :
+    QObject(parent),
+    d(new Private)
+{
+}
+
+/*!
+ * \brief Destroys the limiter.
+ */
+QUpYunBandwidthLimiter::~QUpYunBandwidthLimiter()
+{
+    delete d;
+}
+
+/*!
+ * \brief Limits \a direction to \a bytesPerSecond, allowing bursts of \a burst bytes.
+ *
+ * If \a burst is 0, one second worth of traffic is used. Sets
+ * \a bytesPerSecond to 0 to remove the limit. This could be called at any
+ * time, transfers in progress pick up the new rate immediately.
+ */
+void QUpYunBandwidthLimiter::setRate(Direction direction, qint64 bytesPerSecond, qint64 burst)
+{
+    TokenBucket &bucket = d->buckets[direction];
+    bool wasUnlimited = bucket.rate <= 0;
+    bucket.refill();
+    bucket.rate = qMax(Q_INT64_C(0), bytesPerSecond);
+    bucket.burst = burst > 0 ? burst : bucket.rate;
+    // a fresh limit starts with a full bucket
+    bucket.tokens = wasUnlimited ? bucket.burst : qMin(bucket.tokens, bucket.burst);
+    emit rateChanged(direction);
+}
+
+/*!
+ * \brief Returns the rate of \a direction in bytes per second, 0 if unlimited.
+ */
+qint64 QUpYunBandwidthLimiter::rate(Direction direction) const
+{
+    return d->buckets[direction].rate;
+}
+
+/*!
+ * \brief Returns the burst size of \a direction in bytes.
+ */
+qint64 QUpYunBandwidthLimiter::burst(Direction direction) const
+{
+    return d->buckets[direction].burst;
+}
+
+/*!
+ * \brief Sets whether metadata requests bypass the limits to \a bypass.
+ *
+ * Metadata requests are bucketUsage, mkdir, rmdir, ls, removeFile and fileInfo.
+ * It is \c true by default.
+ */
+void QUpYunBandwidthLimiter::setMetadataBypass(bool bypass)
+{
+    d->metadataBypass = bypass;
+}
+
+/*!
+ * \brief Returns true if metadata requests bypass the limits.
+ */
+bool QUpYunBandwidthLimiter::metadataBypass() const
+{
+    return d->metadataBypass;
+}
+
+/*!
+ * \brief Takes at most \a maxBytes tokens of \a direction.
+ *
+ * Returns the amount which could be transferred now, maybe 0.
+ */
+qint64 QUpYunBandwidthLimiter::acquire(Direction direction, qint64 maxBytes)
+{
+    TokenBucket &bucket = d->buckets[direction];
+    if (bucket.rate <= 0) {
+        return maxBytes;
+    }
+    bucket.refill();
+    qint64 granted = qMin(maxBytes, bucket.tokens);
+    bucket.tokens -= granted;
+    return granted;
+}
+
+/*!
+ * \brief Returns milliseconds before a useful amount of \a direction is available.
+ *
+ * A useful amount is 64 KB, a tenth of a second of traffic or the burst
+ * size, whichever is the smallest, so waiting transfers wake up to send a
+ * chunk rather than a few bytes.
+ */
+int QUpYunBandwidthLimiter::msecsUntilAvailable(Direction direction) const
+{
+    const TokenBucket &bucket = d->buckets[direction];
+    if (bucket.rate <= 0) {
+        return 0;
+    }
+    qint64 needed = qMax(Q_INT64_C(1), qMin(qMin(USEFUL_CHUNK, bucket.rate / 10), bucket.burst));
+    double available = bucket.tokens
+            + double(bucket.rate) * double(bucket.clock.nsecsElapsed() - bucket.refillTime) / 1e9;
+    if (available >= needed) {
+        return 0;
+    }
+    // at least 1 ms, do not spin
+    return qMax(1, int((double(needed) - available) * 1000 / double(bucket.rate) + 1));
+}
+
+
+QUpYunThrottledDevice::QUpYunThrottledDevice(const QByteArray &data,
+                                             QUpYunBandwidthLimiter *bandwidthLimiter,
+                                             QObject *parent) :
+    QIODevice(parent),
+    buffer(data),
+    limiter(bandwidthLimiter)
+{
+    timer.setSingleShot(true);
+    connect(&timer, SIGNAL(timeout()), this, SLOT(wakeUp()));
+    if (bandwidthLimiter) {
+        connect(bandwidthLimiter, SIGNAL(rateChanged(QUpYunBandwidthLimiter::Direction)),
+                this, SLOT(wakeUp()));
+    }
+    open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+}
+
+qint64 QUpYunThrottledDevice::size() const
+{
+    return buffer.size();
+}
+
+qint64 QUpYunThrottledDevice::readData(char *data, qint64 maxSize)
+{
+    qint64 remaining = buffer.size() - pos();
+    if (remaining <= 0) {
+        return -1;
+    }
+    if (maxSize <= 0) {
+        return 0;
+    }
+    qint64 wanted = qMin(maxSize, remaining);
+    qint64 granted = limiter ? limiter->acquire(QUpYunBandwidthLimiter::Upload, wanted) : wanted;
+    if (granted <= 0) {
+        // readyRead() will be emitted when there are tokens again
+        if (!timer.isActive()) {
+            timer.start(limiter->msecsUntilAvailable(QUpYunBandwidthLimiter::Upload));
+        }
+        return 0;
+    }
+    memcpy(data, buffer.constData() + pos(), granted);
+    return granted;
+}
+
+qint64 QUpYunThrottledDevice::writeData(const char *data, qint64 maxSize)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(maxSize);
+    return -1;
+}
+
+void QUpYunThrottledDevice::wakeUp()
+{
+    if (pos() < buffer.size()) {
+        emit readyRead();
+    }
+}
+
+/*!
+ * \enum QUpYunBandwidthLimiter::Direction
+ * \brief Transfer direction.
+ */
+
+/*!
+ * \var QUpYunBandwidthLimiter::Direction QUpYunBandwidthLimiter::Upload
+ * \brief Request bodies sent to UpYun.
+ */
+
+/*!
+ * \var QUpYunBandwidthLimiter::Direction QUpYunBandwidthLimiter::Download
+ * \brief Reply bodies received from UpYun.
+ */
+
+/*!
+ * \fn void QUpYunBandwidthLimiter::rateChanged(QUpYunBandwidthLimiter::Direction direction)
+ * \brief Emitted when the rate of \a direction is changed.
+ */
@@ -0,0 +1,39 @@
+#ifndef QUPYUNBANDWIDTHLIMITER_H
+#define QUPYUNBANDWIDTHLIMITER_H
+
+#include <QObject>
+
+#include "qupyun_global.h"
+
+class QUPYUNSHARED_EXPORT QUpYunBandwidthLimiter : public QObject
+{
+    Q_OBJECT
+public:
+    enum Direction
+    {
+        Upload = 0,
+        Download
+    };
+
+    explicit QUpYunBandwidthLimiter(QObject *parent = 0);
+    ~QUpYunBandwidthLimiter();
+
+    void setRate(Direction direction, qint64 bytesPerSecond, qint64 burst = 0);
+    qint64 rate(Direction direction) const;
+    qint64 burst(Direction direction) const;
+
+    void setMetadataBypass(bool bypass);
+    bool metadataBypass() const;
+
+    qint64 acquire(Direction direction, qint64 maxBytes);
+    int msecsUntilAvailable(Direction direction) const;
+
+signals:
+    void rateChanged(QUpYunBandwidthLimiter::Direction direction);
+
+private:
+    class Private;
+    QUpYunBandwidthLimiter::Private *d;
+}; // end of class QUpYunBandwidthLimiter
+
+#endif // QUPYUNBANDWIDTHLIMITER_H
@@ -0,0 +1,37 @@
+#ifndef QUPYUNBANDWIDTHLIMITER_P_H
+#define QUPYUNBANDWIDTHLIMITER_P_H
+
+#include <QIODevice>
+#include <QPointer>
+#include <QTimer>
+
+#include "qupyunbandwidthlimiter.h"
+
+/*
+ * Read-only device feeding an upload body to QNetworkAccessManager no faster
+ * than the upload bucket of the limiter allows. Not part of the public API.
+ */
+class QUpYunThrottledDevice : public QIODevice
+{
+    Q_OBJECT
+public:
+    QUpYunThrottledDevice(const QByteArray &data,
+                          QUpYunBandwidthLimiter *bandwidthLimiter,
+                          QObject *parent = 0);
+
+    qint64 size() const;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize);
+    qint64 writeData(const char *data, qint64 maxSize);
+
+private slots:
+    void wakeUp();
+
+private:
+    QByteArray buffer;
+    QPointer<QUpYunBandwidthLimiter> limiter;
+    QTimer timer;
+}; // end of class QUpYunThrottledDevice
+
+#endif // QUPYUNBANDWIDTHLIMITER_P_H
@@ -0,0 +1,415 @@
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMap>
+
+#include "qupyundiskcache.h"
+
+static const qint64 DEFAULT_MAXIMUM_CACHE_SIZE = 50 * 1024 * 1024;
+static const char CACHE_MAGIC[] = "QUPYUNCACHE1\n";
+static const char CACHE_SUFFIX[] = ".cache";
+
+// Cache file: MAGIC, key, data size and last modified time on their own
+// lines, followed by the data.
+struct CacheEntry
+{
+    CacheEntry() :
+        dataOffset(0),
+        dataSize(0),
+        lastModified(0),
+        tick(0)
+    {
+    }
+
+    QString fileName;
+    qint64 dataOffset;
+    qint64 dataSize;
+    uint lastModified;     // 0 if unknown.
+    quint64 tick;          // Last use, for LRU.
+    QElapsedTimer validated;
+};
+
+class QUpYunDiskCache::Private
+{
+public:
+    Private(const QString &dir) :
+        directory(dir),
+        maximumCacheSize(DEFAULT_MAXIMUM_CACHE_SIZE),
+        cacheSize(0),
+        validationInterval(0),
+        clock(0)
+    {
+    }
+
+    void load();
+    bool readEntry(const QString &fileName, QString *key, CacheEntry *entry) const;
+    void touch(const QString &key, CacheEntry &entry);
+    void evict(const QString &key);
+    void prune(qint64 limit);
+    QString fileNameOf(const QString &key) const;
+
+    QString directory;
+    qint64 maximumCacheSize;
+    qint64 cacheSize;
+    int validationInterval;
+
+    QHash<QString, CacheEntry> entries;
+    QMap<quint64, QString> lru;  // Oldest first.
+    quint64 clock;
+};
+
+void QUpYunDiskCache::Private::load()
+{
+    QDir dir(directory);
+    if (!dir.exists()) {
+        dir.mkpath(QLatin1String("."));
+        return;
+    }
+    // left by crashes while inserting
+    QStringList temporaries = dir.entryList(QStringList(QLatin1String("*.tmp")), QDir::Files);
+    foreach (const QString &temporary, temporaries) {
+        dir.remove(temporary);
+    }
+    QFileInfoList files = dir.entryInfoList(QStringList(QLatin1String("*") + QLatin1String(CACHE_SUFFIX)),
+                                            QDir::Files,
+                                            QDir::Time | QDir::Reversed);
+    foreach (const QFileInfo &info, files) {
+        QString key;
+        CacheEntry entry;
+        if (!readEntry(info.absoluteFilePath(), &key, &entry) || entries.contains(key)) {
+            QFile::remove(info.absoluteFilePath());
+            continue;
+        }
+        entry.tick = ++clock;
+        entries.insert(key, entry);
+        lru.insert(entry.tick, key);
+        cacheSize += entry.dataSize;
+    }
+    prune(maximumCacheSize);
+}
+
+bool QUpYunDiskCache::Private::readEntry(const QString &fileName, QString *key, CacheEntry *entry) const
+{
+    QFile file(fileName);
+    if (!file.open(QFile::ReadOnly)) {
+        return false;
+    }
+    if (file.readLine() != CACHE_MAGIC) {
+        return false;
+    }
+    QByteArray keyLine = file.readLine();
+    QByteArray sizeLine = file.readLine();
+    QByteArray dateLine = file.readLine();
+    if (!keyLine.endsWith('\n') || !sizeLine.endsWith('\n') || !dateLine.endsWith('\n')) {
+        return false;
+    }
+    bool ok = false;
+    entry->dataSize = sizeLine.trimmed().toLongLong(&ok);
+    if (!ok) {
+        return false;
+    }
+    entry->lastModified = dateLine.trimmed().toUInt(&ok);
+    if (!ok) {
+        return false;
+    }
+    entry->dataOffset = file.pos();
+    if (file.size() - entry->dataOffset != entry->dataSize) {
+        // partly written
+        return false;
+    }
+    keyLine.chop(1);
+    *key = QString::fromUtf8(keyLine.constData(), keyLine.size());
+    entry->fileName = fileName;
+    return true;
+}
+
+void QUpYunDiskCache::Private::touch(const QString &key, CacheEntry &entry)
+{
+    lru.remove(entry.tick);
+    entry.tick = ++clock;
+    lru.insert(entry.tick, key);
+}
+
+void QUpYunDiskCache::Private::evict(const QString &key)
+{
+    QHash<QString, CacheEntry>::iterator i = entries.find(key);
+    if (i == entries.end()) {
+        return;
+    }
+    CacheEntry &entry = i.value();
+    QFile::remove(entry.fileName);
+    lru.remove(entry.tick);
+    cacheSize -= entry.dataSize;
+    entries.erase(i);
+}
+
+void QUpYunDiskCache::Private::prune(qint64 limit)
+{
+    while (cacheSize > limit && !lru.isEmpty()) {
+        QString key = lru.begin().value();
+        evict(key);
+    }
+}
+
+QString QUpYunDiskCache::Private::fileNameOf(const QString &key) const
+{
+    QByteArray hash = QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Md5).toHex();
+    return directory + QLatin1Char('/') + QString::fromLatin1(hash) + QLatin1String(CACHE_SUFFIX);
+}
+
+/*!
+ * \class QUpYunDiskCache
+ * \brief Size-bounded on-disk cache of downloaded files.
+ *
+ * Entries are keyed by the formatted path (bucket name included) and
+ * evicted in least recently used order when the cache grows past
+ * maximumCacheSize(). Cached data is read from the file on every hit, so
+ * arrays returned by data() stay valid after the entry is evicted.
+ *
+ * \sa QUpYun::setDiskCache(QUpYunDiskCache *)
+ */
+
+/*!
+ * \brief Constructs a cache stored in \a directory with given \a parent.
+ *
+ * Entries left in \a directory by former processes are loaded.
+ */
+QUpYunDiskCache::QUpYunDiskCache(const QString &directory, QObject *parent) :
+    QObject(parent),
+    d(new Private(directory))
+{
+    d->load();
+}
+
+/*!
+ * \brief Destroys the cache. Entries are kept on disk.
+ */
+QUpYunDiskCache::~QUpYunDiskCache()
+{
+    delete d;
+}
+
+/*!
+ * \brief Returns the directory the cache is stored in.
+ */
+QString QUpYunDiskCache::directory() const
+{
+    return d->directory;
+}
+
+/*!
+ * \brief Sets the maximum cache size to \a size bytes. 50 MB by default.
+ */
+void QUpYunDiskCache::setMaximumCacheSize(qint64 size)
+{
+    d->maximumCacheSize = qMax(Q_INT64_C(0), size);
+    d->prune(d->maximumCacheSize);
+}
+
+/*!
+ * \brief Returns the maximum cache size in bytes.
+ */
+qint64 QUpYunDiskCache::maximumCacheSize() const
+{
+    return d->maximumCacheSize;
+}
+
+/*!
+ * \brief Returns the size of cached data in bytes.
+ */
+qint64 QUpYunDiskCache::cacheSize() const
+{
+    return d->cacheSize;
+}
+
+/*!
+ * \brief Sets entries validated less than \a msecs ago to be served without validating.
+ *
+ * 0 by default, which validates every time.
+ */
+void QUpYunDiskCache::setValidationInterval(int msecs)
+{
+    d->validationInterval = qMax(0, msecs);
+}
+
+/*!
+ * \brief Returns the interval in milliseconds entries are served without validating.
+ */
+int QUpYunDiskCache::validationInterval() const
+{
+    return d->validationInterval;
+}
+
+/*!
+ * \brief Returns true if there is an entry for \a key.
+ */
+bool QUpYunDiskCache::contains(const QString &key) const
+{
+    return d->entries.contains(key);
+}
+
+/*!
+ * \brief Returns the last modified time of the file cached for \a key.
+ *
+ * It is seconds since epoch, 0 if unknown or there is no entry.
+ */
+uint QUpYunDiskCache::lastModified(const QString &key) const
+{
+    return d->entries.value(key).lastModified;
+}
+
+/*!
+ * \brief Returns the data cached for \a key, an empty array if there is none.
+ *
+ * An entry whose file could not be read completely is removed.
+ */
+QByteArray QUpYunDiskCache::data(const QString &key)
+{
+    QHash<QString, CacheEntry>::iterator i = d->entries.find(key);
+    if (i == d->entries.end()) {
+        return QByteArray();
+    }
+    CacheEntry &entry = i.value();
+    d->touch(key, entry);
+    if (entry.dataSize == 0) {
+        return QByteArray();
+    }
+    QFile file(entry.fileName);
+    QByteArray data;
+    if (file.open(QFile::ReadOnly) && file.seek(entry.dataOffset)) {
+        data = file.read(entry.dataSize);
+    }
+    if (data.size() != entry.dataSize) {
+        // removed or truncated behind the cache
+        d->evict(key);
+        return QByteArray();
+    }
+    return data;
+}
+
+/*!
+ * \brief Caches \a data for \a key, which was last modified at \a lastModified.
+ *
+ * \a lastModified is seconds since epoch, 0 if unknown. Returns false if the
+ * data could not be cached, for example it is larger than maximumCacheSize().
+ */
+bool QUpYunDiskCache::insert(const QString &key, const QByteArray &data, uint lastModified)
+{
+    d->evict(key);
+    if (data.size() > d->maximumCacheSize) {
+        return false;
+    }
+    d->prune(d->maximumCacheSize - data.size());
+
+    CacheEntry entry;
+    entry.fileName = d->fileNameOf(key);
+    QString temporaryName = entry.fileName + QLatin1String(".tmp");
+    QFile file(temporaryName);
+    if (!file.open(QFile::WriteOnly | QFile::Truncate)) {
+        return false;
+    }
+    QByteArray header(CACHE_MAGIC);
+    header += key.toUtf8();
+    header += '\n';
+    header += QByteArray::number(data.size());
+    header += '\n';
+    header += QByteArray::number(lastModified);
+    header += '\n';
+    if (file.write(header) != header.size() || file.write(data) != data.size()) {
+        file.close();
+        QFile::remove(temporaryName);
+        return false;
+    }
+    file.close();
+    QFile::remove(entry.fileName);
+    if (!QFile::rename(temporaryName, entry.fileName)) {
+        QFile::remove(temporaryName);
+        return false;
+    }
+
+    entry.dataOffset = header.size();
+    entry.dataSize = data.size();
+    entry.lastModified = lastModified;
+    entry.tick = ++d->clock;
+    entry.validated.start();
+    d->entries.insert(key, entry);
+    d->lru.insert(entry.tick, key);
+    d->cacheSize += entry.dataSize;
+    return true;
+}
+
+/*!
+ * \brief Removes the entry for \a key. Returns false if there is none.
+ */
+bool QUpYunDiskCache::remove(const QString &key)
+{
+    if (!d->entries.contains(key)) {
+        return false;
+    }
+    d->evict(key);
+    return true;
+}
+
+/*!
+ * \brief Removes all entries.
+ */
+void QUpYunDiskCache::clear()
+{
+    d->prune(0);
+}
+
+/*!
+ * \brief Returns true if the entry for \a key could be served without validating.
+ *
+ * \sa QUpYunDiskCache::setValidationInterval(int)
+ */
+bool QUpYunDiskCache::isFresh(const QString &key) const
+{
+    QHash<QString, CacheEntry>::const_iterator i = d->entries.constFind(key);
+    return i != d->entries.constEnd()
+            && d->validationInterval > 0
+            && i.value().validated.isValid()
+            && i.value().validated.elapsed() < d->validationInterval;
+}
+
+/*!
+ * \brief Validates the entry for \a key against \a size and \a lastModified of the file.
+ *
+ * Returns true if the entry is still valid. An entry cached without the
+ * last modified time takes \a lastModified if its size matches.
+ */
+bool QUpYunDiskCache::validate(const QString &key, qulonglong size, uint lastModified)
+{
+    QHash<QString, CacheEntry>::iterator i = d->entries.find(key);
+    if (i == d->entries.end()) {
+        return false;
+    }
+    CacheEntry &entry = i.value();
+    if (qulonglong(entry.dataSize) != size
+            || (entry.lastModified != 0 && entry.lastModified != lastModified)) {
+        return false;
+    }
+    entry.lastModified = lastModified;
+    entry.validated.start();
+    return true;
+}
+
+/*!
+ * \brief Marks the entry for \a key valid, as the server answered it has not
+ * been modified.
+ *
+ * Returns false if there is no entry for \a key.
+ */
+bool QUpYunDiskCache::validate(const QString &key)
+{
+    QHash<QString, CacheEntry>::iterator i = d->entries.find(key);
+    if (i == d->entries.end()) {
+        return false;
+    }
+    i.value().validated.start();
+    return true;
+}
@@ -0,0 +1,40 @@
+#ifndef QUPYUNDISKCACHE_H
+#define QUPYUNDISKCACHE_H
+
+#include <QObject>
+
+#include "qupyun_global.h"
+
+class QUPYUNSHARED_EXPORT QUpYunDiskCache : public QObject
+{
+    Q_OBJECT
+public:
+    explicit QUpYunDiskCache(const QString &directory, QObject *parent = 0);
+    ~QUpYunDiskCache();
+
+    QString directory() const;
+
+    void setMaximumCacheSize(qint64 size);
+    qint64 maximumCacheSize() const;
+    qint64 cacheSize() const;
+
+    void setValidationInterval(int msecs);
+    int validationInterval() const;
+
+    bool contains(const QString &key) const;
+    uint lastModified(const QString &key) const;
+    QByteArray data(const QString &key);
+    bool insert(const QString &key, const QByteArray &data, uint lastModified = 0);
+    bool remove(const QString &key);
+    void clear();
+
+    bool isFresh(const QString &key) const;
+    bool validate(const QString &key, qulonglong size, uint lastModified);
+    bool validate(const QString &key);
+
+private:
+    class Private;
+    QUpYunDiskCache::Private *d;
+}; // end of class QUpYunDiskCache
+
+#endif // QUPYUNDISKCACHE_H
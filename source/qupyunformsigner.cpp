@@ -0,0 +1,321 @@
+#include <QCryptographicHash>
+#include <QMap>
+
+#include "qupyunformsigner.h"
+
+static const int DEFAULT_EXPIRATION = 10 * 60;
+
+/*
+ * Appends utf8 to out as a JSON string.
+ */
+static void appendJsonString(QByteArray &out, const QByteArray &utf8)
+{
+    static const char HEX[] = "0123456789abcdef";
+
+    out += '"';
+    const char *p = utf8.constData();
+    const char *end = p + utf8.size();
+    for (; p < end; ++p) {
+        uchar c = uchar(*p);
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += char(c);
+        } else if (c < 0x20) {
+            out += "\\u00";
+            out += HEX[c >> 4];
+            out += HEX[c & 0xf];
+        } else {
+            out += char(c);
+        }
+    }
+    out += '"';
+}
+
+static inline QByteArray range(qint64 minimum, qint64 maximum)
+{
+    return QByteArray::number(minimum) + ',' + QByteArray::number(maximum);
+}
+
+class QUpYunFormSigner::Private
+{
+public:
+    void rebuild();
+
+    QString bucket;
+    QByteArray secret;
+    QString saveKey;
+    int expiration;
+    QMap<QByteArray, QByteArray> fields; // Sorted, so policies are stable.
+    QByteArray head;                     // {"bucket":"..."
+    QByteArray tail;                     // ,"name":"value"...}
+}; // end of class QUpYunFormSigner::Private
+
+/*
+ * Serializes the fields shared by all policies once, so that signing only
+ * adds the expiration and the save key.
+ */
+void QUpYunFormSigner::Private::rebuild()
+{
+    head = "{\"bucket\":";
+    appendJsonString(head, bucket.toUtf8());
+    tail.clear();
+    QMap<QByteArray, QByteArray>::const_iterator i = fields.constBegin();
+    for (; i != fields.constEnd(); ++i) {
+        tail += ',';
+        appendJsonString(tail, i.key());
+        tail += ':';
+        appendJsonString(tail, i.value());
+    }
+    tail += '}';
+}
+
+/*!
+ * \class QUpYunFormSigner
+ * \brief Generates policies and signatures of the UpYun form API.
+ *
+ * The form API lets browsers and mobile clients upload directly to UpYun
+ * by POST to http://v0.api.upyun.com/BUCKET with the \c policy and
+ * \c signature fields, so only the signing happens on the server. A signer
+ * holds the settings shared by the policies it generates; sign() only adds
+ * the expiration and the save key, so it could be called thousands of
+ * times per second. Signing is thread-safe as long as the settings do not
+ * change meanwhile.
+ *
+ * \sa http://wiki.upyun.com/index.php?title=%E8%A1%A8%E5%8D%95API%E6%8E%A5%E5%8F%A3
+ */
+
+/*!
+ * \brief Constructs a signer for \a bucketName with \a formAPISecret.
+ *
+ * The form API secret is set in the bucket settings and is not the password
+ * of the operator.
+ */
+QUpYunFormSigner::QUpYunFormSigner(const QString &bucketName, const QString &formAPISecret) :
+    d(new Private)
+{
+    d->bucket = bucketName;
+    d->secret = formAPISecret.toUtf8();
+    d->expiration = DEFAULT_EXPIRATION;
+    d->rebuild();
+}
+
+/*!
+ * \brief Destroys the signer.
+ */
+QUpYunFormSigner::~QUpYunFormSigner()
+{
+    delete d;
+}
+
+/*!
+ * \brief Returns the bucket the policies are for.
+ */
+QString QUpYunFormSigner::bucketName() const
+{
+    return d->bucket;
+}
+
+/*!
+ * \brief Sets the save key used when sign() is given none to \a pathTemplate.
+ *
+ * The template could use the variables of the form API, such as \c {year},
+ * \c {mon}, \c {day}, \c {filename}, \c {.suffix}, \c {filemd5} and
+ * \c {random}, eg. "/{year}/{mon}/{filemd5}{.suffix}".
+ */
+void QUpYunFormSigner::setSaveKey(const QString &pathTemplate)
+{
+    d->saveKey = pathTemplate;
+}
+
+/*!
+ * \brief Returns the default save key.
+ */
+QString QUpYunFormSigner::saveKey() const
+{
+    return d->saveKey;
+}
+
+/*!
+ * \brief Sets policies to expire \a secs after they are signed. It is 10 minutes by default.
+ */
+void QUpYunFormSigner::setExpiration(int secs)
+{
+    d->expiration = qMax(1, secs);
+}
+
+/*!
+ * \brief Returns the seconds policies are valid after they are signed.
+ */
+int QUpYunFormSigner::expiration() const
+{
+    return d->expiration;
+}
+
+/*!
+ * \brief Limits the size of uploaded files from \a minimum to \a maximum bytes.
+ */
+void QUpYunFormSigner::setContentLengthRange(qint64 minimum, qint64 maximum)
+{
+    setField("content-length-range", range(minimum, maximum));
+}
+
+/*!
+ * \brief Allows only files with \a suffixes, separated by comma, eg. "jpg,jpeg,png".
+ */
+void QUpYunFormSigner::setAllowFileType(const QString &suffixes)
+{
+    setField("allow-file-type", suffixes);
+}
+
+/*!
+ * \brief Allows only pictures from \a minimum to \a maximum pixels wide.
+ */
+void QUpYunFormSigner::setImageWidthRange(int minimum, int maximum)
+{
+    setField("image-width-range", range(minimum, maximum));
+}
+
+/*!
+ * \brief Allows only pictures from \a minimum to \a maximum pixels high.
+ */
+void QUpYunFormSigner::setImageHeightRange(int minimum, int maximum)
+{
+    setField("image-height-range", range(minimum, maximum));
+}
+
+/*!
+ * \brief Adds the upload parameters \a params to the policies.
+ *
+ * These are the same parameters as in QUpYun::uploadFile(), so the
+ * \c x-gmkerl options built by QUpYun::extraParamHeader() and headers
+ * such as \c Content-Secret become the matching form fields.
+ *
+ * \sa QUpYun::ExtraParam
+ */
+void QUpYunFormSigner::setParams(const QUpYun::RequestParams &params)
+{
+    QUpYun::RequestParams::const_iterator i = params.constBegin();
+    for (; i != params.constEnd(); ++i) {
+        d->fields.insert(i.key().toLower(), i.value().toByteArray());
+    }
+    d->rebuild();
+}
+
+/*!
+ * \brief Sets the form field \a name of the policies to \a value.
+ *
+ * Could be used for fields without a setter, such as \c return-url and
+ * \c notify-url. An invalid \a value removes the field.
+ */
+void QUpYunFormSigner::setField(const QByteArray &name, const QVariant &value)
+{
+    if (value.isValid()) {
+        d->fields.insert(name, value.toByteArray());
+    } else {
+        d->fields.remove(name);
+    }
+    d->rebuild();
+}
+
+/*!
+ * \brief Removes all fields but the bucket, the expiration and the save key.
+ */
+void QUpYunFormSigner::clearFields()
+{
+    d->fields.clear();
+    d->rebuild();
+}
+
+/*!
+ * \brief Signs a policy saving the file to \a saveKey, or to saveKey() if empty.
+ *
+ * The policy expires expiration() seconds from now.
+ */
+FormPolicy QUpYunFormSigner::sign(const QString &saveKey) const
+{
+    return sign(saveKey, QDateTime::currentDateTime().toTime_t() + d->expiration);
+}
+
+/*!
+ * \brief Signs a policy saving the file to \a saveKey, or to saveKey() if empty, until \a expiration.
+ *
+ * \a expiration is in seconds since 1970-01-01T00:00:00 UTC.
+ */
+FormPolicy QUpYunFormSigner::sign(const QString &saveKey, uint expiration) const
+{
+    static QByteArray EXPIRATION(",\"expiration\":");
+    static QByteArray SAVE_KEY(",\"save-key\":");
+
+    FormPolicy result;
+    result.saveKey = saveKey.isEmpty() ? d->saveKey : saveKey;
+    result.expiration = expiration;
+
+    QByteArray key = result.saveKey.toUtf8();
+    QByteArray json;
+    json.reserve(d->head.size() + d->tail.size() + key.size() + 48);
+    json += d->head;
+    json += EXPIRATION;
+    json += QByteArray::number(expiration);
+    if (!key.isEmpty()) {
+        json += SAVE_KEY;
+        appendJsonString(json, key);
+    }
+    json += d->tail;
+
+    result.policy = json.toBase64();
+    result.signature = signature(result.policy, d->secret);
+    return result;
+}
+
+/*!
+ * \brief Signs a policy for each of \a saveKeys, all expiring expiration() seconds from now.
+ */
+QList<FormPolicy> QUpYunFormSigner::sign(const QStringList &saveKeys) const
+{
+    uint expiration = QDateTime::currentDateTime().toTime_t() + d->expiration;
+    QList<FormPolicy> policies;
+    policies.reserve(saveKeys.size());
+    foreach (const QString &key, saveKeys) {
+        policies.append(sign(key, expiration));
+    }
+    return policies;
+}
+
+/*!
+ * \brief Returns the signature of \a policy, the MD5 of policy&formAPISecret in hex.
+ */
+QByteArray QUpYunFormSigner::signature(const QByteArray &policy, const QByteArray &formAPISecret)
+{
+    QByteArray message;
+    message.reserve(policy.size() + formAPISecret.size() + 1);
+    message += policy;
+    message += '&';
+    message += formAPISecret;
+    return QCryptographicHash::hash(message, QCryptographicHash::Md5).toHex();
+}
+
+
+/*!
+ * \struct FormPolicy
+ * \brief Signed policy of the form API.
+ */
+
+/*!
+ * \var QByteArray FormPolicy::policy
+ * \brief Returns the policy, Base64 encoded, sent as the \c policy field.
+ */
+
+/*!
+ * \var QByteArray FormPolicy::signature
+ * \brief Returns the signature sent as the \c signature field.
+ */
+
+/*!
+ * \var QString FormPolicy::saveKey
+ * \brief Returns the save key in the policy.
+ */
+
+/*!
+ * \var uint FormPolicy::expiration
+ * \brief Returns the time the policy expires, in seconds since 1970-01-01T00:00:00 UTC.
+ */
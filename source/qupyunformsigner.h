@@ -0,0 +1,51 @@
+#ifndef QUPYUNFORMSIGNER_H
+#define QUPYUNFORMSIGNER_H
+
+#include <QStringList>
+
+#include "qupyun.h"
+
+struct FormPolicy
+{
+    QByteArray policy;
+    QByteArray signature;
+    QString    saveKey;
+    uint       expiration;
+};
+Q_DECLARE_METATYPE(FormPolicy)
+
+class QUPYUNSHARED_EXPORT QUpYunFormSigner
+{
+public:
+    QUpYunFormSigner(const QString &bucketName, const QString &formAPISecret);
+    ~QUpYunFormSigner();
+
+    QString bucketName() const;
+
+    void setSaveKey(const QString &pathTemplate);
+    QString saveKey() const;
+
+    void setExpiration(int secs);
+    int expiration() const;
+
+    void setContentLengthRange(qint64 minimum, qint64 maximum);
+    void setAllowFileType(const QString &suffixes);
+    void setImageWidthRange(int minimum, int maximum);
+    void setImageHeightRange(int minimum, int maximum);
+    void setParams(const QUpYun::RequestParams &params);
+    void setField(const QByteArray &name, const QVariant &value);
+    void clearFields();
+
+    FormPolicy sign(const QString &saveKey = QString()) const;
+    FormPolicy sign(const QString &saveKey, uint expiration) const;
+    QList<FormPolicy> sign(const QStringList &saveKeys) const;
+
+    static QByteArray signature(const QByteArray &policy, const QByteArray &formAPISecret);
+
+private:
+    Q_DISABLE_COPY(QUpYunFormSigner)
+    class Private;
+    QUpYunFormSigner::Private *d;
+}; // end of class QUpYunFormSigner
+
+#endif // QUPYUNFORMSIGNER_H
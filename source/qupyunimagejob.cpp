@@ -0,0 +1,281 @@
+#include <QBuffer>
+#include <QImage>
+#include <QImageIOHandler>
+#include <QImageReader>
+#include <QImageWriter>
+#include <QTransform>
+
+#include "qupyunimagejob_p.h"
+
+static const int DEFAULT_QUALITY = 95;
+
+static inline QByteArray header(QUpYun::ExtraParam param)
+{
+    return QUpYun::extraParamHeader(param);
+}
+
+/*
+ * Parses "150" or "200x150". Returns false if value is invalid.
+ */
+static bool parseThumbnailValue(const QByteArray &value, int *width, int *height)
+{
+    bool ok = false;
+    int x = value.indexOf('x');
+    if (x < 0) {
+        *width = *height = value.trimmed().toInt(&ok);
+        return ok && *width > 0;
+    }
+    *width = value.left(x).trimmed().toInt(&ok);
+    if (!ok) {
+        return false;
+    }
+    *height = value.mid(x + 1).trimmed().toInt(&ok);
+    return ok && *width > 0 && *height > 0;
+}
+
+/*
+ * Parses "x,y,width,height".
+ */
+static QRect parseCrop(const QByteArray &value)
+{
+    QList<QByteArray> parts = value.split(',');
+    if (parts.size() != 4) {
+        return QRect();
+    }
+    int numbers[4];
+    for (int i = 0; i < 4; ++i) {
+        bool ok = false;
+        numbers[i] = parts.at(i).trimmed().toInt(&ok);
+        if (!ok) {
+            return QRect();
+        }
+    }
+    if (numbers[0] < 0 || numbers[1] < 0 || numbers[2] <= 0 || numbers[3] <= 0) {
+        return QRect();
+    }
+    return QRect(numbers[0], numbers[1], numbers[2], numbers[3]);
+}
+
+/*
+ * Returns the size a picture of source size should be scaled to for
+ * thumbnail type and value. Returns an invalid size if type is unknown.
+ * SQUARE returns the size covering the square, which is cropped later.
+ */
+static QSize thumbnailSize(const QSize &source, const QByteArray &type, int width, int height)
+{
+    QSize target;
+    if (type == header(QUpYun::FIX_MAX)) {
+        target = source.scaled(width, width, Qt::KeepAspectRatio);
+    } else if (type == header(QUpYun::FIX_MIN)) {
+        target = source.scaled(width, width, Qt::KeepAspectRatioByExpanding);
+    } else if (type == header(QUpYun::FIX_WIDTH)) {
+        target = QSize(width, qMax(1, qRound(qreal(source.height()) * width / source.width())));
+    } else if (type == header(QUpYun::FIX_HEIGHT)) {
+        target = QSize(qMax(1, qRound(qreal(source.width()) * height / source.height())), height);
+    } else if (type == header(QUpYun::FIX_WIDTH_OR_HEIGHT)) {
+        // exactly width x height like FIX_BOTH, but never scaled up
+        target = QSize(width, height);
+    } else if (type == header(QUpYun::FIX_BOTH)) {
+        // the only type which scales up
+        return QSize(width, height);
+    } else if (type == header(QUpYun::FIX_SCALE)) {
+        if (width >= 100) {
+            return QSize();
+        }
+        target = QSize(qMax(1, source.width() * width / 100),
+                       qMax(1, source.height() * width / 100));
+    } else if (type == header(QUpYun::SQUARE)) {
+        int edge = qMin(width, qMin(source.width(), source.height()));
+        target = source.scaled(edge, edge, Qt::KeepAspectRatioByExpanding);
+    } else {
+        return QSize();
+    }
+    if (target.width() > source.width() || target.height() > source.height()) {
+        return source;
+    }
+    return target;
+}
+
+QUpYunImageJob::QUpYunImageJob(QObject *target,
+                               int jobId,
+                               const QByteArray &picture,
+                               const QUpYun::RequestParams &extraParams) :
+    receiver(target),
+    id(jobId),
+    data(picture),
+    params(extraParams)
+{
+}
+
+void QUpYunImageJob::run()
+{
+    QByteArray processed = process(data, params);
+    data.clear();
+    QMetaObject::invokeMethod(receiver, "imageProcessed", Qt::QueuedConnection,
+                              Q_ARG(int, id),
+                              Q_ARG(QByteArray, processed));
+}
+
+/*
+ * Returns true if params contain anything which could be done locally.
+ * Pictures written locally have no EXIF, as UpYun strips it by default;
+ * if EXIF is asked to be kept, leaves everything to UpYun because
+ * QImageWriter does not write EXIF.
+ */
+bool QUpYunImageJob::accepts(const QUpYun::RequestParams &params)
+{
+#if QT_VERSION < QT_VERSION_CHECK(5, 5, 0)
+    // EXIF orientation could not be applied before Qt 5.5
+    Q_UNUSED(params);
+    return false;
+#else
+    if (params.value(header(QUpYun::X_GMKERL_EXIF_SWITCH)).toBool()) {
+        return false;
+    }
+    return (params.contains(header(QUpYun::X_GMKERL_TYPE))
+            && params.contains(header(QUpYun::X_GMKERL_VALUE)))
+            || params.contains(header(QUpYun::X_GMKERL_CROP))
+            || params.contains(header(QUpYun::X_GMKERL_ROTATE))
+            || params.contains(header(QUpYun::X_GMKERL_QUALITY));
+#endif
+}
+
+/*
+ * Returns params without those which have been done locally. Sharpening
+ * is not done locally, so UpYun still applies it to the processed picture.
+ */
+QUpYun::RequestParams QUpYunImageJob::remainingParams(const QUpYun::RequestParams &params)
+{
+    QUpYun::RequestParams remaining(params);
+    remaining.remove(header(QUpYun::X_GMKERL_TYPE));
+    remaining.remove(header(QUpYun::X_GMKERL_VALUE));
+    remaining.remove(header(QUpYun::X_GMKERL_QUALITY));
+    remaining.remove(header(QUpYun::X_GMKERL_ROTATE));
+    remaining.remove(header(QUpYun::X_GMKERL_CROP));
+    remaining.remove(header(QUpYun::X_GMKERL_EXIF_SWITCH));
+    return remaining;
+}
+
+/*
+ * Crops, scales and rotates the picture in data, in this order.
+ * Returns an empty array if the picture could not be processed.
+ */
+QByteArray QUpYunImageJob::process(const QByteArray &data, const QUpYun::RequestParams &params)
+{
+#if QT_VERSION < QT_VERSION_CHECK(5, 5, 0)
+    Q_UNUSED(data);
+    Q_UNUSED(params);
+    return QByteArray();
+#else
+    QBuffer input;
+    input.setData(data);
+    input.open(QIODevice::ReadOnly);
+    QImageReader reader(&input);
+    QByteArray format = reader.format();
+    if (format.isEmpty() || !QImageWriter::supportedImageFormats().contains(format)) {
+        return QByteArray();
+    }
+    if (reader.supportsAnimation() && reader.imageCount() > 1) {
+        return QByteArray();
+    }
+    reader.setAutoTransform(true);
+
+    QByteArray type = params.value(header(QUpYun::X_GMKERL_TYPE)).toByteArray();
+    QByteArray value = params.value(header(QUpYun::X_GMKERL_VALUE)).toByteArray();
+    QByteArray cropValue = params.value(header(QUpYun::X_GMKERL_CROP)).toByteArray();
+    QByteArray rotate = params.value(header(QUpYun::X_GMKERL_ROTATE)).toByteArray();
+
+    int width = 0;
+    int height = 0;
+    bool scale = !type.isEmpty() && !value.isEmpty();
+    if (scale && !parseThumbnailValue(value, &width, &height)) {
+        return QByteArray();
+    }
+    QRect crop;
+    if (!cropValue.isEmpty()) {
+        crop = parseCrop(cropValue);
+        if (crop.isNull()) {
+            return QByteArray();
+        }
+    }
+
+    bool scaledByReader = false;
+    if (scale && crop.isNull()) {
+        // let the decoder scale, which is much cheaper for large JPEG
+        QSize source = reader.size();
+        bool transposed = reader.transformation() & QImageIOHandler::TransformationRotate90;
+        if (transposed) {
+            source.transpose();
+        }
+        QSize target = source.isValid() ? thumbnailSize(source, type, width, height) : QSize();
+        if (target.isValid() && target != source) {
+            if (transposed) {
+                target.transpose();
+            }
+            reader.setScaledSize(target);
+            scaledByReader = true;
+        }
+    }
+
+    QImage image = reader.read();
+    if (image.isNull()) {
+        return QByteArray();
+    }
+
+    if (!crop.isNull()) {
+        if (!image.rect().contains(crop)) {
+            return QByteArray();
+        }
+        image = image.copy(crop);
+    }
+
+    if (scale) {
+        if (!scaledByReader) {
+            QSize target = thumbnailSize(image.size(), type, width, height);
+            if (!target.isValid()) {
+                return QByteArray();
+            }
+            if (target != image.size()) {
+                image = image.scaled(target, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+            }
+        }
+        if (type == header(QUpYun::SQUARE)) {
+            int edge = qMin(image.width(), image.height());
+            image = image.copy((image.width() - edge) / 2,
+                               (image.height() - edge) / 2,
+                               edge,
+                               edge);
+        }
+    }
+
+    // ROTATE_AUTO has been done by the reader
+    int degrees = 0;
+    if (rotate == header(QUpYun::ROTATE_90)) {
+        degrees = 90;
+    } else if (rotate == header(QUpYun::ROTATE_180)) {
+        degrees = 180;
+    } else if (rotate == header(QUpYun::ROTATE_270)) {
+        degrees = 270;
+    }
+    if (degrees != 0) {
+        image = image.transformed(QTransform().rotate(degrees));
+    }
+
+    bool ok = false;
+    int quality = params.value(header(QUpYun::X_GMKERL_QUALITY)).toInt(&ok);
+    if (!ok) {
+        quality = DEFAULT_QUALITY;
+    }
+
+    QBuffer output;
+    output.open(QIODevice::WriteOnly);
+    QImageWriter writer(&output, format);
+    if (format == "jpeg" || format == "jpg" || format == "webp") {
+        writer.setQuality(qBound(1, quality, 100));
+    }
+    if (!writer.write(image)) {
+        return QByteArray();
+    }
+    return output.data();
+#endif
+}
@@ -0,0 +1,36 @@
+#ifndef QUPYUNIMAGEJOB_P_H
+#define QUPYUNIMAGEJOB_P_H
+
+#include <QRunnable>
+
+#include "qupyun.h"
+
+/*
+ * Decodes, crops, scales, rotates and re-encodes one picture in a worker
+ * thread using the same x-gmkerl-* parameters UpYun accepts, then hands
+ * the result back to the receiver by invoking its
+ * imageProcessed(int, QByteArray) slot. An empty result means the picture
+ * should be uploaded as is and processed by UpYun. Not part of the public API.
+ */
+class QUpYunImageJob : public QRunnable
+{
+public:
+    QUpYunImageJob(QObject *target,
+                   int jobId,
+                   const QByteArray &picture,
+                   const QUpYun::RequestParams &extraParams);
+
+    void run();
+
+    static bool accepts(const QUpYun::RequestParams &params);
+    static QUpYun::RequestParams remainingParams(const QUpYun::RequestParams &params);
+    static QByteArray process(const QByteArray &data, const QUpYun::RequestParams &params);
+
+private:
+    QObject *receiver; // Waits for all jobs before destruction.
+    int id;
+    QByteArray data;
+    QUpYun::RequestParams params;
+}; // end of class QUpYunImageJob
+
+#endif // QUPYUNIMAGEJOB_P_H
@@ -0,0 +1,561 @@
+#include <QDateTime>
+#include <QHash>
+#include <QSharedData>
+#include <QVector>
+#include <QtAlgorithms>
+
+#include "qupyun.h"
+#include "qupyunitemlist.h"
+
+static inline int compareNames(const char *a, int aLength, const char *b, int bLength)
+{
+    int result = memcmp(a, b, size_t(qMin(aLength, bLength)));
+    return result != 0 ? result : aLength - bLength;
+}
+
+static inline qulonglong parseNumber(const char *begin, const char *end)
+{
+    qulonglong number = 0;
+    for (; begin < end && *begin >= '0' && *begin <= '9'; ++begin) {
+        number = number * 10 + qulonglong(*begin - '0');
+    }
+    return number;
+}
+
+class QUpYunItemList::Private : public QSharedData
+{
+public:
+    /*
+     * Consecutive items in the same directory, which is stored once.
+     */
+    struct Run
+    {
+        int first;
+        int directory;
+        bool sorted;
+    };
+
+    /*
+     * Orders items by name, comparing their UTF-8 bytes.
+     */
+    class NameLessThan
+    {
+    public:
+        NameLessThan(const Private *list) : d(list) {}
+
+        bool operator()(int a, int b) const
+        {
+            return compareNames(d->nameData(a), d->nameLength(a),
+                                d->nameData(b), d->nameLength(b)) < 0;
+        }
+
+    private:
+        const Private *d;
+    };
+
+    Private();
+
+    inline const char *nameData(int i) const;
+    inline int nameLength(int i) const;
+    int runOf(int i) const;
+    int runEnd(int run) const;
+    int directoryIndex(const QString &directory);
+    void grow(int items);
+    void appendItem(int directory, const char *name, int length,
+                    bool isFolder, qulonglong size, uint date);
+
+    QByteArray names;          // UTF-8 names, back to back.
+    QVector<quint32> offsets;  // Start of each name in names, plus the end.
+    QVector<qulonglong> sizes;
+    QVector<uint> dates;       // Seconds since epoch.
+    QByteArray folders;        // Bit per item.
+    QList<QString> directories;
+    QHash<QString, int> directoryIndexes;
+    QVector<Run> runs;
+}; // end of class QUpYunItemList::Private
+
+QUpYunItemList::Private::Private()
+{
+    offsets.append(0);
+}
+
+inline const char *QUpYunItemList::Private::nameData(int i) const
+{
+    return names.constData() + offsets.at(i);
+}
+
+inline int QUpYunItemList::Private::nameLength(int i) const
+{
+    return int(offsets.at(i + 1) - offsets.at(i));
+}
+
+/*
+ * Returns the run item i belongs to.
+ */
+int QUpYunItemList::Private::runOf(int i) const
+{
+    int low = 0;
+    int high = runs.size() - 1;
+    while (low < high) {
+        int middle = (low + high + 1) / 2;
+        if (runs.at(middle).first <= i) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return low;
+}
+
+int QUpYunItemList::Private::runEnd(int run) const
+{
+    return run + 1 < runs.size() ? runs.at(run + 1).first : sizes.size();
+}
+
+int QUpYunItemList::Private::directoryIndex(const QString &directory)
+{
+    QHash<QString, int>::const_iterator i = directoryIndexes.constFind(directory);
+    if (i != directoryIndexes.constEnd()) {
+        return i.value();
+    }
+    int index = directories.size();
+    directories.append(directory);
+    directoryIndexes.insert(directory, index);
+    return index;
+}
+
+/*
+ * Makes room for items more items. Arrays grow geometrically, so appending
+ * listing after listing stays linear.
+ */
+void QUpYunItemList::Private::grow(int items)
+{
+    int needed = sizes.size() + items;
+    if (needed <= sizes.capacity()) {
+        return;
+    }
+    int capacity = qMax(needed, sizes.capacity() * 2);
+    offsets.reserve(capacity + 1);
+    sizes.reserve(capacity);
+    dates.reserve(capacity);
+}
+
+void QUpYunItemList::Private::appendItem(int directory,
+                                         const char *name,
+                                         int length,
+                                         bool isFolder,
+                                         qulonglong size,
+                                         uint date)
+{
+    int index = sizes.size();
+    if (runs.isEmpty() || runs.last().directory != directory) {
+        Run run;
+        run.first = index;
+        run.directory = directory;
+        run.sorted = true;
+        runs.append(run);
+    } else if (runs.last().sorted && index > runs.last().first) {
+        runs.last().sorted = compareNames(nameData(index - 1), nameLength(index - 1), name, length) <= 0;
+    }
+    names.append(name, length);
+    offsets.append(quint32(names.size()));
+    sizes.append(size);
+    dates.append(date);
+    if ((index & 7) == 0) {
+        folders.append('\0');
+    }
+    if (isFolder) {
+        folders[index >> 3] = char(folders.at(index >> 3) | (1 << (index & 7)));
+    }
+}
+
+/*!
+ * \class QUpYunItemList
+ * \brief Compact list of directory items.
+ *
+ * The list keeps all names in one UTF-8 buffer and sizes, dates and folder
+ * flags in arrays beside it, and stores the directory of consecutive items
+ * once. An item takes about 17 bytes plus its name, against a few hundred
+ * for an ItemInfo, so listings of whole buckets fit in memory. Items are
+ * converted to ItemInfo only when asked for.
+ *
+ * The list is implicitly shared.
+ *
+ * \sa QUpYun::lsCompact(const QString &)
+ */
+
+/*!
+ * \brief Constructs an empty list.
+ */
+QUpYunItemList::QUpYunItemList() :
+    d(new Private)
+{
+}
+
+/*!
+ * \brief Constructs a copy of \a other.
+ */
+QUpYunItemList::QUpYunItemList(const QUpYunItemList &other) :
+    d(other.d)
+{
+}
+
+/*!
+ * \brief Destroys the list.
+ */
+QUpYunItemList::~QUpYunItemList()
+{
+}
+
+/*!
+ * \brief Assigns \a other to this list.
+ */
+QUpYunItemList &QUpYunItemList::operator=(const QUpYunItemList &other)
+{
+    d = other.d;
+    return *this;
+}
+
+/*!
+ * \brief Returns the number of items.
+ */
+int QUpYunItemList::size() const
+{
+    return d->sizes.size();
+}
+
+/*!
+ * \brief Returns true if there is no item.
+ */
+bool QUpYunItemList::isEmpty() const
+{
+    return d->sizes.isEmpty();
+}
+
+/*!
+ * \brief Reserves room for \a items items whose names take \a nameBytes in UTF-8.
+ */
+void QUpYunItemList::reserve(int items, int nameBytes)
+{
+    d->names.reserve(nameBytes);
+    d->offsets.reserve(items + 1);
+    d->sizes.reserve(items);
+    d->dates.reserve(items);
+    d->folders.reserve((items + 7) / 8);
+}
+
+/*!
+ * \brief Releases memory reserved and not used.
+ */
+void QUpYunItemList::squeeze()
+{
+    d->names.squeeze();
+    d->offsets.squeeze();
+    d->sizes.squeeze();
+    d->dates.squeeze();
+    d->folders.squeeze();
+    d->runs.squeeze();
+}
+
+/*!
+ * \brief Removes all items.
+ */
+void QUpYunItemList::clear()
+{
+    d = new Private;
+}
+
+/*!
+ * \brief Returns the bytes allocated by the list, about.
+ */
+qint64 QUpYunItemList::memoryUsage() const
+{
+    qint64 usage = sizeof(Private);
+    usage += d->names.capacity();
+    usage += qint64(d->offsets.capacity()) * sizeof(quint32);
+    usage += qint64(d->sizes.capacity()) * sizeof(qulonglong);
+    usage += qint64(d->dates.capacity()) * sizeof(uint);
+    usage += d->folders.capacity();
+    usage += qint64(d->runs.capacity()) * sizeof(Private::Run);
+    foreach (const QString &directory, d->directories) {
+        usage += directory.size() * sizeof(QChar);
+    }
+    return usage;
+}
+
+/*!
+ * \brief Appends an item in \a directory named \a name, in UTF-8.
+ *
+ * \a date is in seconds since 1970-01-01T00:00:00 UTC.
+ */
+void QUpYunItemList::append(const QString &directory,
+                            const QByteArray &name,
+                            bool isFolder,
+                            qulonglong size,
+                            uint date)
+{
+    d->appendItem(d->directoryIndex(directory), name.constData(), name.size(), isFolder, size, date);
+}
+
+/*!
+ * \brief Appends \a info in \a directory.
+ */
+void QUpYunItemList::append(const QString &directory, const ItemInfo &info)
+{
+    append(directory, info.name.toUtf8(), info.isFolder, info.size, info.date.toTime_t());
+}
+
+/*!
+ * \brief Appends the items of \a other, keeping their directories.
+ */
+void QUpYunItemList::append(const QUpYunItemList &other)
+{
+    // holds the items even if other is this list
+    const QUpYunItemList source(other);
+    const Private *from = source.d.constData();
+    d->grow(source.size());
+    for (int run = 0; run < from->runs.size(); ++run) {
+        int directory = d->directoryIndex(from->directories.at(from->runs.at(run).directory));
+        for (int i = from->runs.at(run).first; i < from->runEnd(run); ++i) {
+            d->appendItem(directory,
+                          from->nameData(i),
+                          from->nameLength(i),
+                          source.isFolder(i),
+                          from->sizes.at(i),
+                          from->dates.at(i));
+        }
+    }
+}
+
+/*!
+ * \brief Appends the items of \a data, the body of an ls response for \a directory.
+ *
+ * Names are copied as they are, without decoding. Malformed lines are
+ * skipped. Returns the number of items appended.
+ */
+int QUpYunItemList::appendListing(const QString &directory, const QByteArray &data)
+{
+    int before = size();
+    d->grow(data.count('\n') + 1);
+    int folder = d->directoryIndex(directory);
+
+    // NAME \t N|F \t SIZE \t DATE
+    const char *begin = data.constData();
+    const char *end = begin + data.size();
+    while (begin < end) {
+        const char *fields[5];
+        int count = 0;
+        fields[count++] = begin;
+        const char *p = begin;
+        for (; p < end && *p != '\n'; ++p) {
+            if (*p == '\t' && count < 5) {
+                fields[count++] = p + 1;
+            }
+        }
+        if (count == 4) {
+            d->appendItem(folder,
+                          fields[0],
+                          int(fields[1] - fields[0] - 1),
+                          fields[2] - fields[1] == 2 && (*fields[1] == 'F' || *fields[1] == 'f'),
+                          parseNumber(fields[2], fields[3] - 1),
+                          uint(parseNumber(fields[3], p)));
+        }
+        begin = p + 1;
+    }
+    return size() - before;
+}
+
+/*!
+ * \brief Returns the name of item \a i in UTF-8, without copying.
+ *
+ * The data is valid until the list is changed or destroyed.
+ */
+QByteArray QUpYunItemList::rawName(int i) const
+{
+    return QByteArray::fromRawData(d->nameData(i), d->nameLength(i));
+}
+
+/*!
+ * \brief Returns the name of item \a i.
+ */
+QString QUpYunItemList::name(int i) const
+{
+    return QString::fromUtf8(d->nameData(i), d->nameLength(i));
+}
+
+/*!
+ * \brief Returns the directory of item \a i.
+ */
+QString QUpYunItemList::directory(int i) const
+{
+    return d->directories.at(d->runs.at(d->runOf(i)).directory);
+}
+
+/*!
+ * \brief Returns the directory and the name of item \a i.
+ */
+QString QUpYunItemList::path(int i) const
+{
+    return directory(i) + name(i);
+}
+
+/*!
+ * \brief Returns true if item \a i is a folder.
+ */
+bool QUpYunItemList::isFolder(int i) const
+{
+    return (d->folders.at(i >> 3) >> (i & 7)) & 1;
+}
+
+/*!
+ * \brief Returns the size of item \a i in bytes.
+ */
+qulonglong QUpYunItemList::fileSize(int i) const
+{
+    return d->sizes.at(i);
+}
+
+/*!
+ * \brief Returns the date of item \a i in seconds since 1970-01-01T00:00:00 UTC.
+ */
+uint QUpYunItemList::timestamp(int i) const
+{
+    return d->dates.at(i);
+}
+
+/*!
+ * \brief Returns item \a i as an ItemInfo.
+ */
+ItemInfo QUpYunItemList::at(int i) const
+{
+    ItemInfo info;
+    info.name = name(i);
+    info.isFolder = isFolder(i);
+    info.size = fileSize(i);
+    info.date = QDateTime::fromTime_t(timestamp(i));
+    return info;
+}
+
+/*!
+ * \brief Returns all items as ItemInfo.
+ */
+QList<ItemInfo> QUpYunItemList::toList() const
+{
+    QList<ItemInfo> infos;
+    infos.reserve(size());
+    for (int i = 0; i < size(); ++i) {
+        infos.append(at(i));
+    }
+    return infos;
+}
+
+/*!
+ * \brief Returns true if the items of each directory are sorted by name.
+ *
+ * indexOf() uses binary search when they are.
+ */
+bool QUpYunItemList::isSorted() const
+{
+    foreach (const Private::Run &run, d->runs) {
+        if (!run.sorted) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*!
+ * \brief Sorts the items of each directory by name, comparing their UTF-8 bytes.
+ */
+void QUpYunItemList::sort()
+{
+    if (isSorted()) {
+        return;
+    }
+    const Private *old = d.constData();
+    QVector<int> order;
+    order.reserve(size());
+    for (int run = 0; run < old->runs.size(); ++run) {
+        int first = order.size();
+        for (int i = old->runs.at(run).first; i < old->runEnd(run); ++i) {
+            order.append(i);
+        }
+        if (!old->runs.at(run).sorted) {
+            qSort(order.begin() + first, order.end(), Private::NameLessThan(old));
+        }
+    }
+
+    QSharedDataPointer<Private> sorted(new Private);
+    sorted->directories = old->directories;
+    sorted->directoryIndexes = old->directoryIndexes;
+    sorted->names.reserve(old->names.size());
+    sorted->offsets.reserve(old->offsets.size());
+    sorted->sizes.reserve(old->sizes.size());
+    sorted->dates.reserve(old->dates.size());
+    sorted->folders.reserve(old->folders.size());
+    for (int run = 0; run < old->runs.size(); ++run) {
+        int directory = old->runs.at(run).directory;
+        for (int i = old->runs.at(run).first; i < old->runEnd(run); ++i) {
+            int item = order.at(i);
+            sorted->appendItem(directory,
+                               old->nameData(item),
+                               old->nameLength(item),
+                               isFolder(item),
+                               old->sizes.at(item),
+                               old->dates.at(item));
+        }
+    }
+    d = sorted;
+}
+
+/*!
+ * \brief Returns the index of the item named \a name in \a directory, or -1.
+ *
+ * Searches all directories if \a directory is null.
+ */
+int QUpYunItemList::indexOf(const QString &name, const QString &directory) const
+{
+    int folder = -1;
+    if (!directory.isNull()) {
+        folder = d->directoryIndexes.value(directory, -1);
+        if (folder < 0) {
+            return -1;
+        }
+    }
+    QByteArray key = name.toUtf8();
+    for (int run = 0; run < d->runs.size(); ++run) {
+        const Private::Run &current = d->runs.at(run);
+        if (folder >= 0 && current.directory != folder) {
+            continue;
+        }
+        int low = current.first;
+        int high = d->runEnd(run);
+        if (current.sorted) {
+            while (low < high) {
+                int middle = (low + high) / 2;
+                if (compareNames(d->nameData(middle), d->nameLength(middle), key.constData(), key.size()) < 0) {
+                    low = middle + 1;
+                } else {
+                    high = middle;
+                }
+            }
+            high = qMin(low + 1, d->runEnd(run));
+        }
+        for (int i = low; i < high; ++i) {
+            if (compareNames(d->nameData(i), d->nameLength(i), key.constData(), key.size()) == 0) {
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+/*!
+ * \brief Returns true if there is an item named \a name in \a directory.
+ *
+ * Searches all directories if \a directory is null.
+ */
+bool QUpYunItemList::contains(const QString &name, const QString &directory) const
+{
+    return indexOf(name, directory) >= 0;
+}
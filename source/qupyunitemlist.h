@@ -0,0 +1,59 @@
+#ifndef QUPYUNITEMLIST_H
+#define QUPYUNITEMLIST_H
+
+#include <QByteArray>
+#include <QList>
+#include <QMetaType>
+#include <QSharedDataPointer>
+#include <QString>
+
+#include "qupyun_global.h"
+
+struct ItemInfo;
+
+class QUPYUNSHARED_EXPORT QUpYunItemList
+{
+public:
+    QUpYunItemList();
+    QUpYunItemList(const QUpYunItemList &other);
+    ~QUpYunItemList();
+    QUpYunItemList &operator=(const QUpYunItemList &other);
+
+    int size() const;
+    bool isEmpty() const;
+    void reserve(int items, int nameBytes);
+    void squeeze();
+    void clear();
+    qint64 memoryUsage() const;
+
+    void append(const QString &directory,
+                const QByteArray &name,
+                bool isFolder,
+                qulonglong size,
+                uint date);
+    void append(const QString &directory, const ItemInfo &info);
+    void append(const QUpYunItemList &other);
+    int appendListing(const QString &directory, const QByteArray &data);
+
+    QByteArray rawName(int i) const;
+    QString name(int i) const;
+    QString directory(int i) const;
+    QString path(int i) const;
+    bool isFolder(int i) const;
+    qulonglong fileSize(int i) const;
+    uint timestamp(int i) const;
+    ItemInfo at(int i) const;
+    QList<ItemInfo> toList() const;
+
+    bool isSorted() const;
+    void sort();
+    int indexOf(const QString &name, const QString &directory = QString()) const;
+    bool contains(const QString &name, const QString &directory = QString()) const;
+
+private:
+    class Private;
+    QSharedDataPointer<QUpYunItemList::Private> d;
+}; // end of class QUpYunItemList
+Q_DECLARE_METATYPE(QUpYunItemList)
+
+#endif // QUPYUNITEMLIST_H
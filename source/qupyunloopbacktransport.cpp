@@ -0,0 +1,525 @@
+#include <QDateTime>
+#include <QLocale>
+#include <QNetworkRequest>
+#include <QTimer>
+#include <QUrl>
+
+#include "qupyunloopbacktransport.h"
+#include "qupyunloopbacktransport_p.h"
+#include "qupyuntransport_p.h"
+
+static const char SEPARATOR = '/';
+
+typedef QList<QPair<QByteArray, QByteArray> > HeaderList;
+
+static inline QByteArray httpDate(uint time)
+{
+    return QLocale::c().toString(QDateTime::fromTime_t(time).toUTC(),
+                                 QLatin1String("ddd, dd MMM yyyy hh:mm:ss 'GMT'")).toLatin1();
+}
+
+static inline QString parentOf(const QString &path)
+{
+    return path.left(path.lastIndexOf(QLatin1Char(SEPARATOR)));
+}
+
+QUpYunLoopbackReply::QUpYunLoopbackReply(QUpYunLoopbackTransport *owner,
+                                         QNetworkAccessManager::Operation operation,
+                                         const QNetworkRequest &request,
+                                         const QByteArray &body,
+                                         QIODevice *bodyDevice) :
+    QNetworkReply(owner),
+    requestBody(body),
+    transport(owner),
+    device(bodyDevice),
+    requestSize(body.size()),
+    status(0),
+    readOffset(0),
+    done(false)
+{
+    setOperation(operation);
+    setRequest(request);
+    setUrl(request.url());
+    open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+    if (device) {
+        requestSize = request.header(QNetworkRequest::ContentLengthHeader).toLongLong();
+        requestBody.reserve(int(requestSize));
+        connect(device, SIGNAL(readyRead()), this, SLOT(readRequestBody()));
+        QMetaObject::invokeMethod(this, "readRequestBody", Qt::QueuedConnection);
+    } else {
+        process();
+    }
+}
+
+void QUpYunLoopbackReply::abort()
+{
+    if (done) {
+        return;
+    }
+    done = true;
+    if (device) {
+        disconnect(device, 0, this, 0);
+    }
+    setError(QNetworkReply::OperationCanceledError, tr("Operation canceled"));
+    emit error(QNetworkReply::OperationCanceledError);
+    setFinished(true);
+    emit finished();
+}
+
+qint64 QUpYunLoopbackReply::bytesAvailable() const
+{
+    return buffer.size() - readOffset + QNetworkReply::bytesAvailable();
+}
+
+bool QUpYunLoopbackReply::isSequential() const
+{
+    return true;
+}
+
+/*
+ * Sets the answer, delivered after the latency of the transport.
+ */
+void QUpYunLoopbackReply::respond(int statusCode,
+                                  const QByteArray &reasonPhrase,
+                                  const HeaderList &responseHeaders,
+                                  const QByteArray &body)
+{
+    static QByteArray CONTENT_LENGTH("Content-Length");
+
+    status = statusCode;
+    reason = reasonPhrase;
+    headers = responseHeaders;
+    headers.append(qMakePair(CONTENT_LENGTH, QByteArray::number(body.size())));
+    if (operation() != QNetworkAccessManager::HeadOperation) {
+        buffer = body;
+    }
+    QTimer::singleShot(transport ? transport->latency() : 0, this, SLOT(deliver()));
+}
+
+qint64 QUpYunLoopbackReply::readData(char *data, qint64 maxSize)
+{
+    qint64 available = buffer.size() - readOffset;
+    if (available <= 0) {
+        return done ? -1 : 0;
+    }
+    qint64 count = qMin(maxSize, available);
+    memcpy(data, buffer.constData() + readOffset, count);
+    readOffset += int(count);
+    return count;
+}
+
+void QUpYunLoopbackReply::readRequestBody()
+{
+    if (done || !device) {
+        return;
+    }
+    qint64 before = requestBody.size();
+    while (requestBody.size() < requestSize) {
+        QByteArray chunk = device->read(requestSize - requestBody.size());
+        if (chunk.isEmpty()) {
+            break;
+        }
+        requestBody.append(chunk);
+    }
+    if (requestBody.size() > before) {
+        emit uploadProgress(requestBody.size(), requestSize);
+    }
+    if (requestBody.size() >= requestSize || device->atEnd()) {
+        disconnect(device, 0, this, 0);
+        device = 0;
+        process();
+    }
+}
+
+void QUpYunLoopbackReply::deliver()
+{
+    if (done) {
+        return;
+    }
+    setAttribute(QNetworkRequest::HttpStatusCodeAttribute, status);
+    setAttribute(QNetworkRequest::HttpReasonPhraseAttribute, reason);
+    for (int i = 0; i < headers.size(); ++i) {
+        setRawHeader(headers.at(i).first, headers.at(i).second);
+    }
+    emit metaDataChanged();
+    if (done) {
+        return;
+    }
+    if (requestSize > 0) {
+        emit uploadProgress(requestSize, requestSize);
+    }
+    if (!buffer.isEmpty()) {
+        emit readyRead();
+        if (done) {
+            return;
+        }
+        emit downloadProgress(buffer.size(), buffer.size());
+        if (done) {
+            return;
+        }
+    }
+    done = true;
+    if (status >= 400) {
+        QNetworkReply::NetworkError code = qupyunHttpStatusError(status);
+        setError(code, tr("Error transferring %1 - server replied: %2")
+                 .arg(url().toString(), QString::fromLatin1(reason)));
+        emit error(code);
+    }
+    setFinished(true);
+    emit finished();
+}
+
+void QUpYunLoopbackReply::process()
+{
+    if (transport) {
+        transport->d->answer(this);
+    } else {
+        respond(503, "Service Unavailable", HeaderList(), QByteArray());
+    }
+}
+
+
+QUpYunLoopbackTransport::Private::Private() :
+    latency(0),
+    storedBytes(0),
+    requestCount(0)
+{
+}
+
+/*
+ * Answers reply as UpYun would, changing the stored files first.
+ */
+void QUpYunLoopbackTransport::Private::answer(QUpYunLoopbackReply *reply)
+{
+    static QByteArray FOLDER("folder");
+    static QByteArray MKDIR("mkdir");
+    static QByteArray TRUE_VALUE("true");
+    static QByteArray FILE_TYPE("x-upyun-file-type");
+    static QByteArray FILE_SIZE("x-upyun-file-size");
+    static QByteArray FILE_DATE("x-upyun-file-date");
+    static QByteArray LAST_MODIFIED("Last-Modified");
+    static QByteArray COPY_SOURCE("X-Upyun-Copy-Source");
+    static QByteArray MOVE_SOURCE("X-Upyun-Move-Source");
+
+    ++requestCount;
+    const QNetworkRequest &request = reply->request();
+    QString path = reply->url().path();
+    bool directory = path.endsWith(QLatin1Char(SEPARATOR));
+    while (path.size() > 1 && path.endsWith(QLatin1Char(SEPARATOR))) {
+        path.chop(1);
+    }
+    QMap<QString, Entry>::iterator entry = entries.find(path);
+    bool exists = entry != entries.end();
+    bool folder = isFolder(path);
+    uint now = QDateTime::currentDateTime().toTime_t();
+
+    HeaderList headers;
+    switch (reply->operation()) {
+    case QNetworkAccessManager::GetOperation:
+    {
+        QString prefix = path == QLatin1String("/") ? path : path + QLatin1Char(SEPARATOR);
+        if (reply->url().toEncoded().endsWith("?usage") && folder) {
+            qint64 usage = 0;
+            QMap<QString, Entry>::const_iterator i = entries.lowerBound(prefix);
+            for (; i != entries.constEnd() && i.key().startsWith(prefix); ++i) {
+                usage += i.value().data.size();
+            }
+            reply->respond(200, "OK", headers, QByteArray::number(usage));
+        } else if (folder) {
+            // NAME \t N|F \t SIZE \t DATE
+            QByteArray body;
+            QMap<QString, Entry>::const_iterator i = entries.lowerBound(prefix);
+            for (; i != entries.constEnd() && i.key().startsWith(prefix); ++i) {
+                QString name = i.key().mid(prefix.size());
+                if (name.contains(QLatin1Char(SEPARATOR))) {
+                    continue;
+                }
+                body += name.toUtf8();
+                body += i.value().folder ? "\tF\t" : "\tN\t";
+                body += QByteArray::number(i.value().data.size());
+                body += '\t';
+                body += QByteArray::number(i.value().date);
+                body += '\n';
+            }
+            reply->respond(200, "OK", headers, body);
+        } else if (exists && !directory) {
+            headers.append(qMakePair(LAST_MODIFIED, httpDate(entry.value().date)));
+            reply->respond(200, "OK", headers, entry.value().data);
+        } else {
+            reply->respond(404, "Not Found", headers, QByteArray());
+        }
+        break;
+    }
+    case QNetworkAccessManager::PutOperation:
+    {
+        bool autoMkdir = request.rawHeader(MKDIR) == TRUE_VALUE;
+        bool makeFolder = request.rawHeader(FOLDER) == TRUE_VALUE;
+        bool move = request.hasRawHeader(MOVE_SOURCE);
+        QByteArray sourceHeader = request.rawHeader(move ? MOVE_SOURCE : COPY_SOURCE);
+        QString source = QUrl::fromPercentEncoding(sourceHeader);
+        QMap<QString, Entry>::iterator sourceEntry = entries.end();
+        if (!sourceHeader.isEmpty()) {
+            sourceEntry = entries.find(source);
+        }
+        if (!sourceHeader.isEmpty() && (sourceEntry == entries.end() || sourceEntry.value().folder)) {
+            // only files could be copied or moved
+            reply->respond(sourceEntry == entries.end() ? 404 : 400,
+                           sourceEntry == entries.end() ? "Not Found" : "Bad Request",
+                           headers,
+                           QByteArray());
+        } else if (makeFolder ? exists && !folder : folder) {
+            reply->respond(409, "Conflict", headers, QByteArray());
+        } else if (!makeParents(path, autoMkdir || makeFolder)) {
+            reply->respond(404, "Not Found", headers, QByteArray());
+        } else if (makeFolder) {
+            if (!folder) {
+                Entry created;
+                created.folder = true;
+                created.date = now;
+                entries.insert(path, created);
+            }
+            reply->respond(200, "OK", headers, QByteArray());
+        } else if (!sourceHeader.isEmpty()) {
+            if (source != path) {
+                Entry copied = sourceEntry.value();
+                copied.date = now;
+                if (move) {
+                    storedBytes -= copied.data.size();
+                    entries.erase(sourceEntry);
+                }
+                Entry &stored = entries[path];
+                storedBytes += copied.data.size() - stored.data.size();
+                stored = copied;
+            }
+            reply->respond(200, "OK", headers, QByteArray());
+        } else {
+            Entry &stored = entries[path];
+            storedBytes += reply->requestBody.size() - stored.data.size();
+            stored.data = reply->requestBody;
+            stored.folder = false;
+            stored.date = now;
+            reply->respond(200, "OK", headers, QByteArray());
+        }
+        break;
+    }
+    case QNetworkAccessManager::HeadOperation:
+        if (folder || exists) {
+            headers.append(qMakePair(FILE_TYPE, folder ? FOLDER : QByteArray("file")));
+            headers.append(qMakePair(FILE_SIZE, QByteArray::number(exists ? entry.value().data.size() : 0)));
+            headers.append(qMakePair(FILE_DATE, QByteArray::number(exists ? entry.value().date : now)));
+            reply->respond(200, "OK", headers, QByteArray());
+        } else {
+            reply->respond(404, "Not Found", headers, QByteArray());
+        }
+        break;
+    case QNetworkAccessManager::DeleteOperation:
+        if (!exists) {
+            reply->respond(404, "Not Found", headers, QByteArray());
+        } else if (folder && hasChildren(path)) {
+            reply->respond(403, "Forbidden", headers, QByteArray());
+        } else {
+            storedBytes -= entry.value().data.size();
+            entries.erase(entry);
+            reply->respond(200, "OK", headers, QByteArray());
+        }
+        break;
+    default:
+        reply->respond(405, "Method Not Allowed", headers, QByteArray());
+        break;
+    }
+}
+
+/*
+ * The root and bucket roots always exist.
+ */
+bool QUpYunLoopbackTransport::Private::isFolder(const QString &path) const
+{
+    if (path.lastIndexOf(QLatin1Char(SEPARATOR)) <= 0) {
+        return true;
+    }
+    QMap<QString, Entry>::const_iterator i = entries.constFind(path);
+    return i != entries.constEnd() && i.value().folder;
+}
+
+bool QUpYunLoopbackTransport::Private::hasChildren(const QString &path) const
+{
+    QString prefix = path + QLatin1Char(SEPARATOR);
+    QMap<QString, Entry>::const_iterator i = entries.lowerBound(prefix);
+    return i != entries.constEnd() && i.key().startsWith(prefix);
+}
+
+/*
+ * Returns true if the parent of path is a folder, creating the missing
+ * ones if autoMkdir is set.
+ */
+bool QUpYunLoopbackTransport::Private::makeParents(const QString &path, bool autoMkdir)
+{
+    QString parent = parentOf(path);
+    if (parent.isEmpty() || isFolder(parent)) {
+        return true;
+    }
+    if (!autoMkdir || entries.contains(parent) || !makeParents(parent, true)) {
+        return false;
+    }
+    Entry created;
+    created.folder = true;
+    created.date = QDateTime::currentDateTime().toTime_t();
+    entries.insert(parent, created);
+    return true;
+}
+
+/*!
+ * \class QUpYunLoopbackTransport
+ * \brief In-memory transport emulating UpYun, for tests and benchmarks.
+ *
+ * The transport keeps uploaded files in memory and answers uploads, mkdir,
+ * ls, downloads, file information, removals, copies, moves and usage as
+ * UpYun does, without checking signatures. Every bucket exists. Answers
+ * are delivered asynchronously after latency().
+ *
+ * \sa QUpYunSession::setTransport(QUpYunTransport *)
+ */
+
+/*!
+ * \brief Constructs an empty transport with given \a parent.
+ */
+QUpYunLoopbackTransport::QUpYunLoopbackTransport(QObject *parent) :
+    QUpYunTransport(parent),
+    d(new Private)
+{
+}
+
+/*!
+ * \brief Destroys the transport and replies which have not been deleted.
+ */
+QUpYunLoopbackTransport::~QUpYunLoopbackTransport()
+{
+    delete d;
+}
+
+/*!
+ * \reimp
+ */
+QNetworkReply *QUpYunLoopbackTransport::send(QNetworkAccessManager::Operation operation,
+                                             const QNetworkRequest &request,
+                                             const QByteArray &body)
+{
+    return new QUpYunLoopbackReply(this, operation, request, body, 0);
+}
+
+/*!
+ * \reimp
+ */
+QNetworkReply *QUpYunLoopbackTransport::send(QNetworkAccessManager::Operation operation,
+                                             const QNetworkRequest &request,
+                                             QIODevice *body)
+{
+    return new QUpYunLoopbackReply(this, operation, request, QByteArray(), body);
+}
+
+/*!
+ * \brief Sets the time between a complete request and its answer to \a msecs.
+ *
+ * It is 0 by default.
+ */
+void QUpYunLoopbackTransport::setLatency(int msecs)
+{
+    d->latency = qMax(0, msecs);
+}
+
+/*!
+ * \brief Returns the time between a complete request and its answer.
+ */
+int QUpYunLoopbackTransport::latency() const
+{
+    return d->latency;
+}
+
+/*!
+ * \brief Stores \a data as the file at \a path, creating the missing folders.
+ *
+ * \a path includes the bucket, as "/bucket/dir/file". It is a shortcut to
+ * set up the files a test or a replay expects to find.
+ */
+void QUpYunLoopbackTransport::addFile(const QString &path, const QByteArray &data)
+{
+    QString key = path;
+    while (key.size() > 1 && key.endsWith(QLatin1Char(SEPARATOR))) {
+        key.chop(1);
+    }
+    if (d->isFolder(key) || !d->makeParents(key, true)) {
+        return;
+    }
+    Private::Entry &stored = d->entries[key];
+    d->storedBytes += data.size() - stored.data.size();
+    stored.data = data;
+    stored.folder = false;
+    stored.date = QDateTime::currentDateTime().toTime_t();
+}
+
+/*!
+ * \brief Creates the folder at \a path and the missing ones above it.
+ *
+ * \a path includes the bucket. Does nothing if there is a file at \a path.
+ */
+void QUpYunLoopbackTransport::addFolder(const QString &path)
+{
+    QString key = path;
+    while (key.size() > 1 && key.endsWith(QLatin1Char(SEPARATOR))) {
+        key.chop(1);
+    }
+    if (d->entries.contains(key) || d->isFolder(key) || !d->makeParents(key, true)) {
+        return;
+    }
+    Private::Entry created;
+    created.folder = true;
+    created.date = QDateTime::currentDateTime().toTime_t();
+    d->entries.insert(key, created);
+}
+
+/*!
+ * \brief Returns true if there is a file or folder at \a path.
+ *
+ * \a path includes the bucket, as "/bucket/dir/file".
+ */
+bool QUpYunLoopbackTransport::contains(const QString &path) const
+{
+    QString key = path;
+    while (key.size() > 1 && key.endsWith(QLatin1Char(SEPARATOR))) {
+        key.chop(1);
+    }
+    return d->entries.contains(key);
+}
+
+/*!
+ * \brief Returns the content of the file at \a path, which includes the bucket.
+ */
+QByteArray QUpYunLoopbackTransport::data(const QString &path) const
+{
+    return d->entries.value(path).data;
+}
+
+/*!
+ * \brief Returns the size of all stored files.
+ */
+qint64 QUpYunLoopbackTransport::storedBytes() const
+{
+    return d->storedBytes;
+}
+
+/*!
+ * \brief Returns the number of requests answered.
+ */
+int QUpYunLoopbackTransport::requestCount() const
+{
+    return d->requestCount;
+}
+
+/*!
+ * \brief Removes all files and folders.
+ */
+void QUpYunLoopbackTransport::clear()
+{
+    d->entries.clear();
+    d->storedBytes = 0;
+}
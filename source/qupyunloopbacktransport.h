@@ -0,0 +1,37 @@
+#ifndef QUPYUNLOOPBACKTRANSPORT_H
+#define QUPYUNLOOPBACKTRANSPORT_H
+
+#include "qupyuntransport.h"
+
+class QUPYUNSHARED_EXPORT QUpYunLoopbackTransport : public QUpYunTransport
+{
+    Q_OBJECT
+public:
+    explicit QUpYunLoopbackTransport(QObject *parent = 0);
+    ~QUpYunLoopbackTransport();
+
+    QNetworkReply *send(QNetworkAccessManager::Operation operation,
+                        const QNetworkRequest &request,
+                        const QByteArray &body);
+    QNetworkReply *send(QNetworkAccessManager::Operation operation,
+                        const QNetworkRequest &request,
+                        QIODevice *body);
+
+    void setLatency(int msecs);
+    int latency() const;
+
+    void addFile(const QString &path, const QByteArray &data);
+    void addFolder(const QString &path);
+    bool contains(const QString &path) const;
+    QByteArray data(const QString &path) const;
+    qint64 storedBytes() const;
+    int requestCount() const;
+    void clear();
+
+private:
+    class Private;
+    QUpYunLoopbackTransport::Private *d;
+    friend class QUpYunLoopbackReply;
+}; // end of class QUpYunLoopbackTransport
+
+#endif // QUPYUNLOOPBACKTRANSPORT_H
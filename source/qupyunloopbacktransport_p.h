@@ -0,0 +1,80 @@
+#ifndef QUPYUNLOOPBACKTRANSPORT_P_H
+#define QUPYUNLOOPBACKTRANSPORT_P_H
+
+#include <QMap>
+#include <QNetworkReply>
+#include <QPair>
+#include <QPointer>
+
+#include "qupyunloopbacktransport.h"
+
+/*
+ * Reply of QUpYunLoopbackTransport. It collects the request body, has the
+ * transport answer it, then delivers the answer after the latency.
+ */
+class QUpYunLoopbackReply : public QNetworkReply
+{
+    Q_OBJECT
+public:
+    QUpYunLoopbackReply(QUpYunLoopbackTransport *transport,
+                        QNetworkAccessManager::Operation operation,
+                        const QNetworkRequest &request,
+                        const QByteArray &body,
+                        QIODevice *bodyDevice);
+
+    void abort();
+    qint64 bytesAvailable() const;
+    bool isSequential() const;
+
+    void respond(int status,
+                 const QByteArray &reason,
+                 const QList<QPair<QByteArray, QByteArray> > &headers,
+                 const QByteArray &body);
+
+    QByteArray requestBody;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize);
+
+private slots:
+    void readRequestBody();
+    void deliver();
+
+private:
+    void process();
+
+    QPointer<QUpYunLoopbackTransport> transport;
+    QPointer<QIODevice> device;
+    qint64 requestSize;
+    int status;
+    QByteArray reason;
+    QList<QPair<QByteArray, QByteArray> > headers;
+    QByteArray buffer;
+    int readOffset;
+    bool done;
+}; // end of class QUpYunLoopbackReply
+
+class QUpYunLoopbackTransport::Private
+{
+public:
+    struct Entry
+    {
+        QByteArray data;
+        bool folder;
+        uint date;
+    };
+
+    Private();
+
+    void answer(QUpYunLoopbackReply *reply);
+    bool isFolder(const QString &path) const;
+    bool hasChildren(const QString &path) const;
+    bool makeParents(const QString &path, bool autoMkdir);
+
+    QMap<QString, Entry> entries; // Normalized path, sorted for listing.
+    int latency;
+    qint64 storedBytes;
+    int requestCount;
+}; // end of class QUpYunLoopbackTransport::Private
+
+#endif // QUPYUNLOOPBACKTRANSPORT_P_H
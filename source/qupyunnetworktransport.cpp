@@ -0,0 +1,72 @@
+#include <QNetworkReply>
+#include <QNetworkRequest>
+
+#include "qupyunnetworktransport.h"
+
+/*!
+ * \class QUpYunNetworkTransport
+ * \brief Transport sending requests by QNetworkAccessManager.
+ *
+ * This is the default transport of QUpYunSession. It supports everything
+ * QNetworkAccessManager does, including proxies and HTTPS.
+ */
+
+/*!
+ * \brief Constructs a transport with its own network access manager and given \a parent.
+ */
+QUpYunNetworkTransport::QUpYunNetworkTransport(QObject *parent) :
+    QUpYunTransport(parent),
+    manager(new QNetworkAccessManager(this))
+{
+}
+
+/*!
+ * \brief Destroys the transport and replies which have not been deleted.
+ */
+QUpYunNetworkTransport::~QUpYunNetworkTransport()
+{
+}
+
+/*!
+ * \brief Returns the network access manager sending the requests.
+ *
+ * It could be used to set a proxy, a cookie jar or a network cache.
+ */
+QNetworkAccessManager *QUpYunNetworkTransport::networkAccessManager() const
+{
+    return manager;
+}
+
+/*!
+ * \reimp
+ */
+QNetworkReply *QUpYunNetworkTransport::send(QNetworkAccessManager::Operation operation,
+                                            const QNetworkRequest &request,
+                                            const QByteArray &body)
+{
+    switch (operation) {
+    case QNetworkAccessManager::GetOperation:
+        return manager->get(request);
+    case QNetworkAccessManager::PutOperation:
+        return manager->put(request, body);
+    case QNetworkAccessManager::HeadOperation:
+        return manager->head(request);
+    case QNetworkAccessManager::DeleteOperation:
+        return manager->deleteResource(request);
+    default:
+        return 0;
+    }
+}
+
+/*!
+ * \reimp
+ */
+QNetworkReply *QUpYunNetworkTransport::send(QNetworkAccessManager::Operation operation,
+                                            const QNetworkRequest &request,
+                                            QIODevice *body)
+{
+    if (operation == QNetworkAccessManager::PutOperation) {
+        return manager->put(request, body);
+    }
+    return send(operation, request, QByteArray());
+}
@@ -0,0 +1,26 @@
+#ifndef QUPYUNNETWORKTRANSPORT_H
+#define QUPYUNNETWORKTRANSPORT_H
+
+#include "qupyuntransport.h"
+
+class QUPYUNSHARED_EXPORT QUpYunNetworkTransport : public QUpYunTransport
+{
+    Q_OBJECT
+public:
+    explicit QUpYunNetworkTransport(QObject *parent = 0);
+    ~QUpYunNetworkTransport();
+
+    QNetworkAccessManager *networkAccessManager() const;
+
+    QNetworkReply *send(QNetworkAccessManager::Operation operation,
+                        const QNetworkRequest &request,
+                        const QByteArray &body);
+    QNetworkReply *send(QNetworkAccessManager::Operation operation,
+                        const QNetworkRequest &request,
+                        QIODevice *body);
+
+private:
+    QNetworkAccessManager *manager;
+}; // end of class QUpYunNetworkTransport
+
+#endif // QUPYUNNETWORKTRANSPORT_H
@@ -0,0 +1,525 @@
+#include "qupyunnetworktransport.h"
+#include "qupyunsession.h"
+#include "qupyunsession_p.h"
+
+static const int DEFAULT_MAX_CONNECTIONS = 6;
+static const int INITIAL_LIMIT = 2;
+static const double DECREASE_FACTOR = 0.5;    // On 429, 503 and timeouts.
+static const double QUEUEING_FACTOR = 0.9;    // When latency builds up.
+static const double QUEUEING_THRESHOLD = 2.0; // Latency over baseline seen as queueing.
+static const double LATENCY_WEIGHT = 0.2;
+static const double BASELINE_DRIFT = 0.01;
+static const qint64 MIN_CUT_INTERVAL = 500;
+
+QUpYunSession::Private::Private(QUpYunSession *session) :
+    q(session),
+    defaultTransport(new QUpYunNetworkTransport(session)),
+    maxConnections(DEFAULT_MAX_CONNECTIONS),
+    active(0),
+    pending(0),
+    cursor(0),
+    dispatching(false),
+    adaptive(false)
+{
+    clock.start();
+}
+
+QUpYunSession::Private::Client *QUpYunSession::Private::find(QUpYunSessionClient *client)
+{
+    for (int i = 0; i < clients.size(); ++i) {
+        if (clients.at(i).client == client) {
+            return &clients[i];
+        }
+    }
+    return 0;
+}
+
+int QUpYunSession::Private::limitOf(const QString &host, QUpYunSession::OperationClass operation)
+{
+    QString key = host + QLatin1Char(' ') + QString::number(operation);
+    QHash<QString, int>::const_iterator i = limitIndexes.constFind(key);
+    if (i != limitIndexes.constEnd()) {
+        return i.value();
+    }
+    Limit limit;
+    limit.host = host;
+    limit.operation = operation;
+    limit.limit = qMin(INITIAL_LIMIT, maxConnections);
+    limit.active = 0;
+    limit.slowStart = true;
+    limit.baseline = 0;
+    limit.latency = 0;
+    limit.cutTime = -1;
+    limits.append(limit);
+    limitIndexes.insert(key, limits.size() - 1);
+    return limits.size() - 1;
+}
+
+inline bool QUpYunSession::Private::hasRoom(int limit) const
+{
+    return !adaptive || limits.at(limit).active < int(limits.at(limit).limit);
+}
+
+void QUpYunSession::Private::attach(QUpYunSessionClient *client)
+{
+    if (find(client)) {
+        return;
+    }
+    Client attached;
+    attached.client = client;
+    attached.lastLimit = -1;
+    clients.append(attached);
+}
+
+/*
+ * Forgets client and returns its requests which have not been started.
+ * Its started requests no longer count against the limits.
+ */
+QList<QUpYunRequest *> QUpYunSession::Private::detach(QUpYunSessionClient *client)
+{
+    QList<QUpYunRequest *> dropped;
+    for (int i = 0; i < clients.size(); ++i) {
+        if (clients.at(i).client != client) {
+            continue;
+        }
+        Client detached = clients.takeAt(i);
+        QMap<int, QQueue<QUpYunRequest *> >::const_iterator queue = detached.queues.constBegin();
+        for (; queue != detached.queues.constEnd(); ++queue) {
+            dropped += queue.value();
+        }
+        pending -= dropped.size();
+        QHash<QUpYunRequest *, Started>::const_iterator started = detached.started.constBegin();
+        for (; started != detached.started.constEnd(); ++started) {
+            --limits[started.value().limit].active;
+        }
+        active -= detached.started.size();
+        if (cursor > i) {
+            --cursor;
+        }
+        if (cursor >= clients.size()) {
+            cursor = 0;
+        }
+        break;
+    }
+    dispatch();
+    return dropped;
+}
+
+void QUpYunSession::Private::enqueue(QUpYunSessionClient *client, QUpYunRequest *request, int limit)
+{
+    Client *attached = find(client);
+    Q_ASSERT(attached);
+    if (!attached) {
+        return;
+    }
+    attached->queues[limit].enqueue(request);
+    ++pending;
+    dispatch();
+}
+
+bool QUpYunSession::Private::dequeue(QUpYunSessionClient *client, QUpYunRequest *request)
+{
+    Client *attached = find(client);
+    if (!attached) {
+        return false;
+    }
+    QMap<int, QQueue<QUpYunRequest *> >::iterator queue = attached->queues.begin();
+    for (; queue != attached->queues.end(); ++queue) {
+        if (queue.value().removeOne(request)) {
+            if (queue.value().isEmpty()) {
+                attached->queues.erase(queue);
+            }
+            --pending;
+            return true;
+        }
+    }
+    return false;
+}
+
+void QUpYunSession::Private::finished(QUpYunSessionClient *client,
+                                      QUpYunRequest *request,
+                                      QUpYunSessionClient::Outcome outcome)
+{
+    Client *attached = find(client);
+    if (!attached || !attached->started.contains(request)) {
+        return;
+    }
+    Started started = attached->started.take(request);
+    --active;
+    --limits[started.limit].active;
+    adapt(started.limit, clock.elapsed() - started.time, outcome);
+    dispatch();
+}
+
+/*
+ * Adjusts a limit by additive increase, multiplicative decrease. Overload
+ * answers and timeouts halve it, at most once per round-trip so that a
+ * burst of them counts once. Successes while the limit was in use raise
+ * it by one per round-trip, or per success before the first cut. Metadata
+ * requests also cut it slightly when their latency builds up well over the
+ * lowest seen, which means requests queue somewhere; transfer latency
+ * depends on the size and is not used.
+ */
+void QUpYunSession::Private::adapt(int index, qint64 latency, QUpYunSessionClient::Outcome outcome)
+{
+    Limit &limit = limits[index];
+    int before = int(limit.limit);
+    qint64 now = clock.elapsed();
+    bool canCut = limit.cutTime < 0
+            || now - limit.cutTime >= qMax(MIN_CUT_INTERVAL, qint64(limit.latency));
+
+    if (outcome == QUpYunSessionClient::Overloaded) {
+        if (canCut) {
+            limit.limit = qMax(1.0, limit.limit * DECREASE_FACTOR);
+            limit.slowStart = false;
+            limit.cutTime = now;
+        }
+    } else if (outcome == QUpYunSessionClient::Succeeded) {
+        bool queueing = false;
+        if (limit.operation == QUpYunSession::Metadata) {
+            if (limit.baseline <= 0 || latency < limit.baseline) {
+                limit.baseline = qMax(qint64(1), latency);
+            } else {
+                limit.baseline += (latency - limit.baseline) * BASELINE_DRIFT;
+            }
+            limit.latency = limit.latency <= 0
+                    ? latency
+                    : limit.latency + (latency - limit.latency) * LATENCY_WEIGHT;
+            queueing = limit.latency > limit.baseline * QUEUEING_THRESHOLD;
+        } else {
+            limit.latency = limit.latency <= 0
+                    ? latency
+                    : limit.latency + (latency - limit.latency) * LATENCY_WEIGHT;
+        }
+        if (queueing) {
+            if (canCut) {
+                limit.limit = qMax(1.0, limit.limit * QUEUEING_FACTOR);
+                limit.slowStart = false;
+                limit.cutTime = now;
+            }
+        } else if (limit.active + 1 >= int(limit.limit)) {
+            // the limit was reached, so it is what held requests back
+            limit.limit += limit.slowStart ? 1.0 : 1.0 / limit.limit;
+            limit.limit = qMin(limit.limit, double(maxConnections));
+        }
+    }
+
+    if (adaptive && int(limit.limit) != before) {
+        emit q->concurrencyLimitChanged(limit.host, limit.operation, int(limit.limit));
+    }
+}
+
+/*
+ * Starts pending requests while below the limits, taking one request from
+ * each client in turn so that a client with a long queue could not starve
+ * the others. Within a client, the classes with room are served in turn.
+ */
+void QUpYunSession::Private::dispatch()
+{
+    // a client may finish a request synchronously from start()
+    if (dispatching) {
+        return;
+    }
+    dispatching = true;
+    while (active < maxConnections && pending > 0) {
+        int index = -1;
+        QMap<int, QQueue<QUpYunRequest *> >::iterator queue;
+        for (int i = 0; i < clients.size() && index < 0; ++i) {
+            int candidate = (cursor + i) % clients.size();
+            Client &client = clients[candidate];
+            if (client.queues.isEmpty()) {
+                continue;
+            }
+            queue = client.queues.upperBound(client.lastLimit);
+            for (int n = 0; n < client.queues.size(); ++n, ++queue) {
+                if (queue == client.queues.end()) {
+                    queue = client.queues.begin();
+                }
+                if (hasRoom(queue.key())) {
+                    index = candidate;
+                    break;
+                }
+            }
+        }
+        if (index < 0) {
+            break;
+        }
+        cursor = (index + 1) % clients.size();
+        Client &client = clients[index];
+        int limit = queue.key();
+        QUpYunRequest *request = queue.value().dequeue();
+        if (queue.value().isEmpty()) {
+            client.queues.erase(queue);
+        }
+        client.lastLimit = limit;
+        Started started;
+        started.limit = limit;
+        started.time = clock.elapsed();
+        client.started.insert(request, started);
+        --pending;
+        ++active;
+        ++limits[limit].active;
+        client.client->start(request);
+    }
+    dispatching = false;
+}
+
+/*!
+ * \class QUpYunSession
+ * \brief Transport shared by several QUpYun instances.
+ *
+ * A session sends the requests of all instances attached to it through one
+ * transport, so they share its connections, DNS cache and socket buffers,
+ * whatever bucket or account they use. The number of requests in flight is
+ * limited for the whole session; requests over the limit wait in a queue
+ * per instance and are started from each queue in turn.
+ *
+ * With adaptive concurrency, each host and operation class also gets a
+ * limit of its own, which follows the latency and the overload answers of
+ * the server.
+ *
+ * QUpYun instances constructed without a session get a private one.
+ *
+ * Deleting a session cancels the queued and in flight requests of the
+ * instances attached to it, which report OperationCanceledError through
+ * their signals and futures. Those instances go on with a private session.
+ *
+ * \sa QUpYun::QUpYun(QUpYunSession *, const QString &, const QString &, const QString &, QObject *)
+ */
+
+/*!
+ * \brief Constructs a session with given \a parent.
+ */
+QUpYunSession::QUpYunSession(QObject *parent) :
+    QObject(parent),
+    d(new Private(this))
+{
+}
+
+/*!
+ * \brief Destroys the session.
+ */
+QUpYunSession::~QUpYunSession()
+{
+    // nothing is started while the clients leave
+    d->dispatching = true;
+    while (!d->clients.isEmpty()) {
+        QUpYunSessionClient *client = d->clients.first().client;
+        client->sessionDestroyed();
+        d->detach(client);
+    }
+    delete d;
+}
+
+/*!
+ * \brief Sends the requests started from now on through \a transport.
+ *
+ * The session does not take ownership of \a transport, which must outlive
+ * the requests sent through it. Sets \a transport to 0 to go back to the
+ * default QUpYunNetworkTransport.
+ *
+ * \sa QUpYunSocketTransport, QUpYunLoopbackTransport
+ */
+void QUpYunSession::setTransport(QUpYunTransport *transport)
+{
+    d->transport = transport;
+}
+
+/*!
+ * \brief Returns the transport which sends the requests.
+ */
+QUpYunTransport *QUpYunSession::transport() const
+{
+    return d->transport ? d->transport.data() : d->defaultTransport;
+}
+
+/*!
+ * \brief Returns the network access manager of the default transport.
+ *
+ * It could be used to set a proxy, a cookie jar or a network cache. It is
+ * not used while another transport is set.
+ */
+QNetworkAccessManager *QUpYunSession::networkAccessManager() const
+{
+    return d->defaultTransport->networkAccessManager();
+}
+
+/*!
+ * \brief Sets the maximum number of requests in flight to \a max.
+ *
+ * The limit applies to all attached instances together. It is 6 by default,
+ * the number of connections QNetworkAccessManager opens to one host.
+ * Raising the limit starts waiting requests immediately; lowering it does
+ * not abort any request.
+ *
+ * With adaptive concurrency, it is also the ceiling of the limit of each
+ * host and operation class, so it should be raised, e.g. to 32, to let the
+ * limits grow.
+ *
+ * \sa setAdaptiveConcurrency()
+ */
+void QUpYunSession::setMaxConnections(int max)
+{
+    d->maxConnections = qMax(1, max);
+    for (int i = 0; i < d->limits.size(); ++i) {
+        Private::Limit &limit = d->limits[i];
+        limit.limit = qMin(limit.limit, double(d->maxConnections));
+    }
+    d->dispatch();
+}
+
+/*!
+ * \brief Returns the maximum number of requests in flight.
+ */
+int QUpYunSession::maxConnections() const
+{
+    return d->maxConnections;
+}
+
+/*!
+ * \brief Enables or disables adaptive concurrency.
+ *
+ * When it is enabled, the requests to each host are limited per operation
+ * class, besides maxConnections(). Each limit starts low and grows while
+ * requests succeed and the limit is reached. It is halved when the server
+ * answers 429 Too Many Requests, 503 Service Unavailable or 504 Gateway
+ * Timeout, or a request times out, and lowered slightly when the latency of
+ * metadata requests builds up well above the lowest seen. Transfers are only
+ * limited by overload answers, because their latency depends on their size.
+ * Failed and canceled requests do not change the limits.
+ *
+ * It is disabled by default: only maxConnections() applies.
+ *
+ * \sa concurrencyLimit(), concurrencyLimitChanged()
+ */
+void QUpYunSession::setAdaptiveConcurrency(bool enabled)
+{
+    if (d->adaptive == enabled) {
+        return;
+    }
+    d->adaptive = enabled;
+    d->dispatch();
+}
+
+/*!
+ * \brief Returns whether adaptive concurrency is enabled.
+ */
+bool QUpYunSession::adaptiveConcurrency() const
+{
+    return d->adaptive;
+}
+
+/*!
+ * \brief Returns the number of requests of \a operation class which could be
+ * in flight to \a host.
+ *
+ * Returns maxConnections() if adaptive concurrency is disabled or no such
+ * request has been sent yet.
+ */
+int QUpYunSession::concurrencyLimit(const QString &host, OperationClass operation) const
+{
+    QString key = host + QLatin1Char(' ') + QString::number(operation);
+    QHash<QString, int>::const_iterator i = d->limitIndexes.constFind(key);
+    if (!d->adaptive || i == d->limitIndexes.constEnd()) {
+        return d->maxConnections;
+    }
+    return qMin(int(d->limits.at(i.value()).limit), d->maxConnections);
+}
+
+/*!
+ * \brief Returns the number of QUpYun instances attached to the session.
+ */
+int QUpYunSession::clientCount() const
+{
+    return d->clients.size();
+}
+
+/*!
+ * \brief Returns the number of requests in flight.
+ */
+int QUpYunSession::activeCount() const
+{
+    return d->active;
+}
+
+/*!
+ * \brief Returns the number of requests waiting for a free connection.
+ */
+int QUpYunSession::pendingCount() const
+{
+    return d->pending;
+}
+
+QUpYunSessionClient::QUpYunSessionClient()
+{
+}
+
+QUpYunSessionClient::~QUpYunSessionClient()
+{
+    detach();
+}
+
+void QUpYunSessionClient::attach(QUpYunSession *session)
+{
+    Q_ASSERT(!currentSession);
+    currentSession = session;
+    if (session) {
+        session->d->attach(this);
+    }
+}
+
+/*
+ * Returns the requests which have not been started, owned by the caller.
+ */
+QList<QUpYunRequest *> QUpYunSessionClient::detach()
+{
+    QList<QUpYunRequest *> dropped;
+    if (currentSession) {
+        dropped = currentSession->d->detach(this);
+    }
+    currentSession = 0;
+    return dropped;
+}
+
+QUpYunSession *QUpYunSessionClient::session() const
+{
+    return currentSession;
+}
+
+QUpYunTransport *QUpYunSessionClient::transport() const
+{
+    return currentSession ? currentSession->transport() : 0;
+}
+
+/*
+ * Queues request, which is passed to start() once there is a free
+ * connection, maybe before this returns. Host and operation select the
+ * adaptive limit it counts against.
+ */
+void QUpYunSessionClient::schedule(QUpYunRequest *request,
+                                   const QString &host,
+                                   QUpYunSession::OperationClass operation)
+{
+    if (currentSession) {
+        QUpYunSession::Private *d = currentSession->d;
+        d->enqueue(this, request, d->limitOf(host, operation));
+    }
+}
+
+/*
+ * Removes request from the queue. Returns false if it has been started.
+ */
+bool QUpYunSessionClient::unschedule(QUpYunRequest *request)
+{
+    return currentSession && currentSession->d->dequeue(this, request);
+}
+
+/*
+ * Tells the session a started request has finished, and how.
+ */
+void QUpYunSessionClient::release(QUpYunRequest *request, Outcome outcome)
+{
+    if (currentSession) {
+        currentSession->d->finished(this, request, outcome);
+    }
+}
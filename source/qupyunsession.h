@@ -0,0 +1,54 @@
+#ifndef QUPYUNSESSION_H
+#define QUPYUNSESSION_H
+
+#include <QObject>
+
+#include "qupyun_global.h"
+
+QT_BEGIN_NAMESPACE
+class QNetworkAccessManager;
+QT_END_NAMESPACE
+
+class QUpYunTransport;
+
+class QUPYUNSHARED_EXPORT QUpYunSession : public QObject
+{
+    Q_OBJECT
+public:
+    enum OperationClass
+    {
+        Metadata = 0,
+        Upload,
+        Download
+    };
+
+    explicit QUpYunSession(QObject *parent = 0);
+    ~QUpYunSession();
+
+    void setTransport(QUpYunTransport *transport);
+    QUpYunTransport *transport() const;
+    QNetworkAccessManager *networkAccessManager() const;
+
+    void setMaxConnections(int max);
+    int maxConnections() const;
+
+    void setAdaptiveConcurrency(bool enabled);
+    bool adaptiveConcurrency() const;
+    int concurrencyLimit(const QString &host, OperationClass operation) const;
+
+    int clientCount() const;
+    int activeCount() const;
+    int pendingCount() const;
+
+signals:
+    void concurrencyLimitChanged(const QString &host,
+                                 QUpYunSession::OperationClass operation,
+                                 int limit);
+
+private:
+    class Private;
+    QUpYunSession::Private *d;
+    friend class QUpYunSessionClient;
+}; // end of class QUpYunSession
+
+#endif // QUPYUNSESSION_H
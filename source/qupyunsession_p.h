@@ -0,0 +1,120 @@
+#ifndef QUPYUNSESSION_P_H
+#define QUPYUNSESSION_P_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QPointer>
+#include <QQueue>
+#include <QVector>
+
+#include "qupyunsession.h"
+#include "qupyuntransport.h"
+
+class QUpYunNetworkTransport;
+
+struct QUpYunRequest;
+
+/*
+ * Something sending requests through a session, i.e. QUpYun::Private.
+ * Requests are opaque to the session, which only decides when each one is
+ * started. Not part of the public API.
+ */
+class QUpYunSessionClient
+{
+public:
+    enum Outcome
+    {
+        Succeeded,
+        Overloaded, // 429, 503 or timed out: the server wants fewer requests.
+        Failed,
+        Canceled
+    };
+
+    QUpYunSessionClient();
+    virtual ~QUpYunSessionClient();
+
+    virtual void start(QUpYunRequest *request) = 0;
+    // The session is being deleted: detach and fail every request sent.
+    virtual void sessionDestroyed() = 0;
+
+protected:
+    void attach(QUpYunSession *session);
+    QList<QUpYunRequest *> detach();
+    QUpYunSession *session() const;
+    QUpYunTransport *transport() const;
+
+    void schedule(QUpYunRequest *request,
+                  const QString &host,
+                  QUpYunSession::OperationClass operation);
+    bool unschedule(QUpYunRequest *request);
+    void release(QUpYunRequest *request, Outcome outcome);
+
+private:
+    QPointer<QUpYunSession> currentSession;
+}; // end of class QUpYunSessionClient
+
+class QUpYunSession::Private
+{
+public:
+    /*
+     * Concurrency limit of one host and operation class.
+     */
+    struct Limit
+    {
+        QString host;
+        QUpYunSession::OperationClass operation;
+        double limit;
+        int active;
+        bool slowStart;    // Grows by one per success until the first cut.
+        double baseline;   // Lowest recent latency in milliseconds, 0 if none.
+        double latency;    // Smoothed latency in milliseconds.
+        qint64 cutTime;    // Clock time of the last cut, -1 if none.
+    };
+
+    struct Started
+    {
+        int limit;
+        qint64 time;
+    };
+
+    struct Client
+    {
+        QUpYunSessionClient *client;
+        QMap<int, QQueue<QUpYunRequest *> > queues; // By limit, never empty.
+        int lastLimit;                               // Limit served last.
+        QHash<QUpYunRequest *, Started> started;
+    };
+
+    Private(QUpYunSession *session);
+
+    Client *find(QUpYunSessionClient *client);
+    int limitOf(const QString &host, QUpYunSession::OperationClass operation);
+    inline bool hasRoom(int limit) const;
+    void attach(QUpYunSessionClient *client);
+    QList<QUpYunRequest *> detach(QUpYunSessionClient *client);
+    void enqueue(QUpYunSessionClient *client, QUpYunRequest *request, int limit);
+    bool dequeue(QUpYunSessionClient *client, QUpYunRequest *request);
+    void finished(QUpYunSessionClient *client,
+                  QUpYunRequest *request,
+                  QUpYunSessionClient::Outcome outcome);
+    void adapt(int limit, qint64 latency, QUpYunSessionClient::Outcome outcome);
+    void dispatch();
+
+    QUpYunSession *q;
+    QUpYunNetworkTransport *defaultTransport;
+    QPointer<QUpYunTransport> transport; // Set by the user, not owned.
+    int maxConnections;
+    int active;        // Started and not finished.
+    int pending;       // Waiting in client queues.
+    QList<Client> clients;
+    int cursor;        // Index of the client served next.
+    bool dispatching;
+    bool adaptive;
+    QVector<Limit> limits;
+    QHash<QString, int> limitIndexes;
+    QElapsedTimer clock;
+}; // end of class QUpYunSession::Private
+
+#endif // QUPYUNSESSION_P_H
@@ -0,0 +1,1044 @@
+#include <climits>
+
+#include <QNetworkRequest>
+#include <QTcpSocket>
+#include <QUrl>
+
+#include "qupyunsockettransport.h"
+#include "qupyunsockettransport_p.h"
+#include "qupyuntransport_p.h"
+
+static const int DEFAULT_MAX_CONNECTIONS_PER_HOST = 6;
+static const int DEFAULT_KEEP_ALIVE_TIMEOUT = 30 * 1000;
+static const int DEFAULT_WRITE_CHUNK_SIZE = 64 * 1024;
+static const qint64 SOCKET_READ_BUFFER = 256 * 1024;
+static const int MAX_RETRIES = 1;
+
+static inline const char *methodName(QNetworkAccessManager::Operation operation)
+{
+    switch (operation) {
+    case QNetworkAccessManager::GetOperation:
+        return "GET";
+    case QNetworkAccessManager::PutOperation:
+        return "PUT";
+    case QNetworkAccessManager::HeadOperation:
+        return "HEAD";
+    case QNetworkAccessManager::DeleteOperation:
+        return "DELETE";
+    default:
+        return 0;
+    }
+}
+
+static QNetworkReply::NetworkError socketErrorCode(QAbstractSocket::SocketError error)
+{
+    switch (error) {
+    case QAbstractSocket::ConnectionRefusedError:
+        return QNetworkReply::ConnectionRefusedError;
+    case QAbstractSocket::RemoteHostClosedError:
+        return QNetworkReply::RemoteHostClosedError;
+    case QAbstractSocket::HostNotFoundError:
+        return QNetworkReply::HostNotFoundError;
+    case QAbstractSocket::SocketTimeoutError:
+        return QNetworkReply::TimeoutError;
+    default:
+        return QNetworkReply::UnknownNetworkError;
+    }
+}
+
+QUpYunSocketReply::QUpYunSocketReply(QUpYunSocketTransport *owner,
+                                     QNetworkAccessManager::Operation operation,
+                                     const QNetworkRequest &request,
+                                     const QByteArray &data,
+                                     QIODevice *bodyDevice) :
+    QNetworkReply(owner),
+    port(80),
+    body(data),
+    device(bodyDevice),
+    bodySize(0),
+    headWritten(false),
+    bodyWritten(0),
+    responseStarted(false),
+    paused(false),
+    retries(0),
+    transport(owner),
+    readOffset(0),
+    received(0),
+    expected(-1),
+    status(0),
+    done(false)
+{
+    setOperation(operation);
+    setRequest(request);
+    setUrl(request.url());
+    open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+
+    QUrl url = request.url();
+    hostName = url.host();
+    port = quint16(url.port(80));
+    hostKey = hostName + QLatin1Char(':') + QString::number(port);
+    bodySize = device ? request.header(QNetworkRequest::ContentLengthHeader).toLongLong()
+                      : body.size();
+
+    // METHOD /path?query HTTP/1.1, Host, then the headers of the request
+    QByteArray target = url.toEncoded(QUrl::RemoveScheme | QUrl::RemoveAuthority | QUrl::RemoveFragment);
+    if (target.isEmpty()) {
+        target = "/";
+    }
+    QList<QByteArray> names = request.rawHeaderList();
+    head.reserve(64 + target.size() + hostName.size() + names.size() * 48);
+    head += methodName(operation);
+    head += ' ';
+    head += target;
+    head += " HTTP/1.1\r\nHost: ";
+    head += QUrl::toAce(hostName);
+    if (port != 80) {
+        head += ':';
+        head += QByteArray::number(port);
+    }
+    head += "\r\n";
+    foreach (const QByteArray &name, names) {
+        head += name;
+        head += ": ";
+        head += request.rawHeader(name);
+        head += "\r\n";
+    }
+    head += "\r\n";
+}
+
+QUpYunSocketReply::~QUpYunSocketReply()
+{
+    if (!done) {
+        detach();
+    }
+}
+
+/*
+ * Takes the reply off its connection or out of the waiting queue.
+ */
+void QUpYunSocketReply::detach()
+{
+    if (connection) {
+        QUpYunSocketConnection *current = connection;
+        connection = 0;
+        current->cancel(this);
+    } else if (transport && transport->d) {
+        transport->d->remove(this);
+    }
+}
+
+void QUpYunSocketReply::abort()
+{
+    if (done) {
+        return;
+    }
+    detach();
+    fail(QNetworkReply::OperationCanceledError, tr("Operation canceled"));
+}
+
+qint64 QUpYunSocketReply::bytesAvailable() const
+{
+    return buffer.size() - readOffset + QNetworkReply::bytesAvailable();
+}
+
+bool QUpYunSocketReply::isSequential() const
+{
+    return true;
+}
+
+/*
+ * Requests with a device body are written on their own connection.
+ */
+bool QUpYunSocketReply::isPipelinable() const
+{
+    return !device;
+}
+
+/*
+ * Returns how many more bytes the reply takes before the connection pauses
+ * reading, following readBufferSize().
+ */
+qint64 QUpYunSocketReply::room() const
+{
+    if (readBufferSize() <= 0) {
+        return Q_INT64_C(0x7fffffffffffffff);
+    }
+    return readBufferSize() - (buffer.size() - readOffset);
+}
+
+void QUpYunSocketReply::respond(int statusCode,
+                                const QByteArray &reason,
+                                const QUpYunHeaderList &headers)
+{
+    status = statusCode;
+    setAttribute(QNetworkRequest::HttpStatusCodeAttribute, statusCode);
+    setAttribute(QNetworkRequest::HttpReasonPhraseAttribute, reason);
+    for (int i = 0; i < headers.size(); ++i) {
+        setRawHeader(headers.at(i).first, headers.at(i).second);
+    }
+    QVariant length = header(QNetworkRequest::ContentLengthHeader);
+    expected = length.isValid() ? length.toLongLong() : -1;
+    emit metaDataChanged();
+}
+
+void QUpYunSocketReply::appendBody(const QByteArray &data)
+{
+    if (readOffset > 0 && readOffset == buffer.size()) {
+        buffer.clear();
+        readOffset = 0;
+    }
+    buffer.append(data);
+    received += data.size();
+    emit readyRead();
+    emit downloadProgress(received, expected);
+}
+
+void QUpYunSocketReply::reportUpload()
+{
+    emit uploadProgress(bodyWritten, bodySize);
+}
+
+void QUpYunSocketReply::complete()
+{
+    if (done) {
+        return;
+    }
+    done = true;
+    connection = 0;
+    if (status >= 400) {
+        QNetworkReply::NetworkError code = qupyunHttpStatusError(status);
+        setError(code, tr("Error transferring %1 - server replied: %2")
+                 .arg(url().toString(), attribute(QNetworkRequest::HttpReasonPhraseAttribute).toString()));
+        emit error(code);
+    }
+    setFinished(true);
+    emit finished();
+}
+
+void QUpYunSocketReply::fail(QNetworkReply::NetworkError errorCode, const QString &errorMessage)
+{
+    if (done) {
+        return;
+    }
+    done = true;
+    connection = 0;
+    setError(errorCode, errorMessage);
+    emit error(errorCode);
+    setFinished(true);
+    emit finished();
+}
+
+/*
+ * Prepares the request to be sent again on another connection.
+ */
+bool QUpYunSocketReply::rewind()
+{
+    if (device && !device->reset()) {
+        return false;
+    }
+    headWritten = false;
+    bodyWritten = 0;
+    responseStarted = false;
+    paused = false;
+    connection = 0;
+    return true;
+}
+
+qint64 QUpYunSocketReply::readData(char *data, qint64 maxSize)
+{
+    qint64 available = buffer.size() - readOffset;
+    if (available <= 0) {
+        return done ? -1 : 0;
+    }
+    qint64 count = qMin(maxSize, available);
+    memcpy(data, buffer.constData() + readOffset, count);
+    readOffset += int(count);
+    if (readOffset == buffer.size()) {
+        buffer.clear();
+        readOffset = 0;
+    }
+    if (paused && connection) {
+        paused = false;
+        QMetaObject::invokeMethod(connection, "readResponses", Qt::QueuedConnection);
+    }
+    return count;
+}
+
+void QUpYunSocketReply::failUnsupported()
+{
+    fail(QNetworkReply::ProtocolUnknownError,
+         tr("Protocol \"%1\" is unknown").arg(url().scheme()));
+}
+
+
+QUpYunSocketConnection::QUpYunSocketConnection(QUpYunSocketTransport *owner,
+                                               const QString &poolKey,
+                                               const QString &hostName,
+                                               quint16 port) :
+    QObject(owner),
+    key(poolKey),
+    transport(owner),
+    socket(new QTcpSocket(this)),
+    writeIndex(0),
+    connected(false),
+    closing(false),
+    served(0),
+    state(StatusLine),
+    remaining(0),
+    status(0),
+    chunked(false),
+    contentLength(-1),
+    closeAfter(false)
+{
+    socket->setReadBufferSize(SOCKET_READ_BUFFER);
+    idleTimer.setSingleShot(true);
+    connect(&idleTimer, SIGNAL(timeout()), this, SLOT(closeIdle()));
+    connect(socket, SIGNAL(connected()), this, SLOT(socketConnected()));
+    connect(socket, SIGNAL(readyRead()), this, SLOT(readResponses()));
+    connect(socket, SIGNAL(bytesWritten(qint64)), this, SLOT(writeRequests()));
+    connect(socket, SIGNAL(disconnected()), this, SLOT(socketDisconnected()));
+    connect(socket, SIGNAL(error(QAbstractSocket::SocketError)),
+            this, SLOT(socketError(QAbstractSocket::SocketError)));
+    socket->connectToHost(hostName, port);
+}
+
+QUpYunSocketConnection::~QUpYunSocketConnection()
+{
+}
+
+inline int QUpYunSocketConnection::load() const
+{
+    return closing ? INT_MAX : replies.size();
+}
+
+bool QUpYunSocketConnection::canPipeline(const QUpYunSocketReply *reply) const
+{
+    if (closing || !reply->isPipelinable() || replies.size() >= transport->d->pipeliningDepth) {
+        return false;
+    }
+    foreach (const QUpYunSocketReply *assigned, replies) {
+        if (!assigned->isPipelinable()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void QUpYunSocketConnection::assign(QUpYunSocketReply *reply)
+{
+    idleTimer.stop();
+    reply->connection = this;
+    replies.append(reply);
+    if (reply->device) {
+        connect(reply->device, SIGNAL(readyRead()), this, SLOT(writeRequests()));
+    }
+    writeRequests();
+}
+
+/*
+ * Drops reply, which is aborted or destroyed. The stream could not be
+ * resynchronized once it has been partly written, so the connection is
+ * closed and the other replies are sent again elsewhere.
+ */
+void QUpYunSocketConnection::cancel(QUpYunSocketReply *reply)
+{
+    int index = replies.indexOf(reply);
+    if (index < 0) {
+        return;
+    }
+    replies.removeAt(index);
+    if (reply->device) {
+        disconnect(reply->device, 0, this, 0);
+    }
+    if (!reply->headWritten) {
+        if (index < writeIndex) {
+            --writeIndex;
+        }
+        return;
+    }
+    close(QNetworkReply::OperationCanceledError, tr("Operation canceled"), true);
+}
+
+void QUpYunSocketConnection::socketConnected()
+{
+    connected = true;
+    QUpYunSocketTransport::Private *settings = transport->d;
+    socket->setSocketOption(QAbstractSocket::LowDelayOption, settings->lowDelay ? 1 : 0);
+    socket->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 3, 0)
+    if (settings->sendBufferSize > 0) {
+        socket->setSocketOption(QAbstractSocket::SendBufferSizeSocketOption, settings->sendBufferSize);
+    }
+    if (settings->receiveBufferSize > 0) {
+        socket->setSocketOption(QAbstractSocket::ReceiveBufferSizeSocketOption, settings->receiveBufferSize);
+    }
+#endif
+    writeRequests();
+}
+
+/*
+ * Writes requests in order, each body in chunks straight from its buffer
+ * or device, keeping at most one chunk queued in the socket.
+ */
+void QUpYunSocketConnection::writeRequests()
+{
+    if (!connected || closing || !transport) {
+        return;
+    }
+    qint64 chunkSize = transport->d->writeChunkSize;
+    while (writeIndex < replies.size()) {
+        QUpYunSocketReply *reply = replies.at(writeIndex);
+        if (!reply->headWritten) {
+            socket->write(reply->head);
+            reply->headWritten = true;
+        }
+        while (reply->bodyWritten < reply->bodySize) {
+            if (socket->bytesToWrite() >= chunkSize) {
+                return;
+            }
+            qint64 wanted = qMin(chunkSize, reply->bodySize - reply->bodyWritten);
+            qint64 written = 0;
+            if (reply->device) {
+                QByteArray chunk = reply->device->read(wanted);
+                if (chunk.isEmpty()) {
+                    if (reply->device->atEnd()) {
+                        close(QNetworkReply::UnknownNetworkError, tr("Request body ended early"), false);
+                    }
+                    // readyRead() comes when there is more
+                    return;
+                }
+                written = socket->write(chunk);
+            } else {
+                written = socket->write(reply->body.constData() + reply->bodyWritten, wanted);
+            }
+            if (written <= 0) {
+                return;
+            }
+            reply->bodyWritten += written;
+            reply->reportUpload();
+        }
+        if (reply->device) {
+            disconnect(reply->device, 0, this, 0);
+        }
+        ++writeIndex;
+    }
+}
+
+/*
+ * Parses as much of the responses as the socket holds, pausing while the
+ * current reply has no room for more data.
+ */
+void QUpYunSocketConnection::readResponses()
+{
+    while (!closing && !replies.isEmpty()) {
+        QUpYunSocketReply *reply = replies.first();
+        switch (state) {
+        case StatusLine:
+        {
+            if (!socket->canReadLine()) {
+                return;
+            }
+            QByteArray line = socket->readLine();
+            if (line.trimmed().isEmpty()) {
+                continue;
+            }
+            if (!parseStatusLine(line)) {
+                close(QNetworkReply::ProtocolFailure, tr("Invalid HTTP status line"), false);
+                return;
+            }
+            reply->responseStarted = true;
+            state = Headers;
+            break;
+        }
+        case Headers:
+        {
+            if (!socket->canReadLine()) {
+                return;
+            }
+            QByteArray line = socket->readLine();
+            if (line != "\r\n" && line != "\n") {
+                parseHeader(line);
+            } else if (!endOfHeaders(reply)) {
+                return;
+            }
+            break;
+        }
+        case Body:
+        case ChunkData:
+        case BodyUntilClose:
+            if (!readBody(reply)) {
+                return;
+            }
+            break;
+        case ChunkSize:
+        {
+            if (!socket->canReadLine()) {
+                return;
+            }
+            QByteArray line = socket->readLine();
+            int extension = line.indexOf(';');
+            bool ok = false;
+            remaining = (extension < 0 ? line : line.left(extension)).trimmed().toLongLong(&ok, 16);
+            if (!ok || remaining < 0) {
+                close(QNetworkReply::ProtocolFailure, tr("Invalid chunk size"), false);
+                return;
+            }
+            state = remaining == 0 ? Trailers : ChunkData;
+            break;
+        }
+        case ChunkEnd:
+            if (!socket->canReadLine()) {
+                return;
+            }
+            socket->readLine();
+            state = ChunkSize;
+            break;
+        case Trailers:
+        {
+            if (!socket->canReadLine()) {
+                return;
+            }
+            QByteArray line = socket->readLine();
+            if (line == "\r\n" || line == "\n") {
+                finishResponse();
+            }
+            break;
+        }
+        }
+    }
+}
+
+/*
+ * Moves body bytes to reply. Returns false if nothing more could be done
+ * until more data arrives or the reply is read.
+ */
+bool QUpYunSocketConnection::readBody(QUpYunSocketReply *reply)
+{
+    qint64 available = socket->bytesAvailable();
+    qint64 room = reply->room();
+    if (room <= 0) {
+        reply->paused = true;
+        return false;
+    }
+    qint64 wanted = qMin(available, room);
+    if (state != BodyUntilClose) {
+        wanted = qMin(wanted, remaining);
+    }
+    if (wanted <= 0) {
+        return false;
+    }
+    QByteArray data = socket->read(wanted);
+    remaining -= data.size();
+    reply->appendBody(data);
+    if (closing || replies.isEmpty() || replies.first() != reply) {
+        // aborted by a slot of readyRead()
+        return false;
+    }
+    if (state == Body && remaining == 0) {
+        finishResponse();
+    } else if (state == ChunkData && remaining == 0) {
+        state = ChunkEnd;
+    }
+    return true;
+}
+
+bool QUpYunSocketConnection::parseStatusLine(const QByteArray &line)
+{
+    // HTTP/1.1 200 OK
+    if (!line.startsWith("HTTP/")) {
+        return false;
+    }
+    int first = line.indexOf(' ');
+    if (first < 0) {
+        return false;
+    }
+    int second = line.indexOf(' ', first + 1);
+    bool ok = false;
+    status = line.mid(first + 1, second < 0 ? -1 : second - first - 1).trimmed().toInt(&ok);
+    if (!ok) {
+        return false;
+    }
+    reason = second < 0 ? QByteArray() : line.mid(second + 1).trimmed();
+    headers.clear();
+    chunked = false;
+    contentLength = -1;
+    // HTTP/1.0 closes unless asked to keep alive
+    closeAfter = line.startsWith("HTTP/1.0");
+    return true;
+}
+
+void QUpYunSocketConnection::parseHeader(const QByteArray &line)
+{
+    int colon = line.indexOf(':');
+    if (colon <= 0) {
+        return;
+    }
+    QByteArray name = line.left(colon).trimmed();
+    QByteArray value = line.mid(colon + 1).trimmed();
+    QByteArray lower = name.toLower();
+    if (lower == "content-length") {
+        contentLength = value.toLongLong();
+    } else if (lower == "transfer-encoding") {
+        chunked = value.toLower().contains("chunked");
+    } else if (lower == "connection") {
+        QByteArray token = value.toLower();
+        if (token.contains("close")) {
+            closeAfter = true;
+        } else if (token.contains("keep-alive")) {
+            closeAfter = false;
+        }
+    }
+    headers.append(qMakePair(name, value));
+}
+
+/*
+ * Hands the headers to reply and picks how the body is delimited. Returns
+ * false if reading should stop.
+ */
+bool QUpYunSocketConnection::endOfHeaders(QUpYunSocketReply *reply)
+{
+    if (status >= 100 && status < 200) {
+        // interim response, the real one follows
+        state = StatusLine;
+        return true;
+    }
+    reply->respond(status, reason, headers);
+    if (closing || replies.isEmpty() || replies.first() != reply) {
+        return false;
+    }
+    if (reply->operation() == QNetworkAccessManager::HeadOperation
+            || status == 204 || status == 304) {
+        finishResponse();
+    } else if (chunked) {
+        state = ChunkSize;
+    } else if (contentLength >= 0) {
+        remaining = contentLength;
+        state = Body;
+        if (remaining == 0) {
+            finishResponse();
+        }
+    } else {
+        state = BodyUntilClose;
+        closeAfter = true;
+    }
+    return true;
+}
+
+/*
+ * Completes the first reply. A response which came before its request was
+ * completely written, as for a rejected upload, leaves the stream unusable.
+ */
+void QUpYunSocketConnection::finishResponse()
+{
+    QUpYunSocketReply *reply = replies.takeFirst();
+    bool written = writeIndex > 0;
+    if (written) {
+        --writeIndex;
+    }
+    state = StatusLine;
+    ++served;
+    if (closeAfter || !written) {
+        close(QNetworkReply::RemoteHostClosedError, tr("Connection closed"), true);
+    }
+    QPointer<QUpYunSocketConnection> self(this);
+    reply->complete();
+    if (!self || closing) {
+        return;
+    }
+    if (replies.isEmpty() && transport) {
+        idleTimer.start(transport->d->keepAliveTimeout);
+        transport->d->dispatch(key);
+    }
+}
+
+void QUpYunSocketConnection::socketDisconnected()
+{
+    if (closing) {
+        return;
+    }
+    readResponses();
+    if (closing) {
+        return;
+    }
+    if (!replies.isEmpty() && (state == Body || state == BodyUntilClose)
+            && socket->bytesAvailable() > 0) {
+        // the reply is paused; hand over what is left before the socket goes
+        QUpYunSocketReply *reply = replies.first();
+        QByteArray data = socket->readAll();
+        remaining -= data.size();
+        reply->appendBody(data);
+        if (closing || replies.isEmpty() || replies.first() != reply) {
+            return;
+        }
+    }
+    if (!replies.isEmpty() && (state == BodyUntilClose || (state == Body && remaining == 0))) {
+        finishResponse();
+        if (closing) {
+            return;
+        }
+    }
+    close(QNetworkReply::RemoteHostClosedError, socket->errorString(), false);
+}
+
+void QUpYunSocketConnection::socketError(QAbstractSocket::SocketError error)
+{
+    if (closing) {
+        return;
+    }
+    if (error == QAbstractSocket::RemoteHostClosedError) {
+        socketDisconnected();
+        return;
+    }
+    close(socketErrorCode(error), socket->errorString(), false);
+}
+
+void QUpYunSocketConnection::closeIdle()
+{
+    if (replies.isEmpty()) {
+        close(QNetworkReply::NoError, QString(), false);
+    }
+}
+
+/*
+ * Closes the connection for good. Replies without any response are sent
+ * again on another connection if the failure is likely not theirs: the
+ * connection had been reused, they were queued behind another request, or
+ * retryAll is set. The others fail.
+ */
+void QUpYunSocketConnection::close(QNetworkReply::NetworkError errorCode,
+                                   const QString &errorMessage,
+                                   bool retryAll)
+{
+    if (closing) {
+        return;
+    }
+    closing = true;
+    idleTimer.stop();
+    socket->abort();
+    QList<QUpYunSocketReply *> orphans = replies;
+    replies.clear();
+    writeIndex = 0;
+    if (transport) {
+        transport->d->connectionClosed(this);
+    }
+    QList<QUpYunSocketReply *> failed;
+    for (int i = 0; i < orphans.size(); ++i) {
+        QUpYunSocketReply *reply = orphans.at(i);
+        if (reply->device) {
+            disconnect(reply->device, 0, this, 0);
+        }
+        bool innocent = retryAll || (connected && (served > 0 || i > 0));
+        if (transport && innocent && !reply->responseStarted
+                && reply->retries < MAX_RETRIES && reply->rewind()) {
+            if (!retryAll) {
+                ++reply->retries;
+            }
+            transport->d->enqueue(reply);
+        } else {
+            failed.append(reply);
+        }
+    }
+    foreach (QUpYunSocketReply *reply, failed) {
+        reply->fail(errorCode, errorMessage);
+    }
+    deleteLater();
+}
+
+
+QUpYunSocketTransport::Private::Private(QUpYunSocketTransport *transport) :
+    q(transport),
+    maxConnectionsPerHost(DEFAULT_MAX_CONNECTIONS_PER_HOST),
+    pipeliningDepth(1),
+    keepAliveTimeout(DEFAULT_KEEP_ALIVE_TIMEOUT),
+    writeChunkSize(DEFAULT_WRITE_CHUNK_SIZE),
+    sendBufferSize(0),
+    receiveBufferSize(0),
+    lowDelay(true)
+{
+}
+
+QUpYunSocketReply *QUpYunSocketTransport::Private::send(QNetworkAccessManager::Operation operation,
+                                                        const QNetworkRequest &request,
+                                                        const QByteArray &body,
+                                                        QIODevice *device)
+{
+    QUpYunSocketReply *reply = new QUpYunSocketReply(q, operation, request, body, device);
+    if (request.url().scheme() != QLatin1String("http") || !methodName(operation)) {
+        QMetaObject::invokeMethod(reply, "failUnsupported", Qt::QueuedConnection);
+        return reply;
+    }
+    enqueue(reply);
+    return reply;
+}
+
+void QUpYunSocketTransport::Private::enqueue(QUpYunSocketReply *reply)
+{
+    hosts[reply->hostKey].waiting.enqueue(reply);
+    dispatch(reply->hostKey);
+}
+
+void QUpYunSocketTransport::Private::remove(QUpYunSocketReply *reply)
+{
+    QHash<QString, Host>::iterator i = hosts.find(reply->hostKey);
+    if (i != hosts.end()) {
+        i.value().waiting.removeOne(reply);
+    }
+}
+
+/*
+ * Assigns waiting replies to an idle connection, a new one while under the
+ * limit, or the least loaded one they could be pipelined on.
+ */
+void QUpYunSocketTransport::Private::dispatch(const QString &key)
+{
+    QHash<QString, Host>::iterator i = hosts.find(key);
+    if (i == hosts.end()) {
+        return;
+    }
+    while (!i.value().waiting.isEmpty()) {
+        Host &host = i.value();
+        QUpYunSocketReply *reply = host.waiting.head();
+        QUpYunSocketConnection *target = 0;
+        foreach (QUpYunSocketConnection *connection, host.connections) {
+            if (connection->load() == 0) {
+                target = connection;
+                break;
+            }
+        }
+        if (!target && host.connections.size() < maxConnectionsPerHost) {
+            target = new QUpYunSocketConnection(q, key, reply->hostName, reply->port);
+            host.connections.append(target);
+        }
+        if (!target && pipeliningDepth > 1) {
+            foreach (QUpYunSocketConnection *connection, host.connections) {
+                if (connection->canPipeline(reply)
+                        && (!target || connection->load() < target->load())) {
+                    target = connection;
+                }
+            }
+        }
+        if (!target) {
+            return;
+        }
+        host.waiting.dequeue();
+        target->assign(reply);
+        // assigning may close connections and rehash
+        i = hosts.find(key);
+        if (i == hosts.end()) {
+            return;
+        }
+    }
+}
+
+void QUpYunSocketTransport::Private::connectionClosed(QUpYunSocketConnection *connection)
+{
+    QHash<QString, Host>::iterator i = hosts.find(connection->key);
+    if (i == hosts.end()) {
+        return;
+    }
+    i.value().connections.removeOne(connection);
+    if (i.value().connections.isEmpty() && i.value().waiting.isEmpty()) {
+        hosts.erase(i);
+    } else {
+        // waiting replies may open a new connection now
+        QMetaObject::invokeMethod(q, "dispatchAll", Qt::QueuedConnection);
+    }
+}
+
+/*!
+ * \class QUpYunSocketTransport
+ * \brief Lightweight HTTP/1.1 transport on QTcpSocket.
+ *
+ * The transport keeps connections to each host alive for reuse and could
+ * pipeline requests on them. Request bodies are written from their buffer
+ * in chunks as the socket drains, so a body backed by a mapped file is not
+ * copied as a whole. Only plain HTTP is supported; use
+ * QUpYunNetworkTransport for HTTPS or proxies.
+ *
+ * \sa QUpYunSession::setTransport(QUpYunTransport *)
+ */
+
+/*!
+ * \brief Constructs a transport with given \a parent.
+ */
+QUpYunSocketTransport::QUpYunSocketTransport(QObject *parent) :
+    QUpYunTransport(parent),
+    d(new Private(this))
+{
+}
+
+/*!
+ * \brief Destroys the transport, its connections and replies which have not been deleted.
+ */
+QUpYunSocketTransport::~QUpYunSocketTransport()
+{
+    QHash<QString, Private::Host>::iterator i = d->hosts.begin();
+    for (; i != d->hosts.end(); ++i) {
+        qDeleteAll(i.value().connections);
+    }
+    delete d;
+    // the replies, deleted with the other children, check for it
+    d = 0;
+}
+
+/*!
+ * \reimp
+ */
+QNetworkReply *QUpYunSocketTransport::send(QNetworkAccessManager::Operation operation,
+                                           const QNetworkRequest &request,
+                                           const QByteArray &body)
+{
+    return d->send(operation, request, body, 0);
+}
+
+/*!
+ * \reimp
+ */
+QNetworkReply *QUpYunSocketTransport::send(QNetworkAccessManager::Operation operation,
+                                           const QNetworkRequest &request,
+                                           QIODevice *body)
+{
+    return d->send(operation, request, QByteArray(), body);
+}
+
+/*!
+ * \brief Sets the maximum number of connections to one host to \a max.
+ *
+ * It is 6 by default.
+ */
+void QUpYunSocketTransport::setMaxConnectionsPerHost(int max)
+{
+    d->maxConnectionsPerHost = qMax(1, max);
+    dispatchAll();
+}
+
+/*!
+ * \brief Returns the maximum number of connections to one host.
+ */
+int QUpYunSocketTransport::maxConnectionsPerHost() const
+{
+    return d->maxConnectionsPerHost;
+}
+
+/*!
+ * \brief Sets the number of requests which could be in flight on one connection to \a depth.
+ *
+ * Requests are pipelined only when all connections to the host are in
+ * use. Requests whose body is read from a device are never pipelined.
+ * It is 1 by default, which disables pipelining.
+ */
+void QUpYunSocketTransport::setPipeliningDepth(int depth)
+{
+    d->pipeliningDepth = qMax(1, depth);
+    dispatchAll();
+}
+
+/*!
+ * \brief Returns the number of requests which could be in flight on one connection.
+ */
+int QUpYunSocketTransport::pipeliningDepth() const
+{
+    return d->pipeliningDepth;
+}
+
+/*!
+ * \brief Closes connections idle for \a msecs. It is 30 seconds by default.
+ */
+void QUpYunSocketTransport::setKeepAliveTimeout(int msecs)
+{
+    d->keepAliveTimeout = qMax(0, msecs);
+}
+
+/*!
+ * \brief Returns the milliseconds an idle connection is kept.
+ */
+int QUpYunSocketTransport::keepAliveTimeout() const
+{
+    return d->keepAliveTimeout;
+}
+
+/*!
+ * \brief Sets the size of body chunks handed to the socket to \a bytes.
+ *
+ * At most one chunk per connection is buffered by the socket. It is 64 KB
+ * by default.
+ */
+void QUpYunSocketTransport::setWriteChunkSize(int bytes)
+{
+    d->writeChunkSize = qMax(1024, bytes);
+}
+
+/*!
+ * \brief Returns the size of body chunks handed to the socket.
+ */
+int QUpYunSocketTransport::writeChunkSize() const
+{
+    return d->writeChunkSize;
+}
+
+/*!
+ * \brief Sets the kernel send and receive buffers of new connections to \a sendBytes and \a receiveBytes.
+ *
+ * Sets a size to 0 to keep the system default, which is the default.
+ * Needs Qt 5.3 or later; ignored otherwise.
+ */
+void QUpYunSocketTransport::setSocketBufferSizes(int sendBytes, int receiveBytes)
+{
+    d->sendBufferSize = qMax(0, sendBytes);
+    d->receiveBufferSize = qMax(0, receiveBytes);
+}
+
+/*!
+ * \brief Returns the kernel send buffer size of new connections, 0 if default.
+ */
+int QUpYunSocketTransport::sendBufferSize() const
+{
+    return d->sendBufferSize;
+}
+
+/*!
+ * \brief Returns the kernel receive buffer size of new connections, 0 if default.
+ */
+int QUpYunSocketTransport::receiveBufferSize() const
+{
+    return d->receiveBufferSize;
+}
+
+/*!
+ * \brief Sets whether Nagle's algorithm is disabled on new connections to \a enabled.
+ *
+ * It is \c true by default, which suits small requests.
+ */
+void QUpYunSocketTransport::setLowDelay(bool enabled)
+{
+    d->lowDelay = enabled;
+}
+
+/*!
+ * \brief Returns true if Nagle's algorithm is disabled on new connections.
+ */
+bool QUpYunSocketTransport::lowDelay() const
+{
+    return d->lowDelay;
+}
+
+/*!
+ * \brief Returns the number of open connections to all hosts.
+ */
+int QUpYunSocketTransport::connectionCount() const
+{
+    int count = 0;
+    QHash<QString, Private::Host>::const_iterator i = d->hosts.constBegin();
+    for (; i != d->hosts.constEnd(); ++i) {
+        count += i.value().connections.size();
+    }
+    return count;
+}
+
+void QUpYunSocketTransport::dispatchAll()
+{
+    QStringList keys = d->hosts.keys();
+    foreach (const QString &key, keys) {
+        d->dispatch(key);
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef QUPYUNSOCKETTRANSPORT_H
+#define QUPYUNSOCKETTRANSPORT_H
+
+#include "qupyuntransport.h"
+
+class QUPYUNSHARED_EXPORT QUpYunSocketTransport : public QUpYunTransport
+{
+    Q_OBJECT
+public:
+    explicit QUpYunSocketTransport(QObject *parent = 0);
+    ~QUpYunSocketTransport();
+
+    QNetworkReply *send(QNetworkAccessManager::Operation operation,
+                        const QNetworkRequest &request,
+                        const QByteArray &body);
+    QNetworkReply *send(QNetworkAccessManager::Operation operation,
+                        const QNetworkRequest &request,
+                        QIODevice *body);
+
+    void setMaxConnectionsPerHost(int max);
+    int maxConnectionsPerHost() const;
+
+    void setPipeliningDepth(int depth);
+    int pipeliningDepth() const;
+
+    void setKeepAliveTimeout(int msecs);
+    int keepAliveTimeout() const;
+
+    void setWriteChunkSize(int bytes);
+    int writeChunkSize() const;
+
+    void setSocketBufferSizes(int sendBytes, int receiveBytes);
+    int sendBufferSize() const;
+    int receiveBufferSize() const;
+
+    void setLowDelay(bool enabled);
+    bool lowDelay() const;
+
+    int connectionCount() const;
+
+private slots:
+    void dispatchAll();
+
+private:
+    class Private;
+    QUpYunSocketTransport::Private *d;
+    friend class QUpYunSocketConnection;
+    friend class QUpYunSocketReply;
+}; // end of class QUpYunSocketTransport
+
+#endif // QUPYUNSOCKETTRANSPORT_H
@@ -0,0 +1,185 @@
+#ifndef QUPYUNSOCKETTRANSPORT_P_H
+#define QUPYUNSOCKETTRANSPORT_P_H
+
+#include <QAbstractSocket>
+#include <QHash>
+#include <QList>
+#include <QNetworkReply>
+#include <QPair>
+#include <QPointer>
+#include <QQueue>
+#include <QTimer>
+
+#include "qupyunsockettransport.h"
+
+QT_BEGIN_NAMESPACE
+class QTcpSocket;
+QT_END_NAMESPACE
+
+class QUpYunSocketConnection;
+
+typedef QList<QPair<QByteArray, QByteArray> > QUpYunHeaderList;
+
+/*
+ * Reply of QUpYunSocketTransport, filled by the connection it is assigned
+ * to. Not part of the public API.
+ */
+class QUpYunSocketReply : public QNetworkReply
+{
+    Q_OBJECT
+public:
+    QUpYunSocketReply(QUpYunSocketTransport *transport,
+                      QNetworkAccessManager::Operation operation,
+                      const QNetworkRequest &request,
+                      const QByteArray &body,
+                      QIODevice *bodyDevice);
+    ~QUpYunSocketReply();
+
+    void abort();
+    qint64 bytesAvailable() const;
+    bool isSequential() const;
+
+    bool isPipelinable() const;
+    qint64 room() const;
+    void respond(int status, const QByteArray &reason, const QUpYunHeaderList &headers);
+    void appendBody(const QByteArray &data);
+    void reportUpload();
+    void complete();
+    void fail(QNetworkReply::NetworkError errorCode, const QString &errorMessage);
+    bool rewind();
+
+    QString hostKey;             // "host:port" of the connection pool.
+    QString hostName;
+    quint16 port;
+    QByteArray head;             // Request line and headers.
+    QByteArray body;             // Body if not read from device.
+    QPointer<QIODevice> device;  // Body device, maybe null.
+    qint64 bodySize;
+    bool headWritten;
+    qint64 bodyWritten;
+    bool responseStarted;
+    bool paused;                 // Connection waits for the data to be read.
+    int retries;
+    QPointer<QUpYunSocketConnection> connection;
+
+protected:
+    qint64 readData(char *data, qint64 maxSize);
+
+private slots:
+    void failUnsupported();
+
+private:
+    void detach();
+
+    QPointer<QUpYunSocketTransport> transport;
+    QByteArray buffer;
+    int readOffset;
+    qint64 received;
+    qint64 expected;
+    int status;
+    bool done;
+}; // end of class QUpYunSocketReply
+
+/*
+ * One keep-alive connection, answering its replies in order.
+ */
+class QUpYunSocketConnection : public QObject
+{
+    Q_OBJECT
+public:
+    QUpYunSocketConnection(QUpYunSocketTransport *transport,
+                           const QString &key,
+                           const QString &hostName,
+                           quint16 port);
+    ~QUpYunSocketConnection();
+
+    inline int load() const;
+    bool canPipeline(const QUpYunSocketReply *reply) const;
+    void assign(QUpYunSocketReply *reply);
+    void cancel(QUpYunSocketReply *reply);
+
+    QString key;
+
+public slots:
+    void readResponses();
+    void writeRequests();
+
+private slots:
+    void socketConnected();
+    void socketDisconnected();
+    void socketError(QAbstractSocket::SocketError error);
+    void closeIdle();
+
+private:
+    enum State
+    {
+        StatusLine,
+        Headers,
+        Body,
+        ChunkSize,
+        ChunkData,
+        ChunkEnd,
+        Trailers,
+        BodyUntilClose
+    };
+
+    bool readBody(QUpYunSocketReply *reply);
+    bool parseStatusLine(const QByteArray &line);
+    void parseHeader(const QByteArray &line);
+    bool endOfHeaders(QUpYunSocketReply *reply);
+    void finishResponse();
+    void close(QNetworkReply::NetworkError errorCode,
+               const QString &errorMessage,
+               bool retryAll);
+
+    QPointer<QUpYunSocketTransport> transport;
+    QTcpSocket *socket;
+    QTimer idleTimer;
+    QList<QUpYunSocketReply *> replies; // Assigned, answered in this order.
+    int writeIndex;                     // First reply not completely written.
+    bool connected;
+    bool closing;
+    int served;                         // Responses read so far.
+
+    State state;
+    qint64 remaining;                   // Body or chunk bytes left.
+    int status;
+    QByteArray reason;
+    QUpYunHeaderList headers;
+    bool chunked;
+    qint64 contentLength;               // -1 if unknown.
+    bool closeAfter;
+}; // end of class QUpYunSocketConnection
+
+class QUpYunSocketTransport::Private
+{
+public:
+    struct Host
+    {
+        QList<QUpYunSocketConnection *> connections;
+        QQueue<QUpYunSocketReply *> waiting;
+    };
+
+    Private(QUpYunSocketTransport *transport);
+
+    QUpYunSocketReply *send(QNetworkAccessManager::Operation operation,
+                            const QNetworkRequest &request,
+                            const QByteArray &body,
+                            QIODevice *device);
+    void enqueue(QUpYunSocketReply *reply);
+    void remove(QUpYunSocketReply *reply);
+    void dispatch(const QString &key);
+    void connectionClosed(QUpYunSocketConnection *connection);
+
+    QUpYunSocketTransport *q;
+    QHash<QString, Host> hosts;
+    int maxConnectionsPerHost;
+    int pipeliningDepth;
+    int keepAliveTimeout;
+    int writeChunkSize;
+    int sendBufferSize;    // 0 for the system default.
+    int receiveBufferSize; // 0 for the system default.
+    bool lowDelay;
+}; // end of class QUpYunSocketTransport::Private
+
+#endif // QUPYUNSOCKETTRANSPORT_P_H
@@ -0,0 +1,449 @@
+#include <QElapsedTimer>
+#include <QHash>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QPointer>
+#include <QUrl>
+
+#include "qupyuntrafficrecorder.h"
+#include "qupyuntransport_p.h"
+
+typedef QList<QPair<QByteArray, QByteArray> > HeaderList;
+
+static const char FORMAT_LINE[] = "# QUpYun traffic 1\n";
+static const int FIELD_COUNT = 10;
+
+/*
+ * Headers which carry credentials or are derived from the payload.
+ */
+static bool isPrivateHeader(const QByteArray &name)
+{
+    static QByteArray AUTHORIZATION("authorization");
+    static QByteArray DATE("date");
+    static QByteArray CONTENT_MD5("content-md5");
+    static QByteArray CONTENT_SECRET("content-secret");
+    static QByteArray CONTENT_LENGTH("content-length");
+    static QByteArray COOKIE("cookie");
+    static QByteArray SET_COOKIE("set-cookie");
+
+    QByteArray lower = name.toLower();
+    return lower == AUTHORIZATION || lower == DATE || lower == CONTENT_MD5
+            || lower == CONTENT_SECRET || lower == CONTENT_LENGTH
+            || lower == COOKIE || lower == SET_COOKIE;
+}
+
+/*
+ * Path of request with the keys of its query, whose values may carry
+ * tokens. Requests without credentials go to a download domain and are
+ * recorded as //HOST/PATH, leaving out the version QUpYun appended.
+ */
+static QString recordedPath(const QNetworkRequest &request)
+{
+    static QByteArray AUTHORIZATION("Authorization");
+
+    QUrl url = request.url();
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+    QByteArray query = url.query(QUrl::FullyEncoded).toLatin1();
+#else
+    QByteArray query = url.encodedQuery();
+#endif
+    QString path = url.path();
+    if (!request.hasRawHeader(AUTHORIZATION)) {
+        QVariant file = request.attribute(DOWNLOAD_PATH_ATTRIBUTE);
+        if (file.isValid()) {
+            path = file.toString();
+        }
+        QString host = url.host();
+        if (url.port() > 0) {
+            host += QLatin1Char(':') + QString::number(url.port());
+        }
+        path = QLatin1String("//") + host + path;
+    }
+    if (!query.isEmpty()) {
+        QByteArray keys;
+        foreach (const QByteArray &item, query.split('&')) {
+            if (!keys.isEmpty()) {
+                keys += '&';
+            }
+            int equal = item.indexOf('=');
+            keys += equal < 0 ? item : item.left(equal);
+        }
+        path += QLatin1Char('?');
+        path += QString::fromUtf8(QByteArray::fromPercentEncoding(keys));
+    }
+    return path;
+}
+
+static QByteArray methodName(QNetworkAccessManager::Operation operation,
+                             const QNetworkRequest &request)
+{
+    switch (operation) {
+    case QNetworkAccessManager::GetOperation:
+        return "GET";
+    case QNetworkAccessManager::PutOperation:
+        return "PUT";
+    case QNetworkAccessManager::HeadOperation:
+        return "HEAD";
+    case QNetworkAccessManager::DeleteOperation:
+        return "DELETE";
+    case QNetworkAccessManager::PostOperation:
+        return "POST";
+    default:
+        return request.attribute(QNetworkRequest::CustomVerbAttribute).toByteArray();
+    }
+}
+
+static QByteArray formatHeaders(const HeaderList &headers)
+{
+    QByteArray out;
+    foreach (const HeaderList::value_type &header, headers) {
+        if (!out.isEmpty()) {
+            out += '&';
+        }
+        out += header.first.toPercentEncoding();
+        out += ':';
+        out += header.second.toPercentEncoding();
+    }
+    return out;
+}
+
+static bool parseHeaders(const QByteArray &field, HeaderList *headers)
+{
+    if (field.isEmpty()) {
+        return true;
+    }
+    foreach (const QByteArray &item, field.split('&')) {
+        int colon = item.indexOf(':');
+        if (colon <= 0) {
+            return false;
+        }
+        headers->append(qMakePair(QByteArray::fromPercentEncoding(item.left(colon)),
+                                  QByteArray::fromPercentEncoding(item.mid(colon + 1))));
+    }
+    return true;
+}
+
+static inline bool earlierThan(const TrafficRecord &left, const TrafficRecord &right)
+{
+    return left.time < right.time;
+}
+
+class QUpYunTrafficRecorder::Private
+{
+public:
+    Private();
+
+    QPointer<QUpYunTransport> target;
+    QPointer<QIODevice> device;
+    QElapsedTimer clock;
+    QHash<QNetworkReply *, TrafficRecord> pending; // In flight, by reply.
+    int count;
+}; // end of class QUpYunTrafficRecorder::Private
+
+QUpYunTrafficRecorder::Private::Private() :
+    count(0)
+{
+}
+
+/*!
+ * \class QUpYunTrafficRecorder
+ * \brief Transport recording the traffic sent through another transport.
+ *
+ * The recorder forwards every request to its target transport and, while
+ * recording, writes one line per finished request to a device: when it
+ * was sent, the method, the path, the body size, the headers, then the
+ * status, the error, the response size, the latency and the response
+ * headers. Bodies are never stored, nor the \c Authorization, \c Date,
+ * \c Content-MD5, \c Content-Secret and cookie headers, nor the values of
+ * the query, so a recording could be shared without leaking files or
+ * credentials. Downloads from a download domain are recorded as
+ * //HOST/PATH, without the version or file secret appended to the path.
+ *
+ * Lines are written as requests finish; load() returns them in the order
+ * they were sent, ready to be replayed, e.g. by the qupyunreplay tool
+ * against a QUpYunLoopbackTransport.
+ *
+ * \code
+ * QUpYunTrafficRecorder *recorder =
+ *         new QUpYunTrafficRecorder(session->transport(), session);
+ * session->setTransport(recorder);
+ * recorder->start(&file);
+ * \endcode
+ *
+ * \sa QUpYunSession::setTransport(QUpYunTransport *)
+ */
+
+/*!
+ * \brief Constructs a recorder forwarding requests to \a target, with given \a parent.
+ *
+ * The recorder does not take ownership of \a target.
+ */
+QUpYunTrafficRecorder::QUpYunTrafficRecorder(QUpYunTransport *target, QObject *parent) :
+    QUpYunTransport(parent),
+    d(new Private)
+{
+    Q_ASSERT(target && target != this);
+    d->target = target;
+}
+
+/*!
+ * \brief Destroys the recorder. Requests still in flight are not recorded.
+ */
+QUpYunTrafficRecorder::~QUpYunTrafficRecorder()
+{
+    stop();
+    delete d;
+}
+
+/*!
+ * \brief Returns the transport the requests are forwarded to.
+ */
+QUpYunTransport *QUpYunTrafficRecorder::target() const
+{
+    return d->target;
+}
+
+/*!
+ * \reimp
+ */
+QNetworkReply *QUpYunTrafficRecorder::send(QNetworkAccessManager::Operation operation,
+                                           const QNetworkRequest &request,
+                                           const QByteArray &body)
+{
+    if (!d->target) {
+        return 0;
+    }
+    return watch(d->target->send(operation, request, body), operation, request);
+}
+
+/*!
+ * \reimp
+ */
+QNetworkReply *QUpYunTrafficRecorder::send(QNetworkAccessManager::Operation operation,
+                                           const QNetworkRequest &request,
+                                           QIODevice *body)
+{
+    if (!d->target) {
+        return 0;
+    }
+    return watch(d->target->send(operation, request, body), operation, request);
+}
+
+/*!
+ * \brief Starts recording the requests sent from now on to \a device.
+ *
+ * \a device must be open for writing and is not owned by the recorder.
+ * Times are counted from this call. Returns false if \a device could not
+ * be written.
+ */
+bool QUpYunTrafficRecorder::start(QIODevice *device)
+{
+    stop();
+    if (!device || !device->isWritable()
+            || device->write(FORMAT_LINE, sizeof(FORMAT_LINE) - 1) < 0) {
+        return false;
+    }
+    d->device = device;
+    d->count = 0;
+    d->clock.start();
+    return true;
+}
+
+/*!
+ * \brief Stops recording. Requests in flight are not recorded.
+ */
+void QUpYunTrafficRecorder::stop()
+{
+    QHash<QNetworkReply *, TrafficRecord>::const_iterator i = d->pending.constBegin();
+    for (; i != d->pending.constEnd(); ++i) {
+        disconnect(i.key(), 0, this, 0);
+    }
+    d->pending.clear();
+    d->device = 0;
+}
+
+/*!
+ * \brief Returns true while recording.
+ */
+bool QUpYunTrafficRecorder::isRecording() const
+{
+    return d->device;
+}
+
+/*!
+ * \brief Returns the number of requests recorded since start().
+ */
+int QUpYunTrafficRecorder::recordCount() const
+{
+    return d->count;
+}
+
+/*!
+ * \brief Returns \a record as a line of the recording, with the line feed.
+ */
+QByteArray QUpYunTrafficRecorder::format(const TrafficRecord &record)
+{
+    static QByteArray PATH_SAFE("/?&");
+
+    QByteArray line;
+    line += QByteArray::number(record.time);
+    line += '\t';
+    line += record.method;
+    line += '\t';
+    line += record.path.toUtf8().toPercentEncoding(PATH_SAFE);
+    line += '\t';
+    line += QByteArray::number(record.requestSize);
+    line += '\t';
+    line += formatHeaders(record.requestHeaders);
+    line += '\t';
+    line += QByteArray::number(record.status);
+    line += '\t';
+    line += QByteArray::number(record.error);
+    line += '\t';
+    line += QByteArray::number(record.responseSize);
+    line += '\t';
+    line += QByteArray::number(record.latency);
+    line += '\t';
+    line += formatHeaders(record.responseHeaders);
+    line += '\n';
+    return line;
+}
+
+/*!
+ * \brief Parses \a line of a recording into \a record.
+ *
+ * Returns false if \a line is a comment or malformed.
+ */
+bool QUpYunTrafficRecorder::parse(const QByteArray &line, TrafficRecord *record)
+{
+    QByteArray trimmed = line.trimmed();
+    if (trimmed.isEmpty() || trimmed.startsWith('#')) {
+        return false;
+    }
+    QList<QByteArray> fields = line.split('\t');
+    if (fields.size() != FIELD_COUNT) {
+        return false;
+    }
+    fields.last() = fields.last().trimmed();
+    bool ok[6];
+    TrafficRecord parsed;
+    parsed.time = fields.at(0).toLongLong(&ok[0]);
+    parsed.method = fields.at(1);
+    parsed.path = QString::fromUtf8(QByteArray::fromPercentEncoding(fields.at(2)));
+    parsed.requestSize = fields.at(3).toLongLong(&ok[1]);
+    parsed.status = fields.at(5).toInt(&ok[2]);
+    parsed.error = fields.at(6).toInt(&ok[3]);
+    parsed.responseSize = fields.at(7).toLongLong(&ok[4]);
+    parsed.latency = fields.at(8).toLongLong(&ok[5]);
+    for (int i = 0; i < 6; ++i) {
+        if (!ok[i]) {
+            return false;
+        }
+    }
+    if (!parseHeaders(fields.at(4), &parsed.requestHeaders)
+            || !parseHeaders(fields.at(9), &parsed.responseHeaders)) {
+        return false;
+    }
+    *record = parsed;
+    return true;
+}
+
+/*!
+ * \brief Reads the recording in \a device, sorted by the time requests were sent.
+ *
+ * Comments and malformed lines are skipped.
+ */
+QList<TrafficRecord> QUpYunTrafficRecorder::load(QIODevice *device)
+{
+    QList<TrafficRecord> records;
+    TrafficRecord record;
+    while (!device->atEnd()) {
+        if (parse(device->readLine(), &record)) {
+            records.append(record);
+        }
+    }
+    qStableSort(records.begin(), records.end(), earlierThan);
+    return records;
+}
+
+/*
+ * Remembers what is known of the request until its reply finishes.
+ */
+QNetworkReply *QUpYunTrafficRecorder::watch(QNetworkReply *reply,
+                                            QNetworkAccessManager::Operation operation,
+                                            const QNetworkRequest &request)
+{
+    if (!reply || !d->device) {
+        return reply;
+    }
+    TrafficRecord &record = d->pending[reply];
+    record.time = d->clock.elapsed();
+    record.method = methodName(operation, request);
+    record.path = recordedPath(request);
+    record.requestSize = request.header(QNetworkRequest::ContentLengthHeader).toLongLong();
+    foreach (const QByteArray &name, request.rawHeaderList()) {
+        if (!isPrivateHeader(name)) {
+            record.requestHeaders.append(qMakePair(name, request.rawHeader(name)));
+        }
+    }
+    record.status = 0;
+    record.error = QNetworkReply::NoError;
+    record.responseSize = 0;
+    record.latency = 0;
+    connect(reply, SIGNAL(downloadProgress(qint64,qint64)),
+            this, SLOT(replyProgress(qint64,qint64)));
+    connect(reply, SIGNAL(finished()), this, SLOT(replyFinished()));
+    connect(reply, SIGNAL(destroyed(QObject*)), this, SLOT(replyDestroyed(QObject*)));
+    return reply;
+}
+
+void QUpYunTrafficRecorder::replyProgress(qint64 bytesReceived, qint64 bytesTotal)
+{
+    Q_UNUSED(bytesTotal)
+    QNetworkReply *reply = static_cast<QNetworkReply *>(sender());
+    QHash<QNetworkReply *, TrafficRecord>::iterator i = d->pending.find(reply);
+    if (i != d->pending.end()) {
+        i.value().responseSize = bytesReceived;
+    }
+}
+
+void QUpYunTrafficRecorder::replyFinished()
+{
+    finish(static_cast<QNetworkReply *>(sender()), false);
+}
+
+/*
+ * A reply deleted before it finished is recorded as canceled.
+ */
+void QUpYunTrafficRecorder::replyDestroyed(QObject *reply)
+{
+    finish(static_cast<QNetworkReply *>(reply), true);
+}
+
+void QUpYunTrafficRecorder::finish(QNetworkReply *reply, bool destroyed)
+{
+    QHash<QNetworkReply *, TrafficRecord>::iterator i = d->pending.find(reply);
+    if (i == d->pending.end()) {
+        return;
+    }
+    TrafficRecord record = i.value();
+    d->pending.erase(i);
+    record.latency = d->clock.elapsed() - record.time;
+    if (destroyed) {
+        record.error = QNetworkReply::OperationCanceledError;
+    } else {
+        disconnect(reply, 0, this, 0);
+        record.status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        record.error = reply->error();
+        foreach (const QByteArray &name, reply->rawHeaderList()) {
+            if (!isPrivateHeader(name)) {
+                record.responseHeaders.append(qMakePair(name, reply->rawHeader(name)));
+            }
+        }
+    }
+    if (!d->device || d->device->write(format(record)) < 0) {
+        return;
+    }
+    ++d->count;
+    emit recorded(record);
+}
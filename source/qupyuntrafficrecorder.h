@@ -0,0 +1,68 @@
+#ifndef QUPYUNTRAFFICRECORDER_H
+#define QUPYUNTRAFFICRECORDER_H
+
+#include <QList>
+#include <QMetaType>
+#include <QPair>
+
+#include "qupyuntransport.h"
+
+struct TrafficRecord
+{
+    qint64     time;         // Milliseconds since the recording started.
+    QByteArray method;
+    QString    path;         // With the bucket and the query keys, or //HOST for the CDN.
+    qint64     requestSize;
+    QList<QPair<QByteArray, QByteArray> > requestHeaders;
+    int        status;       // 0 if there was no response.
+    int        error;        // QNetworkReply::NetworkError
+    qint64     responseSize;
+    qint64     latency;      // Milliseconds from sending to finished.
+    QList<QPair<QByteArray, QByteArray> > responseHeaders;
+};
+Q_DECLARE_METATYPE(TrafficRecord)
+
+class QUPYUNSHARED_EXPORT QUpYunTrafficRecorder : public QUpYunTransport
+{
+    Q_OBJECT
+public:
+    explicit QUpYunTrafficRecorder(QUpYunTransport *target, QObject *parent = 0);
+    ~QUpYunTrafficRecorder();
+
+    QUpYunTransport *target() const;
+
+    QNetworkReply *send(QNetworkAccessManager::Operation operation,
+                        const QNetworkRequest &request,
+                        const QByteArray &body);
+    QNetworkReply *send(QNetworkAccessManager::Operation operation,
+                        const QNetworkRequest &request,
+                        QIODevice *body);
+
+    bool start(QIODevice *device);
+    void stop();
+    bool isRecording() const;
+    int recordCount() const;
+
+    static QByteArray format(const TrafficRecord &record);
+    static bool parse(const QByteArray &line, TrafficRecord *record);
+    static QList<TrafficRecord> load(QIODevice *device);
+
+signals:
+    void recorded(const TrafficRecord &record);
+
+private slots:
+    void replyProgress(qint64 bytesReceived, qint64 bytesTotal);
+    void replyFinished();
+    void replyDestroyed(QObject *reply);
+
+private:
+    QNetworkReply *watch(QNetworkReply *reply,
+                         QNetworkAccessManager::Operation operation,
+                         const QNetworkRequest &request);
+    void finish(QNetworkReply *reply, bool destroyed);
+
+    class Private;
+    QUpYunTrafficRecorder::Private *d;
+}; // end of class QUpYunTrafficRecorder
+
+#endif // QUPYUNTRAFFICRECORDER_H
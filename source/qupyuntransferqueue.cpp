@@ -0,0 +1,591 @@
+#include <QFile>
+#include <QFutureWatcher>
+#include <QMap>
+#include <QPointer>
+#include <QQueue>
+#if QT_VERSION >= QT_VERSION_CHECK(5, 1, 0)
+#include <QSaveFile>
+#endif
+
+#include "qupyun.h"
+#include "qupyuntransferqueue.h"
+
+static const int DEFAULT_MAX_ACTIVE_JOBS = 4;
+static const int DEFAULT_COMPACT_THRESHOLD = 100000;
+
+// Journal records, one per line: TYPE \t ID [\t FLAGS \t PATH \t LOCAL_PATH \t SECRET]
+static const char RECORD_ENQUEUED = 'E';
+static const char RECORD_STARTED = 'S';
+static const char RECORD_DONE = 'D';
+static const char RECORD_FAILED = 'F';
+
+static const int FLAG_AUTO_MKDIR = 0x1;
+static const int FLAG_APPEND_MD5 = 0x2;
+
+static QByteArray escapeField(const QString &field)
+{
+    QByteArray utf8 = field.toUtf8();
+    QByteArray escaped;
+    escaped.reserve(utf8.size());
+    for (int i = 0; i < utf8.size(); ++i) {
+        char c = utf8.at(i);
+        switch (c) {
+        case '\\':
+            escaped += "\\\\";
+            break;
+        case '\t':
+            escaped += "\\t";
+            break;
+        case '\n':
+            escaped += "\\n";
+            break;
+        case '\r':
+            escaped += "\\r";
+            break;
+        default:
+            escaped += c;
+            break;
+        }
+    }
+    return escaped;
+}
+
+static QString unescapeField(const QByteArray &field)
+{
+    if (!field.contains('\\')) {
+        return QString::fromUtf8(field.constData(), field.size());
+    }
+    QByteArray unescaped;
+    unescaped.reserve(field.size());
+    for (int i = 0; i < field.size(); ++i) {
+        char c = field.at(i);
+        if (c == '\\' && i + 1 < field.size()) {
+            c = field.at(++i);
+            if (c == 't') {
+                c = '\t';
+            } else if (c == 'n') {
+                c = '\n';
+            } else if (c == 'r') {
+                c = '\r';
+            }
+        }
+        unescaped += c;
+    }
+    return QString::fromUtf8(unescaped.constData(), unescaped.size());
+}
+
+struct TransferJob
+{
+    TransferJob() :
+        autoMkdir(false),
+        appendFileMD5(false),
+        failed(false)
+    {
+    }
+
+    QString path;
+    QString localPath;
+    bool autoMkdir;
+    bool appendFileMD5;
+    QString fileSecret;
+    bool failed; // Failed in this session, retried after next open().
+};
+
+static QByteArray enqueuedRecord(quint64 id, const TransferJob &job)
+{
+    int flags = (job.autoMkdir ? FLAG_AUTO_MKDIR : 0)
+            | (job.appendFileMD5 ? FLAG_APPEND_MD5 : 0);
+    QByteArray record;
+    record += RECORD_ENQUEUED;
+    record += '\t';
+    record += QByteArray::number(id);
+    record += '\t';
+    record += QByteArray::number(flags);
+    record += '\t';
+    record += escapeField(job.path);
+    record += '\t';
+    record += escapeField(job.localPath);
+    record += '\t';
+    record += escapeField(job.fileSecret);
+    record += '\n';
+    return record;
+}
+
+class QUpYunTransferQueue::Private : public QObject
+{
+    Q_OBJECT
+public:
+    Private(QUpYunTransferQueue *queue, QUpYun *client, const QString &path) :
+        QObject(queue),
+        q(queue),
+        upyun(client),
+        journalPath(path),
+        nextId(1),
+        records(0),
+        maxActiveJobs(DEFAULT_MAX_ACTIVE_JOBS),
+        compactThreshold(DEFAULT_COMPACT_THRESHOLD)
+    {
+    }
+
+    bool replay();
+    bool writeCompacted();
+    void appendRecord(char type, quint64 id);
+    void appendEnqueued(quint64 id, const TransferJob &job);
+    void schedule();
+    void stop();
+
+    QUpYunTransferQueue *q;
+    QPointer<QUpYun> upyun;
+    QString journalPath;
+    QFile journal; // Opened for appending.
+
+    QMap<quint64, TransferJob> jobs; // All unfinished jobs, ordered by id.
+    QQueue<quint64> pending;
+    QHash<QFutureWatcher<PicInfo> *, quint64> active;
+    quint64 nextId;
+    int records; // Records in the journal file.
+
+    int maxActiveJobs;
+    int compactThreshold;
+
+private slots:
+    void uploadFinished();
+}; // end of class QUpYunTransferQueue::Private
+
+/*!
+ * \class QUpYunTransferQueue
+ * \brief Crash-safe persistent queue of uploads.
+ *
+ * Every enqueued, started, completed and failed upload is appended to a
+ * journal file. open() replays the journal and resumes the uploads which
+ * were not completed, so a restarted process continues where it stopped
+ * instead of uploading everything again.
+ *
+ * The journal is compacted on open() and whenever it holds more than
+ * compactThreshold() records, most of which are finished. The compacted
+ * journal replaces the old one atomically with Qt 5.1 or later.
+ *
+ * \note Records are flushed to the operating system after each write, which
+ * survives a crash of the process but not of the machine.
+ */
+
+/*!
+ * \brief Constructs a queue uploading by \a upyun, journaled at \a journalPath.
+ */
+QUpYunTransferQueue::QUpYunTransferQueue(QUpYun *upyun,
+                                         const QString &journalPath,
+                                         QObject *parent) :
+    QObject(parent),
+    d(new Private(this, upyun, journalPath))
+{
+}
+
+/*!
+ * \brief Destroys the queue. Unfinished uploads are resumed by next open().
+ */
+QUpYunTransferQueue::~QUpYunTransferQueue()
+{
+    close();
+    delete d;
+}
+
+/*!
+ * \brief Opens the journal, replays it and resumes unfinished uploads.
+ *
+ * Returns false if the journal could not be read or written.
+ */
+bool QUpYunTransferQueue::open()
+{
+    if (isOpen()) {
+        return true;
+    }
+    if (!d->replay() || !d->writeCompacted()) {
+        d->jobs.clear();
+        return false;
+    }
+    d->journal.setFileName(d->journalPath);
+    if (!d->journal.open(QFile::WriteOnly | QFile::Append)) {
+        d->jobs.clear();
+        return false;
+    }
+    QMap<quint64, TransferJob>::const_iterator i = d->jobs.constBegin();
+    while (i != d->jobs.constEnd()) {
+        d->pending.enqueue(i.key());
+        ++i;
+    }
+    d->schedule();
+    return true;
+}
+
+/*!
+ * \brief Closes the journal and stops starting uploads.
+ *
+ * Uploads in progress are canceled by QUpYun::cancel(const QFuture<void> &)
+ * and will be started again by next open(), so no file is uploaded twice at
+ * the same time.
+ */
+void QUpYunTransferQueue::close()
+{
+    if (!isOpen()) {
+        return;
+    }
+    d->stop();
+    d->journal.close();
+}
+
+/*!
+ * \brief Returns true if the journal is opened.
+ */
+bool QUpYunTransferQueue::isOpen() const
+{
+    return d->journal.isOpen();
+}
+
+/*!
+ * \brief Enqueues uploading a file at \a localPath to \a path.
+ *
+ * \a autoMkdir, \a appendFileMD5 and \a fileSecret are the same as
+ * QUpYun::uploadFile(). Returns the job id, or 0 if the queue is not opened.
+ *
+ * \sa QUpYunTransferQueue::jobFinished(quint64, bool)
+ */
+quint64 QUpYunTransferQueue::enqueue(const QString &path,
+                                     const QString &localPath,
+                                     bool autoMkdir,
+                                     bool appendFileMD5,
+                                     const QString &fileSecret)
+{
+    if (!isOpen()) {
+        return 0;
+    }
+    quint64 id = d->nextId++;
+    TransferJob &job = d->jobs[id];
+    job.path = path;
+    job.localPath = localPath;
+    job.autoMkdir = autoMkdir;
+    job.appendFileMD5 = appendFileMD5;
+    job.fileSecret = fileSecret;
+    d->appendEnqueued(id, job);
+    d->pending.enqueue(id);
+    d->schedule();
+    return id;
+}
+
+/*!
+ * \brief Returns count of jobs waiting to start.
+ */
+int QUpYunTransferQueue::pendingCount() const
+{
+    return d->pending.size();
+}
+
+/*!
+ * \brief Returns count of uploads in progress.
+ */
+int QUpYunTransferQueue::activeCount() const
+{
+    return d->active.size();
+}
+
+/*!
+ * \brief Returns count of jobs failed since open(), which are retried by next open().
+ */
+int QUpYunTransferQueue::failedCount() const
+{
+    int count = 0;
+    QMap<quint64, TransferJob>::const_iterator i = d->jobs.constBegin();
+    while (i != d->jobs.constEnd()) {
+        if (i.value().failed) {
+            ++count;
+        }
+        ++i;
+    }
+    return count;
+}
+
+/*!
+ * \brief Sets at most \a max uploads in progress at the same time. 4 by default.
+ */
+void QUpYunTransferQueue::setMaxActiveJobs(int max)
+{
+    d->maxActiveJobs = qMax(1, max);
+    d->schedule();
+}
+
+/*!
+ * \brief Returns at most how many uploads are in progress at the same time.
+ */
+int QUpYunTransferQueue::maxActiveJobs() const
+{
+    return d->maxActiveJobs;
+}
+
+/*!
+ * \brief Compacts the journal once it has more than \a records records.
+ *
+ * Sets \a records to 0 to compact only on open(). 100000 by default.
+ */
+void QUpYunTransferQueue::setCompactThreshold(int records)
+{
+    d->compactThreshold = qMax(0, records);
+}
+
+/*!
+ * \brief Returns how many records the journal could have before compacting.
+ */
+int QUpYunTransferQueue::compactThreshold() const
+{
+    return d->compactThreshold;
+}
+
+/*!
+ * \brief Rewrites the journal with unfinished jobs only.
+ *
+ * Returns false if the journal could not be rewritten, in which case the
+ * old journal is kept. If the journal could not be opened again, the queue
+ * is closed and journalError() is emitted.
+ */
+bool QUpYunTransferQueue::compact()
+{
+    if (!isOpen()) {
+        return false;
+    }
+    d->journal.close();
+    bool compacted = d->writeCompacted();
+    if (!d->journal.open(QFile::WriteOnly | QFile::Append)) {
+        d->stop();
+        emit journalError();
+        return false;
+    }
+    return compacted;
+}
+
+bool QUpYunTransferQueue::Private::replay()
+{
+    QString compactedPath = journalPath + QLatin1String(".tmp");
+    if (!QFile::exists(journalPath)) {
+        // before Qt 5.1, crashed between removing the journal and renaming
+        // the compacted one
+        if (QFile::exists(compactedPath) && !QFile::rename(compactedPath, journalPath)) {
+            return false;
+        }
+    } else if (QFile::exists(compactedPath)) {
+        // crashed while compacting, the journal is still complete
+        QFile::remove(compactedPath);
+    }
+
+    jobs.clear();
+    nextId = 1;
+    records = 0;
+
+    QFile file(journalPath);
+    if (!file.exists()) {
+        return true;
+    }
+    if (!file.open(QFile::ReadOnly)) {
+        return false;
+    }
+    QByteArray content = file.readAll();
+    file.close();
+
+    int start = 0;
+    int end = 0;
+    // a line without '\n' was torn by a crash, skip it
+    while ((end = content.indexOf('\n', start)) >= 0) {
+        QList<QByteArray> fields = content.mid(start, end - start).split('\t');
+        start = end + 1;
+        if (fields.size() < 2 || fields.at(0).size() != 1) {
+            continue;
+        }
+        bool ok = false;
+        quint64 id = fields.at(1).toULongLong(&ok);
+        if (!ok) {
+            continue;
+        }
+        nextId = qMax(nextId, id + 1);
+        switch (fields.at(0).at(0)) {
+        case RECORD_ENQUEUED:
+            if (fields.size() == 6) {
+                int flags = fields.at(2).toInt();
+                TransferJob &job = jobs[id];
+                job.autoMkdir = (flags & FLAG_AUTO_MKDIR) != 0;
+                job.appendFileMD5 = (flags & FLAG_APPEND_MD5) != 0;
+                job.path = unescapeField(fields.at(3));
+                job.localPath = unescapeField(fields.at(4));
+                job.fileSecret = unescapeField(fields.at(5));
+            }
+            break;
+        case RECORD_DONE:
+            jobs.remove(id);
+            break;
+        default:
+            // started and failed jobs are still unfinished
+            break;
+        }
+    }
+    return true;
+}
+
+bool QUpYunTransferQueue::Private::writeCompacted()
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 1, 0)
+    // replaces the journal atomically on commit()
+    QSaveFile compacted(journalPath);
+    if (!compacted.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+#else
+    QString compactedPath = journalPath + QLatin1String(".tmp");
+    QFile compacted(compactedPath);
+    if (!compacted.open(QFile::WriteOnly | QFile::Truncate)) {
+        return false;
+    }
+#endif
+    QByteArray buffer;
+    QMap<quint64, TransferJob>::const_iterator i = jobs.constBegin();
+    while (i != jobs.constEnd()) {
+        buffer += enqueuedRecord(i.key(), i.value());
+        if (buffer.size() >= 64 * 1024) {
+            if (compacted.write(buffer) != buffer.size()) {
+                return false;
+            }
+            buffer.clear();
+        }
+        ++i;
+    }
+    if (compacted.write(buffer) != buffer.size()) {
+        return false;
+    }
+#if QT_VERSION >= QT_VERSION_CHECK(5, 1, 0)
+    if (!compacted.commit()) {
+        return false;
+    }
+#else
+    if (!compacted.flush()) {
+        return false;
+    }
+    compacted.close();
+    if (QFile::exists(journalPath) && !QFile::remove(journalPath)) {
+        return false;
+    }
+    if (!QFile::rename(compactedPath, journalPath)) {
+        return false;
+    }
+#endif
+    records = jobs.size();
+    return true;
+}
+
+void QUpYunTransferQueue::Private::appendRecord(char type, quint64 id)
+{
+    QByteArray record;
+    record += type;
+    record += '\t';
+    record += QByteArray::number(id);
+    record += '\n';
+    journal.write(record);
+    journal.flush();
+    ++records;
+}
+
+void QUpYunTransferQueue::Private::appendEnqueued(quint64 id, const TransferJob &job)
+{
+    journal.write(enqueuedRecord(id, job));
+    journal.flush();
+    ++records;
+}
+
+void QUpYunTransferQueue::Private::schedule()
+{
+    while (active.size() < maxActiveJobs && !pending.isEmpty()) {
+        quint64 id = pending.dequeue();
+        if (!jobs.contains(id)) {
+            continue;
+        }
+        TransferJob &job = jobs[id];
+        if (!QFile::exists(job.localPath)) {
+            job.failed = true;
+            appendRecord(RECORD_FAILED, id);
+            emit q->jobFinished(id, false);
+            continue;
+        }
+        appendRecord(RECORD_STARTED, id);
+        QFutureWatcher<PicInfo> *watcher = new QFutureWatcher<PicInfo>(this);
+        connect(watcher, SIGNAL(finished()), this, SLOT(uploadFinished()));
+        active.insert(watcher, id);
+        watcher->setFuture(upyun->uploadFile(job.path,
+                                             job.localPath,
+                                             job.autoMkdir,
+                                             job.appendFileMD5,
+                                             job.fileSecret));
+    }
+}
+
+/*
+ * Cancels the uploads in progress and forgets all jobs, which stay in the
+ * journal for next open().
+ */
+void QUpYunTransferQueue::Private::stop()
+{
+    QHash<QFutureWatcher<PicInfo> *, quint64>::const_iterator i = active.constBegin();
+    while (i != active.constEnd()) {
+        i.key()->disconnect(this);
+        if (upyun) {
+            upyun->cancel(QFuture<void>(i.key()->future()));
+        }
+        i.key()->deleteLater();
+        ++i;
+    }
+    active.clear();
+    pending.clear();
+    jobs.clear();
+}
+
+void QUpYunTransferQueue::Private::uploadFinished()
+{
+    QFutureWatcher<PicInfo> *watcher = static_cast<QFutureWatcher<PicInfo> *>(sender());
+    quint64 id = active.take(watcher);
+    watcher->deleteLater();
+    bool success = !watcher->isCanceled();
+    if (success) {
+        jobs.remove(id);
+        appendRecord(RECORD_DONE, id);
+    } else {
+        jobs[id].failed = true;
+        appendRecord(RECORD_FAILED, id);
+    }
+    if (compactThreshold > 0 && records >= compactThreshold && records > 2 * jobs.size()) {
+        q->compact();
+    }
+    emit q->jobFinished(id, success);
+    if (!q->isOpen()) {
+        // the journal could not be reopened after compacting
+        return;
+    }
+    schedule();
+    if (pending.isEmpty() && active.isEmpty()) {
+        emit q->finished();
+    }
+}
+
+#include "qupyuntransferqueue.moc"
+
+/*!
+ * \fn void QUpYunTransferQueue::jobFinished(quint64 id, bool success)
+ * \brief Emitted when the upload of job \a id is finished.
+ *
+ * If \a success is false, the job is retried after next open().
+ */
+
+/*!
+ * \fn void QUpYunTransferQueue::journalError()
+ * \brief Emitted when the journal could not be opened again after compacting.
+ *
+ * The queue is closed and its uploads in progress are canceled. Unfinished
+ * jobs are still in the journal on disk and resumed by next open().
+ */
+
+/*!
+ * \fn void QUpYunTransferQueue::finished()
+ * \brief Emitted when there is no upload waiting or in progress.
+ */
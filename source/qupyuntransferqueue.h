@@ -0,0 +1,51 @@
+#ifndef QUPYUNTRANSFERQUEUE_H
+#define QUPYUNTRANSFERQUEUE_H
+
+#include <QObject>
+
+#include "qupyun_global.h"
+
+class QUpYun;
+
+class QUPYUNSHARED_EXPORT QUpYunTransferQueue : public QObject
+{
+    Q_OBJECT
+public:
+    QUpYunTransferQueue(QUpYun *upyun,
+                        const QString &journalPath,
+                        QObject *parent = 0);
+    ~QUpYunTransferQueue();
+
+    bool open();
+    void close();
+    bool isOpen() const;
+
+    quint64 enqueue(const QString &path,
+                    const QString &localPath,
+                    bool autoMkdir = false,
+                    bool appendFileMD5 = false,
+                    const QString &fileSecret = QString());
+
+    int pendingCount() const;
+    int activeCount() const;
+    int failedCount() const;
+
+    void setMaxActiveJobs(int max);
+    int maxActiveJobs() const;
+
+    void setCompactThreshold(int records);
+    int compactThreshold() const;
+    bool compact();
+
+signals:
+    void jobFinished(quint64 id, bool success);
+    void journalError();
+    void finished();
+
+private:
+    class Private;
+    QUpYunTransferQueue::Private *d;
+    friend class QUpYunTransferQueue::Private;
+}; // end of class QUpYunTransferQueue
+
+#endif // QUPYUNTRANSFERQUEUE_H
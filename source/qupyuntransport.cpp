@@ -0,0 +1,92 @@
+#include "qupyuntransport.h"
+#include "qupyuntransport_p.h"
+
+/*
+ * Maps an HTTP status to the error QNetworkAccessManager reports for it.
+ */
+QNetworkReply::NetworkError qupyunHttpStatusError(int status)
+{
+    switch (status) {
+    case 400:
+        return QNetworkReply::ProtocolInvalidOperationError;
+    case 401:
+        return QNetworkReply::AuthenticationRequiredError;
+    case 403:
+        return QNetworkReply::ContentAccessDenied;
+    case 404:
+        return QNetworkReply::ContentNotFoundError;
+    case 405:
+        return QNetworkReply::ContentOperationNotPermittedError;
+    case 407:
+        return QNetworkReply::ProxyAuthenticationRequiredError;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 3, 0)
+    case 409:
+        return QNetworkReply::ContentConflictError;
+    case 410:
+        return QNetworkReply::ContentGoneError;
+    case 500:
+        return QNetworkReply::InternalServerError;
+    case 501:
+        return QNetworkReply::OperationNotImplementedError;
+    case 503:
+        return QNetworkReply::ServiceUnavailableError;
+#endif
+    default:
+        break;
+    }
+    if (status >= 500) {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 3, 0)
+        return QNetworkReply::UnknownServerError;
+#else
+        return QNetworkReply::ProtocolUnknownError;
+#endif
+    }
+    return QNetworkReply::UnknownContentError;
+}
+
+/*!
+ * \class QUpYunTransport
+ * \brief Interface sending the HTTP requests of QUpYun.
+ *
+ * A transport turns a signed request into a QNetworkReply, which QUpYun
+ * reads as it would read one from QNetworkAccessManager: headers, status
+ * attributes, errors, readyRead(), progress signals and finished(). The
+ * reply must not emit finished() before send() returns. QUpYun owns the
+ * replies it gets and deletes them when they have finished or have been
+ * aborted.
+ *
+ * \sa QUpYunNetworkTransport, QUpYunSocketTransport, QUpYunLoopbackTransport
+ * \sa QUpYunSession::setTransport(QUpYunTransport *)
+ */
+
+/*!
+ * \brief Constructs a transport with given \a parent.
+ */
+QUpYunTransport::QUpYunTransport(QObject *parent) :
+    QObject(parent)
+{
+}
+
+/*!
+ * \brief Destroys the transport.
+ */
+QUpYunTransport::~QUpYunTransport()
+{
+}
+
+/*!
+ * \fn QNetworkReply *QUpYunTransport::send(QNetworkAccessManager::Operation operation, const QNetworkRequest &request, const QByteArray &body)
+ * \brief Sends \a request by \a operation with \a body and returns its reply.
+ *
+ * \a operation is one of \c GetOperation, \c PutOperation, \c HeadOperation
+ * and \c DeleteOperation. The \c Content-Length header is always set.
+ */
+
+/*!
+ * \fn QNetworkReply *QUpYunTransport::send(QNetworkAccessManager::Operation operation, const QNetworkRequest &request, QIODevice *body)
+ * \brief Sends \a request by \a operation with the content of \a body and returns its reply.
+ *
+ * \a body is open and sized by the \c Content-Length header. It may have
+ * nothing to read for a while, in which case it emits readyRead() once it
+ * has. It must be kept until the reply has finished.
+ */
@@ -0,0 +1,30 @@
+#ifndef QUPYUNTRANSPORT_H
+#define QUPYUNTRANSPORT_H
+
+#include <QNetworkAccessManager>
+#include <QObject>
+
+#include "qupyun_global.h"
+
+QT_BEGIN_NAMESPACE
+class QIODevice;
+class QNetworkReply;
+class QNetworkRequest;
+QT_END_NAMESPACE
+
+class QUPYUNSHARED_EXPORT QUpYunTransport : public QObject
+{
+    Q_OBJECT
+public:
+    explicit QUpYunTransport(QObject *parent = 0);
+    virtual ~QUpYunTransport();
+
+    virtual QNetworkReply *send(QNetworkAccessManager::Operation operation,
+                                const QNetworkRequest &request,
+                                const QByteArray &body) = 0;
+    virtual QNetworkReply *send(QNetworkAccessManager::Operation operation,
+                                const QNetworkRequest &request,
+                                QIODevice *body) = 0;
+}; // end of class QUpYunTransport
+
+#endif // QUPYUNTRANSPORT_H
@@ -0,0 +1,17 @@
+#ifndef QUPYUNTRANSPORT_P_H
+#define QUPYUNTRANSPORT_P_H
+
+#include <QNetworkReply>
+#include <QNetworkRequest>
+
+/*
+ * Set by QUpYun on downloads of a version from the download domain to the
+ * URL path of the file itself, so the suffix, which may be the file secret,
+ * is never recorded.
+ */
+static const QNetworkRequest::Attribute DOWNLOAD_PATH_ATTRIBUTE =
+        QNetworkRequest::Attribute(QNetworkRequest::User + 1);
+
+QNetworkReply::NetworkError qupyunHttpStatusError(int status);
+
+#endif // QUPYUNTRANSPORT_P_H
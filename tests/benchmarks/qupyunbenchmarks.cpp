@@ -0,0 +1,408 @@
+#include <cstdlib>
+
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QFutureWatcher>
+#include <QMap>
+#include <QTemporaryFile>
+#include <QTextStream>
+#include <QtTest>
+
+#include "qupyun.h"
+#include "qupyunitemlist.h"
+#include "qupyunloopbacktransport.h"
+#include "qupyunsession.h"
+
+static const char BUCKET[] = "bucket";
+static const double ALLOCATION_TOLERANCE = 1.1;
+static const double DEFAULT_TIME_TOLERANCE = 1.5;
+
+static volatile bool counting = false;
+static long allocationCount = 0;
+
+#if defined(__GLIBC__)
+/*
+ * Heap allocations are counted by interposing malloc, which QByteArray,
+ * QString and operator new all end up in.
+ */
+#define QUPYUN_COUNT_ALLOCATIONS
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+
+void *malloc(size_t size) __THROW
+{
+    if (counting) {
+        __sync_fetch_and_add(&allocationCount, 1);
+    }
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) __THROW
+{
+    if (counting) {
+        __sync_fetch_and_add(&allocationCount, 1);
+    }
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size) __THROW
+{
+    if (counting) {
+        __sync_fetch_and_add(&allocationCount, 1);
+    }
+    return __libc_realloc(pointer, size);
+}
+} // extern "C"
+#endif
+
+struct Result
+{
+    Result() :
+        allocations(-1),
+        nsecs(-1)
+    {
+    }
+
+    qint64 allocations; // Of one operation, -1 if not counted.
+    qint64 nsecs;       // Fastest run of one operation.
+};
+
+/*
+ * Measures every run of a QBENCHMARK body, keeping the best one.
+ */
+class Measurement
+{
+public:
+    void start()
+    {
+        allocationCount = 0;
+        counting = true;
+        timer.start();
+    }
+
+    void stop()
+    {
+        qint64 elapsed = timer.nsecsElapsed();
+        counting = false;
+        if (result.nsecs < 0 || elapsed < result.nsecs) {
+            result.nsecs = elapsed;
+        }
+#ifdef QUPYUN_COUNT_ALLOCATIONS
+        if (result.allocations < 0 || allocationCount < result.allocations) {
+            result.allocations = allocationCount;
+        }
+#endif
+    }
+
+    Result result;
+
+private:
+    QElapsedTimer timer;
+};
+
+template <typename T>
+static void waitFor(const QFuture<T> &future)
+{
+    QFutureWatcher<T> watcher;
+    QEventLoop loop;
+    QObject::connect(&watcher, SIGNAL(finished()), &loop, SLOT(quit()));
+    watcher.setFuture(future);
+    if (!future.isFinished()) {
+        loop.exec();
+    }
+}
+
+/*
+ * ls body of count items, NAME \t N|F \t SIZE \t DATE, one in eight a
+ * folder and one in four named in Chinese.
+ */
+static QByteArray listingBody(int count)
+{
+    QByteArray body;
+    body.reserve(count * 40);
+    for (int i = 0; i < count; ++i) {
+        body += (i % 4 == 0) ? QString::fromUtf8("照片_").toUtf8() : QByteArray("IMG_");
+        body += QByteArray::number(i);
+        if (i % 8 == 7) {
+            body += "\tF\t0\t";
+        } else {
+            body += ".jpg\tN\t";
+            body += QByteArray::number(100000 + i * 37);
+            body += '\t';
+        }
+        body += QByteArray::number(1400000000 + i);
+        body += '\n';
+    }
+    return body;
+}
+
+static QString longPath(const QString &segment, int length)
+{
+    QString path;
+    while (path.size() < length) {
+        path += QLatin1Char('/');
+        path += segment;
+    }
+    return path.left(length);
+}
+
+class QUpYunBenchmarks : public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void parseListing_data();
+    void parseListing();
+    void ls_data();
+    void ls();
+    void longPath_data();
+    void longPath();
+    void manyHeaders_data();
+    void manyHeaders();
+
+private:
+    void loadBaseline();
+    void writeBaseline() const;
+    void verify(const Result &result);
+
+    QUpYunSession *session;
+    QUpYunLoopbackTransport *loopback;
+    QUpYun *upyun;
+
+    QString baselinePath;
+    bool updating;
+    double timeTolerance;
+    QMap<QByteArray, Result> baseline;
+    QMap<QByteArray, Result> results;
+}; // end of class QUpYunBenchmarks
+
+void QUpYunBenchmarks::initTestCase()
+{
+    session = new QUpYunSession(this);
+    loopback = new QUpYunLoopbackTransport(session);
+    session->setTransport(loopback);
+    upyun = new QUpYun(session, QLatin1String(BUCKET), QLatin1String("user"), QLatin1String("password"), this);
+
+    QByteArray path = qgetenv("QUPYUN_BENCHMARK_BASELINE");
+    baselinePath = path.isEmpty() ? QString::fromLocal8Bit(QUPYUN_BENCHMARK_BASELINE)
+                                  : QString::fromLocal8Bit(path);
+    updating = !qgetenv("QUPYUN_UPDATE_BASELINE").isEmpty();
+    bool ok = false;
+    timeTolerance = qgetenv("QUPYUN_BENCHMARK_TOLERANCE").toDouble(&ok);
+    if (!ok || timeTolerance < 1) {
+        timeTolerance = DEFAULT_TIME_TOLERANCE;
+    }
+    if (!updating) {
+        loadBaseline();
+    }
+}
+
+void QUpYunBenchmarks::cleanupTestCase()
+{
+    if (updating) {
+        writeBaseline();
+    }
+}
+
+/*
+ * Baseline file: # comments, then NAME ALLOCATIONS NANOSECONDS per line.
+ */
+void QUpYunBenchmarks::loadBaseline()
+{
+    QFile file(baselinePath);
+    if (!file.open(QFile::ReadOnly | QFile::Text)) {
+        return;
+    }
+    while (!file.atEnd()) {
+        QByteArray line = file.readLine().trimmed();
+        if (line.isEmpty() || line.startsWith('#')) {
+            continue;
+        }
+        QList<QByteArray> fields = line.split(' ');
+        if (fields.size() != 3) {
+            continue;
+        }
+        Result result;
+        result.allocations = fields.at(1).toLongLong();
+        result.nsecs = fields.at(2).toLongLong();
+        baseline.insert(fields.at(0), result);
+    }
+}
+
+void QUpYunBenchmarks::writeBaseline() const
+{
+    QFile file(baselinePath);
+    if (!file.open(QFile::WriteOnly | QFile::Truncate | QFile::Text)) {
+        qWarning("Cannot write %s", qPrintable(baselinePath));
+        return;
+    }
+    QTextStream stream(&file);
+    stream << "# Baseline of qupyunbenchmarks, one benchmark per line:\n"
+           << "# NAME ALLOCATIONS NANOSECONDS\n"
+           << "#\n"
+           << "# NAME is the test function and data tag, ALLOCATIONS the heap allocations\n"
+           << "# of one operation (-1 if not counted) and NANOSECONDS the fastest run of\n"
+           << "# one operation. Regenerate it on the reference machine with\n"
+           << "# QUPYUN_UPDATE_BASELINE=1 ./qupyunbenchmarks\n";
+    QMap<QByteArray, Result>::const_iterator i = results.constBegin();
+    while (i != results.constEnd()) {
+        stream << i.key() << ' ' << i.value().allocations << ' ' << i.value().nsecs << '\n';
+        ++i;
+    }
+}
+
+/*
+ * Fails if result regressed past the baseline, or has none. Allocations are
+ * exact, so only a small tolerance is allowed; times vary between runs and
+ * machines.
+ */
+void QUpYunBenchmarks::verify(const Result &result)
+{
+    QByteArray name = QByteArray(QTest::currentTestFunction()) + '/' + QTest::currentDataTag();
+    name.replace(' ', '_');
+    results.insert(name, result);
+    if (updating) {
+        qDebug("%s: %lld allocations, %lld ns", name.constData(), result.allocations, result.nsecs);
+        return;
+    }
+    QMap<QByteArray, Result>::const_iterator i = baseline.constFind(name);
+    if (i == baseline.constEnd()) {
+        QFAIL(qPrintable(QString::fromLatin1("No baseline for %1, regenerate it with QUPYUN_UPDATE_BASELINE=1")
+                         .arg(QString::fromLatin1(name))));
+    }
+    const Result &expected = i.value();
+    if (expected.allocations >= 0 && result.allocations >= 0
+            && result.allocations > expected.allocations * ALLOCATION_TOLERANCE + 1) {
+        QFAIL(qPrintable(QString::fromLatin1("%1 allocations, baseline %2")
+                         .arg(result.allocations).arg(expected.allocations)));
+    }
+    if (expected.nsecs > 0 && result.nsecs > expected.nsecs * timeTolerance) {
+        QFAIL(qPrintable(QString::fromLatin1("%1 ns, baseline %2 ns")
+                         .arg(result.nsecs).arg(expected.nsecs)));
+    }
+}
+
+void QUpYunBenchmarks::parseListing_data()
+{
+    QTest::addColumn<QByteArray>("body");
+
+    QTest::newRow("10 bytes") << QByteArray("ab\tN\t10\t1\n");
+    QTest::newRow("1k entries") << listingBody(1000);
+    QTest::newRow("100k entries") << listingBody(100000);
+    QTest::newRow("1M entries") << listingBody(1000000);
+}
+
+void QUpYunBenchmarks::parseListing()
+{
+    QFETCH(QByteArray, body);
+
+    QString directory = QLatin1Char('/') + QLatin1String(BUCKET) + QLatin1String("/photos/");
+    Measurement measurement;
+    QBENCHMARK {
+        measurement.start();
+        QUpYunItemList items;
+        items.appendListing(directory, body);
+        measurement.stop();
+    }
+    verify(measurement.result);
+}
+
+void QUpYunBenchmarks::ls_data()
+{
+    QTest::addColumn<int>("count");
+
+    // the loopback keeps every file in memory, so 1M entries are left to parseListing
+    QTest::newRow("1 entry") << 1;
+    QTest::newRow("1k entries") << 1000;
+    QTest::newRow("100k entries") << 100000;
+}
+
+void QUpYunBenchmarks::ls()
+{
+    QFETCH(int, count);
+
+    QString directory = QString::fromLatin1("/%1/ls%2/").arg(QLatin1String(BUCKET)).arg(count);
+    for (int i = 0; i < count; ++i) {
+        loopback->addFile(directory + QString::fromUtf8("照片_%1.jpg").arg(i), QByteArray());
+    }
+    QString path = QString::fromLatin1("/ls%1/").arg(count);
+    Measurement measurement;
+    QBENCHMARK {
+        measurement.start();
+        QFuture<QList<ItemInfo> > future = upyun->ls(path);
+        waitFor(future);
+        measurement.stop();
+        QCOMPARE(future.result().size(), count);
+    }
+    verify(measurement.result);
+}
+
+void QUpYunBenchmarks::longPath_data()
+{
+    QTest::addColumn<QString>("path");
+
+    QTest::newRow("ascii 64") << longPath(QLatin1String("photos"), 64);
+    QTest::newRow("utf-8 256") << longPath(QString::fromUtf8("旅行照片"), 256);
+    QTest::newRow("utf-8 1024") << longPath(QString::fromUtf8("旅行照片"), 1024);
+}
+
+void QUpYunBenchmarks::longPath()
+{
+    QFETCH(QString, path);
+
+    loopback->addFile(QLatin1Char('/') + QLatin1String(BUCKET) + path, QByteArray("data"));
+    Measurement measurement;
+    QBENCHMARK {
+        measurement.start();
+        QFuture<FileInfo> future = upyun->fileInfo(path);
+        waitFor(future);
+        measurement.stop();
+        QVERIFY(!future.isCanceled());
+    }
+    verify(measurement.result);
+}
+
+void QUpYunBenchmarks::manyHeaders_data()
+{
+    QTest::addColumn<int>("count");
+
+    QTest::newRow("0 headers") << 0;
+    QTest::newRow("16 headers") << 16;
+    QTest::newRow("128 headers") << 128;
+}
+
+void QUpYunBenchmarks::manyHeaders()
+{
+    QFETCH(int, count);
+
+    QUpYun::RequestParams params;
+    for (int i = 0; i < count; ++i) {
+        params.insert("x-upyun-meta-key" + QByteArray::number(i),
+                      QVariant(QByteArray("value-") + QByteArray::number(i)));
+    }
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    file.write(QByteArray(1024, 'x'));
+    file.flush();
+    QString path = QString::fromLatin1("/headers/%1.bin").arg(count);
+    Measurement measurement;
+    QBENCHMARK {
+        file.seek(0);
+        measurement.start();
+        QFuture<PicInfo> future = upyun->uploadFile(path, &file, true, false, QString(), params);
+        waitFor(future);
+        measurement.stop();
+        QVERIFY(!future.isCanceled());
+    }
+    verify(measurement.result);
+}
+
+QTEST_MAIN(QUpYunBenchmarks)
+
+#include "qupyunbenchmarks.moc"
@@ -0,0 +1,15 @@
+QT       += core network testlib
+QT       -= gui
+
+TARGET    = qupyunbenchmarks
+TEMPLATE  = app
+CONFIG   += console testcase release
+CONFIG   -= app_bundle debug
+
+include("../../source/qupyun.pri")
+
+DEFINES  += QUPYUN_BENCHMARK_BASELINE=\\\"$$PWD/baseline.txt\\\"
+
+SOURCES  += qupyunbenchmarks.cpp
+
+OTHER_FILES += baseline.txt
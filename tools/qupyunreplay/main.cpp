@@ -0,0 +1,546 @@
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFutureWatcher>
+#include <QHash>
+#include <QMap>
+#include <QSet>
+#include <QStringList>
+#include <QTemporaryFile>
+#include <QTextStream>
+#include <QTimer>
+#include <QUrl>
+#include <QVector>
+
+#include "qupyun.h"
+#include "qupyunloopbacktransport.h"
+#include "qupyunsession.h"
+#include "qupyuntrafficrecorder.h"
+
+static const char SEPARATOR = '/';
+
+struct Options
+{
+    QString trace;
+    double  speed;          // 0 to send requests as fast as possible.
+    int     latency;
+    int     maxConnections;
+    bool    adaptive;
+};
+
+static QByteArray headerOf(const QList<QPair<QByteArray, QByteArray> > &headers,
+                           const QByteArray &name)
+{
+    for (int i = 0; i < headers.size(); ++i) {
+        if (qstricmp(headers.at(i).first.constData(), name.constData()) == 0) {
+            return headers.at(i).second;
+        }
+    }
+    return QByteArray();
+}
+
+/*
+ * Source path of a recorded copy or move, with the bucket, or empty.
+ */
+static QString sourceOf(const TrafficRecord &record, bool *move)
+{
+    static QByteArray COPY_SOURCE("X-Upyun-Copy-Source");
+    static QByteArray MOVE_SOURCE("X-Upyun-Move-Source");
+
+    QByteArray source = headerOf(record.requestHeaders, MOVE_SOURCE);
+    *move = !source.isEmpty();
+    if (!*move) {
+        source = headerOf(record.requestHeaders, COPY_SOURCE);
+    }
+    return QUrl::fromPercentEncoding(source);
+}
+
+/*
+ * Path of record in the in-memory storage, without the query. Downloads
+ * from a download domain, recorded as //HOST/PATH, are stored as the files
+ * of a bucket named after the host.
+ */
+static QString storagePath(const TrafficRecord &record, bool *cdn)
+{
+    QString path = record.path.section(QLatin1Char('?'), 0, 0);
+    *cdn = path.startsWith(QLatin1String("//"));
+    return *cdn ? path.mid(1) : path;
+}
+
+static inline bool isSuccess(int status)
+{
+    return status >= 200 && status < 300;
+}
+
+/*
+ * Sorted samples at fraction, e.g. 0.99.
+ */
+static inline qint64 percentile(const QVector<qint64> &sorted, double fraction)
+{
+    if (sorted.isEmpty()) {
+        return 0;
+    }
+    return sorted.at(qMin(sorted.size() - 1, int(fraction * sorted.size())));
+}
+
+/*
+ * Memory of the process in kilobytes, by /proc where there is one, or -1.
+ */
+static qint64 memoryOf(const QByteArray &field)
+{
+    QFile status("/proc/self/status");
+    if (!status.open(QFile::ReadOnly)) {
+        return -1;
+    }
+    while (!status.atEnd()) {
+        QByteArray line = status.readLine();
+        if (line.startsWith(field)) {
+            return line.mid(field.size()).trimmed().split(' ').first().toLongLong();
+        }
+    }
+    return -1;
+}
+
+static QString megabytes(qint64 kilobytes)
+{
+    if (kilobytes < 0) {
+        return QLatin1String("n/a");
+    }
+    return QString::number(kilobytes / 1024.0, 'f', 1) + QLatin1String(" MB");
+}
+
+/*
+ * Sends the recorded requests through QUpYun at their recorded times,
+ * divided by the speed, against a loopback transport seeded with the files
+ * the recording read.
+ */
+class Replayer : public QObject
+{
+    Q_OBJECT
+public:
+    Replayer(const QList<TrafficRecord> &records, const Options &options, QObject *parent = 0);
+
+    void start();
+
+signals:
+    void done();
+
+private slots:
+    void issueDue();
+    void operationFinished();
+
+private:
+    struct Pending
+    {
+        QString operation;
+        qint64 issued;
+        bool expected;     // Whether the recorded request succeeded.
+    };
+
+    struct Stats
+    {
+        Stats() : failed(0), differed(0) {}
+
+        QVector<qint64> latencies;
+        QVector<qint64> recorded;
+        int failed;
+        int differed;
+    };
+
+    void seed();
+    void issue(const TrafficRecord &record);
+    QFuture<void> operation(const TrafficRecord &record, QString *name);
+    QUpYun *client(const QString &bucket);
+    QString bodyOf(qint64 size);
+    void finishIfDone();
+    void report();
+
+    QList<TrafficRecord> records;
+    Options options;
+    QUpYunLoopbackTransport *transport;
+    QUpYunSession *session;
+    QHash<QString, QUpYun *> clients;
+    QHash<qint64, QTemporaryFile *> bodies;
+    QHash<QFutureWatcher<void> *, Pending> pending;
+    QMap<QString, Stats> stats;
+    QElapsedTimer clock;
+    QTimer timer;
+    int next;
+    int skipped;
+    qint64 uploaded;
+    qint64 downloaded;
+    qint64 seededMemory;
+}; // end of class Replayer
+
+Replayer::Replayer(const QList<TrafficRecord> &records, const Options &options, QObject *parent) :
+    QObject(parent),
+    records(records),
+    options(options),
+    transport(new QUpYunLoopbackTransport(this)),
+    session(new QUpYunSession(this)),
+    next(0),
+    skipped(0),
+    uploaded(0),
+    downloaded(0),
+    seededMemory(-1)
+{
+    transport->setLatency(options.latency);
+    session->setTransport(transport);
+    session->setMaxConnections(options.maxConnections);
+    session->setAdaptiveConcurrency(options.adaptive);
+    timer.setSingleShot(true);
+    connect(&timer, SIGNAL(timeout()), this, SLOT(issueDue()));
+}
+
+void Replayer::start()
+{
+    seed();
+    seededMemory = memoryOf("VmRSS:");
+    clock.start();
+    issueDue();
+}
+
+/*
+ * Stores the files and folders which the recorded requests found, unless
+ * an earlier request of the recording created them.
+ */
+void Replayer::seed()
+{
+    static QByteArray FILE_TYPE("x-upyun-file-type");
+    static QByteArray FILE_SIZE("x-upyun-file-size");
+    static QByteArray FOLDER("folder");
+
+    QSet<QString> created;
+    foreach (const TrafficRecord &record, records) {
+        bool cdn;
+        QString path = storagePath(record, &cdn);
+        // the query of the CDN only carries the token
+        bool query = !cdn && record.path.contains(QLatin1Char('?'));
+        if (record.method == "PUT") {
+            bool move;
+            QString source = sourceOf(record, &move);
+            if (!source.isEmpty() && isSuccess(record.status) && !created.contains(source)) {
+                transport->addFile(source, QByteArray());
+                created.insert(source);
+            }
+            created.insert(path);
+            continue;
+        }
+        if (!isSuccess(record.status) || query || created.contains(path)) {
+            continue;
+        }
+        if (record.method == "GET") {
+            if (path.endsWith(QLatin1Char(SEPARATOR))) {
+                transport->addFolder(path);
+            } else {
+                transport->addFile(path, QByteArray(int(record.responseSize), 'x'));
+            }
+        } else if (record.method == "HEAD") {
+            if (headerOf(record.responseHeaders, FILE_TYPE) == FOLDER) {
+                transport->addFolder(path);
+            } else {
+                qint64 size = headerOf(record.responseHeaders, FILE_SIZE).toLongLong();
+                transport->addFile(path, QByteArray(int(size), 'x'));
+            }
+        } else if (record.method == "DELETE") {
+            transport->addFile(path, QByteArray());
+        }
+        created.insert(path);
+    }
+}
+
+void Replayer::issueDue()
+{
+    qint64 now = clock.elapsed();
+    qint64 origin = records.isEmpty() ? 0 : records.first().time;
+    while (next < records.size()) {
+        const TrafficRecord &record = records.at(next);
+        qint64 due = options.speed > 0 ? qint64((record.time - origin) / options.speed) : 0;
+        if (due > now) {
+            timer.start(int(due - now));
+            return;
+        }
+        ++next;
+        issue(record);
+    }
+    finishIfDone();
+}
+
+void Replayer::issue(const TrafficRecord &record)
+{
+    QString name;
+    qint64 issued = clock.elapsed();
+    QFuture<void> future = operation(record, &name);
+    if (name.isEmpty()) {
+        ++skipped;
+        return;
+    }
+    Stats &operationStats = stats[name];
+    operationStats.recorded.append(record.latency);
+    QFutureWatcher<void> *watcher = new QFutureWatcher<void>(this);
+    connect(watcher, SIGNAL(finished()), this, SLOT(operationFinished()));
+    Pending started;
+    started.operation = name;
+    started.issued = issued;
+    started.expected = isSuccess(record.status);
+    pending.insert(watcher, started);
+    watcher->setFuture(future);
+}
+
+/*
+ * Calls the QUpYun method which sends record, and sets name to the
+ * operation, or leaves it empty if the request is not one QUpYun sends.
+ */
+QFuture<void> Replayer::operation(const TrafficRecord &record, QString *name)
+{
+    static QByteArray MKDIR("mkdir");
+    static QByteArray FOLDER("folder");
+    static QByteArray TRUE_VALUE("true");
+
+    bool cdn;
+    QString full = storagePath(record, &cdn);
+    QString query = record.path.section(QLatin1Char('?'), 1);
+    QString bucket = full.section(QLatin1Char(SEPARATOR), 1, 1);
+    if (bucket.isEmpty()) {
+        return QFuture<void>();
+    }
+    QString path = full.mid(bucket.size() + 1);
+    if (path.isEmpty()) {
+        path = QLatin1Char(SEPARATOR);
+    }
+    QUpYun *upyun = client(bucket);
+
+    if (cdn) {
+        if (record.method != "GET" || path.endsWith(QLatin1Char(SEPARATOR))) {
+            return QFuture<void>();
+        }
+        *name = QLatin1String("cdn");
+        downloaded += record.responseSize;
+        return upyun->downloadFile(path);
+    } else if (record.method == "GET") {
+        if (query == QLatin1String("usage")) {
+            *name = QLatin1String("usage");
+            return upyun->bucketUsage();
+        } else if (path.endsWith(QLatin1Char(SEPARATOR))) {
+            *name = QLatin1String("ls");
+            return upyun->ls(path);
+        }
+        *name = QLatin1String("download");
+        downloaded += record.responseSize;
+        return upyun->downloadFile(path);
+    } else if (record.method == "PUT") {
+        bool autoMkdir = headerOf(record.requestHeaders, MKDIR) == TRUE_VALUE;
+        if (headerOf(record.requestHeaders, FOLDER) == TRUE_VALUE) {
+            *name = QLatin1String("mkdir");
+            return upyun->mkdir(path, autoMkdir);
+        }
+        bool move;
+        QString source = sourceOf(record, &move);
+        if (source.startsWith(QLatin1Char(SEPARATOR) + bucket + QLatin1Char(SEPARATOR))) {
+            source = source.mid(bucket.size() + 1);
+            *name = QLatin1String(move ? "move" : "copy");
+            return move ? upyun->moveFile(source, path, autoMkdir)
+                        : upyun->copyFile(source, path, autoMkdir);
+        }
+        QUpYun::RequestParams params;
+        for (int i = 0; i < record.requestHeaders.size(); ++i) {
+            const QByteArray &header = record.requestHeaders.at(i).first;
+            if (qstricmp(header.constData(), MKDIR.constData()) != 0) {
+                params.insert(header, record.requestHeaders.at(i).second);
+            }
+        }
+        *name = QLatin1String("upload");
+        uploaded += record.requestSize;
+        QFile body(bodyOf(record.requestSize));
+        return upyun->uploadFile(path, &body, autoMkdir, false, QString(), params);
+    } else if (record.method == "HEAD") {
+        *name = QLatin1String("info");
+        return upyun->fileInfo(path);
+    } else if (record.method == "DELETE") {
+        *name = QLatin1String("remove");
+        return upyun->removeFile(path);
+    }
+    return QFuture<void>();
+}
+
+QUpYun *Replayer::client(const QString &bucket)
+{
+    QUpYun *&upyun = clients[bucket];
+    if (!upyun) {
+        upyun = new QUpYun(session, bucket, QLatin1String("replay"), QLatin1String("replay"), this);
+    }
+    return upyun;
+}
+
+/*
+ * Path of a file of size bytes, shared by the uploads of that size.
+ */
+QString Replayer::bodyOf(qint64 size)
+{
+    QTemporaryFile *&body = bodies[size];
+    if (!body) {
+        body = new QTemporaryFile(this);
+        if (body->open()) {
+            body->resize(size);
+            body->close();
+        }
+    }
+    return body->fileName();
+}
+
+void Replayer::operationFinished()
+{
+    QFutureWatcher<void> *watcher = static_cast<QFutureWatcher<void> *>(sender());
+    Pending finished = pending.take(watcher);
+    Stats &operationStats = stats[finished.operation];
+    operationStats.latencies.append(clock.elapsed() - finished.issued);
+    bool succeeded = !watcher->isCanceled();
+    if (!succeeded) {
+        ++operationStats.failed;
+    }
+    if (succeeded != finished.expected) {
+        ++operationStats.differed;
+    }
+    watcher->deleteLater();
+    finishIfDone();
+}
+
+void Replayer::finishIfDone()
+{
+    if (next < records.size() || !pending.isEmpty()) {
+        return;
+    }
+    report();
+    emit done();
+}
+
+void Replayer::report()
+{
+    QTextStream out(stdout);
+    qint64 elapsed = qMax(qint64(1), clock.elapsed());
+    qint64 recordedTime = records.isEmpty() ? 0
+            : records.last().time + records.last().latency - records.first().time;
+    int count = 0;
+    int failed = 0;
+    int differed = 0;
+    QVector<qint64> all;
+    QVector<qint64> allRecorded;
+    QMap<QString, Stats>::iterator i = stats.begin();
+    for (; i != stats.end(); ++i) {
+        qSort(i.value().latencies);
+        qSort(i.value().recorded);
+        count += i.value().latencies.size();
+        failed += i.value().failed;
+        differed += i.value().differed;
+        all += i.value().latencies;
+        allRecorded += i.value().recorded;
+    }
+    qSort(all);
+    qSort(allRecorded);
+
+    out << "Requests:    " << count << " (" << failed << " failed, " << differed
+        << " differ from the recording, " << skipped << " skipped)\n";
+    out << "Duration:    " << elapsed << " ms (recorded " << recordedTime << " ms)\n";
+    out << "Throughput:  " << QString::number(count * 1000.0 / elapsed, 'f', 1) << " req/s, "
+        << QString::number(uploaded / 1024.0 / 1024.0 * 1000.0 / elapsed, 'f', 2) << " MB/s up, "
+        << QString::number(downloaded / 1024.0 / 1024.0 * 1000.0 / elapsed, 'f', 2) << " MB/s down\n";
+    out << "Memory:      peak " << megabytes(memoryOf("VmHWM:"))
+        << ", after seeding " << megabytes(seededMemory)
+        << ", mock storage " << megabytes(transport->storedBytes() / 1024) << "\n";
+    out << "\nLatency (ms)  count    p50    p90    p99    max  recorded p50    p99\n";
+    for (i = stats.begin(); i != stats.end(); ++i) {
+        const Stats &operationStats = i.value();
+        out << qSetFieldWidth(12) << left << i.key() << qSetFieldWidth(7) << right
+            << operationStats.latencies.size()
+            << percentile(operationStats.latencies, 0.5)
+            << percentile(operationStats.latencies, 0.9)
+            << percentile(operationStats.latencies, 0.99)
+            << percentile(operationStats.latencies, 1.0)
+            << qSetFieldWidth(14) << percentile(operationStats.recorded, 0.5)
+            << qSetFieldWidth(7) << percentile(operationStats.recorded, 0.99)
+            << qSetFieldWidth(0) << "\n";
+    }
+    out << qSetFieldWidth(12) << left << "all" << qSetFieldWidth(7) << right
+        << all.size()
+        << percentile(all, 0.5)
+        << percentile(all, 0.9)
+        << percentile(all, 0.99)
+        << percentile(all, 1.0)
+        << qSetFieldWidth(14) << percentile(allRecorded, 0.5)
+        << qSetFieldWidth(7) << percentile(allRecorded, 0.99)
+        << qSetFieldWidth(0) << "\n";
+}
+
+static void usage()
+{
+    QTextStream(stderr)
+            << "Usage: qupyunreplay [options] RECORDING\n"
+            << "Replays a recording of QUpYunTrafficRecorder against an in-memory server.\n\n"
+            << "  --speed FACTOR         Replay FACTOR times faster, 0 for no delay (1)\n"
+            << "  --latency MSECS        Latency of the in-memory server (0)\n"
+            << "  --max-connections N    Requests in flight at most (6)\n"
+            << "  --adaptive             Enable adaptive concurrency\n";
+}
+
+static bool parseOptions(const QStringList &arguments, Options *options)
+{
+    options->speed = 1;
+    options->latency = 0;
+    options->maxConnections = 6;
+    options->adaptive = false;
+    for (int i = 1; i < arguments.size(); ++i) {
+        const QString &argument = arguments.at(i);
+        bool ok = true;
+        if (argument == QLatin1String("--adaptive")) {
+            options->adaptive = true;
+        } else if (argument.startsWith(QLatin1String("--"))) {
+            if (i + 1 >= arguments.size()) {
+                return false;
+            }
+            QString value = arguments.at(++i);
+            if (argument == QLatin1String("--speed")) {
+                options->speed = value.toDouble(&ok);
+                ok = ok && options->speed >= 0;
+            } else if (argument == QLatin1String("--latency")) {
+                options->latency = value.toInt(&ok);
+            } else if (argument == QLatin1String("--max-connections")) {
+                options->maxConnections = value.toInt(&ok);
+            } else {
+                return false;
+            }
+        } else if (options->trace.isEmpty()) {
+            options->trace = argument;
+        } else {
+            return false;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return !options->trace.isEmpty();
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    Options options;
+    if (!parseOptions(app.arguments(), &options)) {
+        usage();
+        return 2;
+    }
+    QFile trace(options.trace);
+    if (!trace.open(QFile::ReadOnly)) {
+        QTextStream(stderr) << "Cannot open " << options.trace << ": " << trace.errorString() << "\n";
+        return 1;
+    }
+    QList<TrafficRecord> records = QUpYunTrafficRecorder::load(&trace);
+    trace.close();
+
+    Replayer replayer(records, options);
+    QObject::connect(&replayer, SIGNAL(done()), &app, SLOT(quit()), Qt::QueuedConnection);
+    replayer.start();
+    return app.exec();
+}
+
+#include "main.moc"
@@ -0,0 +1,11 @@
+QT       += core network
+QT       -= gui
+
+TARGET    = qupyunreplay
+TEMPLATE  = app
+CONFIG   += console
+CONFIG   -= app_bundle
+
+include("../../source/qupyun.pri")
+
+SOURCES  += main.cpp